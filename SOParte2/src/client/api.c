@@ -1,4 +1,7 @@
 #include <errno.h>
+#include <fnmatch.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -6,215 +9,1662 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "api.h"
+#include "cache.h"
+#include "keyset.h"
 #include "src/common/constants.h"
+#include "src/common/io.h"
 #include "src/common/protocol.h"
+#include "src/common/shm.h"
 
-int REQ_FD_WR;
-int RESP_FD_RD;
-int NOTIF_FD_RD;
+#define RESPONSE_READ_SIZE (16 * 1024)
 
-char REQ_PIPE_PATH[MAX_PIPE_PATH_LENGTH];
-char RESP_PIPE_PATH[MAX_PIPE_PATH_LENGTH];
-char NOTIF_PIPE_PATH[MAX_PIPE_PATH_LENGTH];
+typedef struct PendingRequest PendingRequest;
 
-/**
- * helper function to send messages
- * retries to send whatever was not sent in the beginning
- */
-void send_msg(int fd, char const *str) {
-    size_t len = strlen(str);
-    size_t written = 0;
+// Keys of a write or delete whose cache entries wait for the versions in
+// its response
+typedef struct {
+  size_t count;
+  char keys[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+  uint64_t marks[MAX_REQUEST_KEYS];
+} StaleKeys;
 
-    while (written < len) {
-        ssize_t ret = write(fd, str + written, len - written);
-        if (ret < 0) {
-            perror("Write failed");
-            exit(EXIT_FAILURE);
-        }
+// Turns the status and payload of a response into the result of the API call,
+// decoding the payload into the caller's buffers. payload is NULL if the
+// session was lost.
+typedef int (*CompleteFn)(const PendingRequest *pending, int status, const char *payload);
 
-        written += (size_t)ret;
+// A request sent to the server and waiting for its response. Request i uses
+// slot i % MAX_PENDING_REQUESTS, so the response thread finds it directly.
+struct PendingRequest {
+  int in_use;
+  int done;
+  uint32_t request_id;
+  uint8_t op_code;
+  int status;            // Response status, -1 if the session was lost
+  void *response;        // Where to copy the response payload
+  size_t response_size;  // Exact size of the expected response payload
+  pthread_cond_t done_cond;
+
+  // Asynchronous requests: nobody waits on done_cond; the response thread
+  // completes them into these buffers and calls callback
+  CompleteFn complete;
+  KvsCallback callback;
+  void *callback_arg;
+  size_t count;
+  char (*values)[MAX_STRING_SIZE];
+  int *flags;
+  KvsConnection *conn;
+  StaleKeys *stale;           // WRITE and DELETE with a cache, freed on completion
+  char key[MAX_STRING_SIZE];  // Key of a SUBSCRIBE
+  int tracked;                // The SUBSCRIBE added key to app_keys
+};
+
+// Callback of an asynchronous request answered without the server, e.g.
+// from the cache, left for the response thread to run
+typedef struct LocalCompletion {
+  KvsCallback callback;
+  void *arg;
+  struct LocalCompletion *next;
+} LocalCompletion;
+
+// Callback for the notifications of one key
+typedef struct {
+  char key[MAX_STRING_SIZE];
+  KvsNotifyFn notify;
+  void *arg;
+} NotificationHandler;
+
+// Everything a session needs, so a process may hold several at once.
+struct KvsConnection {
+  int req_fd;    // Request pipe (write end), or the socket
+  int resp_fd;   // Response pipe (read end), or the same socket
+  int notif_fd;  // Notification pipe (read end), handed to the caller
+
+  char req_pipe_path[MAX_PIPE_PATH_LENGTH];
+  char resp_pipe_path[MAX_PIPE_PATH_LENGTH];
+  char notif_pipe_path[MAX_PIPE_PATH_LENGTH];
+
+  // With the socket transport, req_fd and resp_fd are the same socket and
+  // notifications are forwarded by the response thread to an internal pipe,
+  // whose read end is notif_fd.
+  int socket_transport;
+  int notif_forward_fd;
+
+  // Shared memory rings, if the server accepted ATTACH_SHM. Requests are then
+  // written to shm->requests (one writer at a time) and responses read from
+  // shm->responses; notifications keep their pipe or socket.
+  ShmSegment *shm;
+  pthread_mutex_t shm_send_mutex;
+  pthread_t notif_thread;
+
+  PendingRequest pending[MAX_PENDING_REQUESTS];
+  pthread_mutex_t pending_mutex;
+  pthread_cond_t pending_slot_cond;
+  uint32_t next_request_id;  // 0 is used by CONNECT and notifications
+  int session_lost;
+  pthread_t response_thread;
+
+  // Requests answered locally, in order, protected by pending_mutex. wake_fds
+  // is a non-blocking pipe that wakes the response thread to run them; with
+  // shared memory the response ring is woken instead.
+  LocalCompletion *local_head;
+  LocalCompletion *local_tail;
+  int wake_fds[2];
+
+  // Notification callbacks, run by the dispatch thread once the first one is set
+  NotificationHandler handlers[MAX_NOTIFICATION_HANDLERS];
+  size_t handler_count;
+  KvsNotifyFn default_notify;  // Keys without a handler of their own
+  void *default_arg;
+  pthread_mutex_t handlers_mutex;
+  int dispatching;
+  pthread_t dispatch_thread;
+
+  // Subscriptions of the application itself, protected by handlers_mutex.
+  // The server sends one notification per key even when both the cache and
+  // the application subscribed to it, so these decide who gets it.
+  KeySet *app_keys;
+  char (*app_patterns)[MAX_STRING_SIZE];
+  size_t app_pattern_count;
+  size_t app_pattern_capacity;
+
+  NearCache *cache;  // NULL unless kvs_cache_enable was called
+  char (*invalidated)[MAX_STRING_SIZE];  // As many keys as the cache, for the dispatch thread
+
+  // Read only by the response thread
+  char response_buffer[RESPONSE_READ_SIZE];
+  size_t response_start;
+  size_t response_end;
+  char shm_payload[FRAME_MAX_PAYLOAD];
+};
+
+static KvsConnection *connection_new(void) {
+  KvsConnection *conn = calloc(1, sizeof(KvsConnection));
+  if (conn == NULL) {
+    perror("Failed to allocate connection");
+    return NULL;
+  }
+  conn->req_fd = -1;
+  conn->resp_fd = -1;
+  conn->notif_fd = -1;
+  conn->notif_forward_fd = -1;
+  conn->next_request_id = 1;
+  conn->session_lost = 1;
+  conn->app_keys = keyset_new();
+  if (conn->app_keys == NULL) {
+    perror("Failed to allocate connection");
+    free(conn);
+    return NULL;
+  }
+  if (pipe(conn->wake_fds) != 0) {
+    perror("Failed to create wake pipe");
+    keyset_free(conn->app_keys);
+    free(conn);
+    return NULL;
+  }
+  fcntl(conn->wake_fds[0], F_SETFL, O_NONBLOCK);
+  fcntl(conn->wake_fds[1], F_SETFL, O_NONBLOCK);
+  pthread_mutex_init(&conn->shm_send_mutex, NULL);
+  pthread_mutex_init(&conn->pending_mutex, NULL);
+  pthread_cond_init(&conn->pending_slot_cond, NULL);
+  pthread_mutex_init(&conn->handlers_mutex, NULL);
+  for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+    pthread_cond_init(&conn->pending[i].done_cond, NULL);
+  }
+  return conn;
+}
+
+static void connection_free(KvsConnection *conn) {
+  for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+    pthread_cond_destroy(&conn->pending[i].done_cond);
+  }
+  pthread_cond_destroy(&conn->pending_slot_cond);
+  pthread_mutex_destroy(&conn->handlers_mutex);
+  pthread_mutex_destroy(&conn->pending_mutex);
+  pthread_mutex_destroy(&conn->shm_send_mutex);
+  if (conn->cache != NULL) {
+    cache_free(conn->cache);
+  }
+  free(conn->invalidated);
+  keyset_free(conn->app_keys);
+  free(conn->app_patterns);
+  close(conn->wake_fds[0]);
+  close(conn->wake_fds[1]);
+  free(conn);
+}
+
+// Closes the descriptors of a session that never started or has ended
+static void close_session_fds(KvsConnection *conn) {
+  int fds[] = {conn->req_fd, conn->resp_fd, conn->notif_fd, conn->notif_forward_fd};
+  for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+    // With the socket transport req_fd and resp_fd are the same descriptor
+    if (fds[i] != -1 && (i != 1 || fds[1] != fds[0])) {
+      close(fds[i]);
     }
+  }
 }
 
+// Reads the next response frame. Responses are read from the pipe in large
+// chunks, so a burst of pipelined responses costs a single read.
+// @return 1 on success, 2 if woken through wake_fds, 0 on end of file, -1 on
+// error.
+static int next_response(KvsConnection *conn, FrameHeader *header, const char **payload) {
+  char *buffer = conn->response_buffer;
+
+  for (;;) {
+    size_t available = conn->response_end - conn->response_start;
+    if (available >= FRAME_HEADER_SIZE) {
+      decode_frame_header(buffer + conn->response_start, header);
+      if (header->length > FRAME_MAX_PAYLOAD) {
+        return -1;
+      }
+      if (available >= FRAME_HEADER_SIZE + (size_t)header->length) {
+        *payload = buffer + conn->response_start + FRAME_HEADER_SIZE;
+        conn->response_start += FRAME_HEADER_SIZE + header->length;
+        return 1;
+      }
+    }
 
-void copy_and_pad(const char *src, char *dest) {
-  size_t len = strlen(src);
-  if (len > MAX_PIPE_PATH_LENGTH) len = MAX_PIPE_PATH_LENGTH;
-  memcpy(dest, src, len);
-  memset(dest + len, '\0', MAX_PIPE_PATH_LENGTH - len);  // Fill the rest with '\0'
+    // Moves the partial frame to the start of the buffer and reads more
+    memmove(buffer, buffer + conn->response_start, available);
+    conn->response_start = 0;
+    conn->response_end = available;
+    struct pollfd fds[2] = {{.fd = conn->resp_fd, .events = POLLIN}, {.fd = conn->wake_fds[0], .events = POLLIN}};
+    if (poll(fds, 2, -1) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (fds[1].revents & POLLIN) {
+      char drain[64];
+      while (read(conn->wake_fds[0], drain, sizeof(drain)) > 0) {
+      }
+      return 2;
+    }
+    ssize_t result = read(conn->resp_fd, buffer + conn->response_end, RESPONSE_READ_SIZE - conn->response_end);
+    if (result == -1 && errno == EINTR) {
+      continue;
+    }
+    if (result <= 0) {
+      conn->response_start = conn->response_end = 0;
+      return (int)result;
+    }
+    conn->response_end += (size_t)result;
+  }
 }
 
-void build_message_paths(const char *req_pipe_path, const char *resp_pipe_path, const char *notifications_pipe_path, char *message) {
-    snprintf(message, MAX_PIPE_PATH_LENGTH, "1|%s|%s|%s", req_pipe_path, resp_pipe_path, notifications_pipe_path);
+// Reads the next response, from the shared memory ring if there is one.
+// @return As next_response.
+static int read_response(KvsConnection *conn, FrameHeader *header, const char **payload) {
+  if (conn->shm != NULL) {
+    *payload = conn->shm_payload;
+    int result = shm_ring_wait_frame(&conn->shm->responses);
+    if (result != 1) {
+      return result;
+    }
+    return shm_ring_recv_frame(&conn->shm->responses, header, conn->shm_payload, FRAME_MAX_PAYLOAD);
+  }
+  return next_response(conn, header, payload);
 }
-void build_message(const char *req_pipe_path, const char *resp_pipe_path, const char *notifications_pipe_path, char *message) {
-  // Start with OP_CODE=1
-  message[0] = (char) 1;
 
-  // Copy and pad the pipe names into the message
-  copy_and_pad(req_pipe_path, message + 1);
-  copy_and_pad(resp_pipe_path, message + 1 + MAX_PIPE_PATH_LENGTH);
-  copy_and_pad(notifications_pipe_path, message + 1 + 2 * MAX_PIPE_PATH_LENGTH);
+// Completes an asynchronous request: frees its slot and then, without the
+// lock, decodes the response and runs the callback. Called with
+// pending_mutex, which it releases.
+static void complete_async(KvsConnection *conn, PendingRequest *pending, int status, const char *payload) {
+  PendingRequest completed = *pending;
+  pending->in_use = 0;
+  pending->callback = NULL;
+  pthread_cond_broadcast(&conn->pending_slot_cond);
+  pthread_mutex_unlock(&conn->pending_mutex);
+
+  int result = completed.complete(&completed, status, payload);
+  completed.callback(result, completed.callback_arg);
+}
+
+// Runs the callbacks of the requests answered locally so far
+static void run_local_completions(KvsConnection *conn) {
+  pthread_mutex_lock(&conn->pending_mutex);
+  LocalCompletion *completion = conn->local_head;
+  conn->local_head = conn->local_tail = NULL;
+  pthread_mutex_unlock(&conn->pending_mutex);
+
+  while (completion != NULL) {
+    LocalCompletion *next = completion->next;
+    completion->callback(0, completion->arg);
+    free(completion);
+    completion = next;
+  }
 }
 
-char read_msg(int fd) {
-  char buffer[2];
-  ssize_t ret = read(fd, buffer, 2);
-  if (ret == 0) {
-      // ret == 0 indicates EOF
-      fprintf(stderr, "pipe closed\n");
-      return '\0';
-  } else if (ret == -1) {
-      // ret == -1 indicates error
-      fprintf(stderr, "read failed: %s\n", strerror(errno));
-      exit(EXIT_FAILURE);
+// Leaves the callback of a request answered locally for the response
+// thread, so that every callback runs there, as for requests the server
+// answers.
+// @return 0 on success, -1 if the session was lost or there is not enough
+// memory.
+static int complete_locally(KvsConnection *conn, KvsCallback callback, void *arg) {
+  LocalCompletion *completion = malloc(sizeof(LocalCompletion));
+  if (completion == NULL) {
+    return -1;
+  }
+  completion->callback = callback;
+  completion->arg = arg;
+  completion->next = NULL;
+
+  pthread_mutex_lock(&conn->pending_mutex);
+  if (conn->session_lost) {
+    pthread_mutex_unlock(&conn->pending_mutex);
+    free(completion);
+    return -1;
+  }
+  if (conn->local_tail != NULL) {
+    conn->local_tail->next = completion;
+  } else {
+    conn->local_head = completion;
   }
+  conn->local_tail = completion;
+  pthread_mutex_unlock(&conn->pending_mutex);
 
-  return buffer[1];
+  if (conn->shm != NULL) {
+    shm_ring_wake(&conn->shm->responses);
+  } else if (write(conn->wake_fds[1], "", 1) == -1 && errno != EAGAIN) {
+    perror("Failed to wake response thread");
+  }
+  return 0;
 }
 
-int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
-                char const *notif_pipe_path, char const *server_pipe_path, int *notif_pipe) {
-  int fifo_fd_wr = open(server_pipe_path, O_WRONLY);
-  if (fifo_fd_wr == -1) {
-    perror("Failed to open FIFO");
-    exit(EXIT_FAILURE);
+// With shared memory over the socket transport, responses come from the ring
+// and only notifications are left on the socket for this thread to forward.
+static void *thread_socket_notifications(void *arg) {
+  KvsConnection *conn = arg;
+  char payload[FRAME_MAX_PAYLOAD];
+
+  for (;;) {
+    FrameHeader header;
+    if (recv_packet(conn->resp_fd, &header, payload, FRAME_MAX_PAYLOAD) != 1) {
+      break;
+    }
+    if (header.op_code == OP_CODE_NOTIFICATION) {
+      send_frame(conn->notif_forward_fd, OP_CODE_NOTIFICATION, header.status, 0, payload, header.length);
+    }
+  }
+
+  close(conn->notif_forward_fd);
+  conn->notif_forward_fd = -1;
+  return NULL;
+}
+
+// Reads every response from the server and hands it to the request with the
+// same id. When the response pipe closes, wakes every request still waiting.
+static void *thread_responses(void *arg) {
+  KvsConnection *conn = arg;
+
+  for (;;) {
+    FrameHeader header;
+    const char *payload;
+    int result = read_response(conn, &header, &payload);
+    if (result == 2) {
+      run_local_completions(conn);
+      continue;
+    }
+    if (result != 1) {
+      break;
+    }
+
+    if (header.op_code == OP_CODE_NOTIFICATION && conn->socket_transport) {
+      send_frame(conn->notif_forward_fd, OP_CODE_NOTIFICATION, header.status, 0, payload, header.length);
+      continue;
+    }
+
+    pthread_mutex_lock(&conn->pending_mutex);
+    PendingRequest *pending = &conn->pending[header.request_id % MAX_PENDING_REQUESTS];
+    if (!pending->in_use || pending->done || pending->request_id != header.request_id) {
+      fprintf(stderr, "Unexpected response for request %u\n", header.request_id);
+      pthread_mutex_unlock(&conn->pending_mutex);
+      continue;
+    }
+    int valid = header.op_code == pending->op_code && header.length == pending->response_size;
+    if (!valid) {
+      fprintf(stderr, "Unexpected response op_code %u\n", header.op_code);
+    }
+    if (pending->callback != NULL) {
+      complete_async(conn, pending, valid ? header.status : -1, valid ? payload : NULL);
+      continue;
+    }
+    if (!valid) {
+      pending->status = -1;
+    } else {
+      if (header.length > 0) {
+        memcpy(pending->response, payload, header.length);
+      }
+      pending->status = header.status;
+    }
+    pending->done = 1;
+    pthread_cond_signal(&pending->done_cond);
+    pthread_mutex_unlock(&conn->pending_mutex);
   }
 
-  /* remove pipes if they exist */
-  if (unlink(req_pipe_path) != 0 && errno != ENOENT) {
-    perror("unlink(%s) failed");
-    exit(EXIT_FAILURE);
+  pthread_mutex_lock(&conn->pending_mutex);
+  conn->session_lost = 1;
+  for (int i = 0; i < MAX_PENDING_REQUESTS; i++) {
+    if (conn->pending[i].in_use && conn->pending[i].callback != NULL) {
+      complete_async(conn, &conn->pending[i], -1, NULL);
+      pthread_mutex_lock(&conn->pending_mutex);
+    } else if (conn->pending[i].in_use && !conn->pending[i].done) {
+      conn->pending[i].status = -1;
+      conn->pending[i].done = 1;
+      pthread_cond_signal(&conn->pending[i].done_cond);
+    }
   }
-  if (unlink(resp_pipe_path) != 0 && errno != ENOENT) {
-    perror("unlink(%s) failed");
-    exit(EXIT_FAILURE);
+  pthread_cond_broadcast(&conn->pending_slot_cond);
+  pthread_mutex_unlock(&conn->pending_mutex);
+  // No more are queued once session_lost is set
+  run_local_completions(conn);
+
+  // Ends the notifications, as the server closing the notification pipe would
+  if (conn->socket_transport && conn->shm == NULL) {
+    close(conn->notif_forward_fd);
+    conn->notif_forward_fd = -1;
   }
-  if (unlink(notif_pipe_path) != 0 && errno != ENOENT) {
-    perror("unlink(%s) failed");
-    exit(EXIT_FAILURE);
+  return NULL;
+}
+
+// Takes the slot of the next request id, waiting while an older request
+// still holds it. Called with pending_mutex.
+// @return The slot, or NULL if the session was lost.
+static PendingRequest *claim_pending(KvsConnection *conn, uint8_t op_code, size_t response_size) {
+  uint32_t request_id = conn->next_request_id++;
+  if (conn->next_request_id == 0) {
+    conn->next_request_id = 1;
+  }
+  PendingRequest *pending = &conn->pending[request_id % MAX_PENDING_REQUESTS];
+  while (pending->in_use && !conn->session_lost) {
+    pthread_cond_wait(&conn->pending_slot_cond, &conn->pending_mutex);
   }
+  if (conn->session_lost) {
+    return NULL;
+  }
+  pending->in_use = 1;
+  pending->done = 0;
+  pending->request_id = request_id;
+  pending->op_code = op_code;
+  pending->response = NULL;
+  pending->response_size = response_size;
+  pending->callback = NULL;
+  return pending;
+}
 
-  /* create pipes */
-  if (mkfifo(req_pipe_path, 0640) != 0) {
-    perror("mkfifo failed");
-    exit(EXIT_FAILURE);
+// @return 1 if the request frame was sent, 0 otherwise.
+static int send_request(KvsConnection *conn, const PendingRequest *pending, const void *payload,
+                        size_t length) {
+  if (conn->shm != NULL) {
+    char frame[FRAME_MAX_SIZE];
+    size_t size = encode_frame(frame, pending->op_code, 0, pending->request_id, payload, length);
+    pthread_mutex_lock(&conn->shm_send_mutex);
+    int sent = shm_ring_write(&conn->shm->requests, frame, size) == 1;
+    pthread_mutex_unlock(&conn->shm_send_mutex);
+    return sent;
   }
-  if (mkfifo(resp_pipe_path, 0640) != 0) {
-    perror("mkfifo failed");
-    exit(EXIT_FAILURE);
+  return send_frame(conn->req_fd, pending->op_code, 0, pending->request_id, payload, length) == 1;
+}
+
+// Sends a request frame and waits for the matching response frame. Several
+// threads may call it at once: their requests are pipelined on the session
+// and each one waits only for its own response.
+// @param response Buffer for the response payload, may be NULL if response_size is 0.
+// @param response_size Exact size of the expected response payload.
+// @return The status of the response, or -1 if the server could not be reached.
+static int request(KvsConnection *conn, uint8_t op_code, const void *payload, size_t length,
+                   void *response, size_t response_size) {
+  pthread_mutex_lock(&conn->pending_mutex);
+  PendingRequest *pending = claim_pending(conn, op_code, response_size);
+  if (pending == NULL) {
+    pthread_mutex_unlock(&conn->pending_mutex);
+    return -1;
   }
-  if (mkfifo(notif_pipe_path, 0640) != 0) {
-    perror("mkfifo failed");
-    exit(EXIT_FAILURE);
+  pending->response = response;
+  pthread_mutex_unlock(&conn->pending_mutex);
+
+  int sent = send_request(conn, pending, payload, length);
+
+  pthread_mutex_lock(&conn->pending_mutex);
+  while (sent && !pending->done) {
+    pthread_cond_wait(&pending->done_cond, &conn->pending_mutex);
   }
-  strcpy(REQ_PIPE_PATH, req_pipe_path);
-  strcpy(RESP_PIPE_PATH, resp_pipe_path);
-  strcpy(NOTIF_PIPE_PATH, notif_pipe_path);
+  int status = sent ? pending->status : -1;
+  pending->in_use = 0;
+  pthread_cond_broadcast(&conn->pending_slot_cond);
+  pthread_mutex_unlock(&conn->pending_mutex);
 
-  // send connect message to request pipe and wait for response in response pipe
-  char message[1 + 3 * MAX_PIPE_PATH_LENGTH] = {0};
+  if (status == -1) {
+    fprintf(stderr, "Failed to read response from server\n");
+  }
+  return status;
+}
 
-  build_message_paths(req_pipe_path, resp_pipe_path, notif_pipe_path, message);
+// Asks the server to move the session to shared memory rings. The server
+// only offers them if started with -m; otherwise the session keeps its pipes.
+// @return 0 if the session uses the rings or kept its pipes, 1 if the session
+// was lost.
+static int attach_shm(KvsConnection *conn) {
+  if (send_frame(conn->req_fd, OP_CODE_ATTACH_SHM, 0, 0, NULL, 0) != 1) {
+    return 1;
+  }
 
-  send_msg(fifo_fd_wr, message);
+  FrameHeader header;
+  char payload[PATH_FIELD_SIZE];
+  int result = conn->socket_transport ? recv_packet(conn->resp_fd, &header, payload, PATH_FIELD_SIZE)
+                                      : recv_frame(conn->resp_fd, &header, payload, PATH_FIELD_SIZE, NULL);
+  if (result != 1 || header.op_code != OP_CODE_ATTACH_SHM) {
+    return 1;
+  }
+  if (header.status != 0) {
+    return 0;
+  }
+  if (header.length != PATH_FIELD_SIZE) {
+    return 1;
+  }
 
-  RESP_FD_RD = open(resp_pipe_path, O_RDONLY);
-  if (RESP_FD_RD == -1) {
-    perror("Failed to open FIFO");
-    exit(EXIT_FAILURE);
+  char name[PATH_FIELD_SIZE];
+  decode_field(name, payload, PATH_FIELD_SIZE);
+  ShmSegment *segment = shm_segment_attach(name);
+  if (segment == NULL) {
+    return 1;
+  }
+  atomic_store(&segment->requests.writer_pid, getpid());
+  atomic_store(&segment->responses.reader_pid, getpid());
+  conn->shm = segment;
+  return 0;
+}
+
+static void detach_shm(KvsConnection *conn) {
+  if (conn->shm != NULL) {
+    shm_segment_detach(conn->shm);
+    conn->shm = NULL;
+  }
+}
+
+// From now on responses are read by a dedicated thread and matched to
+// requests by their id.
+static int start_session(KvsConnection *conn) {
+  if (attach_shm(conn) != 0) {
+    fprintf(stderr, "Failed to attach to shared memory\n");
+    return 1;
   }
 
-  REQ_FD_WR = open(req_pipe_path, O_WRONLY);
-  if (REQ_FD_WR == -1) {
+  conn->session_lost = 0;
+  if (pthread_create(&conn->response_thread, NULL, thread_responses, conn) != 0) {
+    fprintf(stderr, "Failed to create response thread\n");
+    conn->session_lost = 1;
+    detach_shm(conn);
+    return 1;
+  }
+  if (conn->socket_transport && conn->shm != NULL &&
+      pthread_create(&conn->notif_thread, NULL, thread_socket_notifications, conn) != 0) {
+    // The response thread ends once the server closes the session
+    fprintf(stderr, "Failed to create notification thread\n");
+    shutdown(conn->resp_fd, SHUT_RDWR);
+    shm_ring_close(&conn->shm->responses);
+    pthread_join(conn->response_thread, NULL);
+    detach_shm(conn);
+    return 1;
+  }
+  return 0;
+}
+
+// Connects through the server's SOCK_SEQPACKET socket: a single channel
+// carries requests, responses and notifications.
+static int connect_socket(KvsConnection *conn, char const *server_socket_path) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(server_socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", server_socket_path);
+    return 1;
+  }
+  strcpy(addr.sun_path, server_socket_path);
+
+  int socket_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (socket_fd == -1 || connect(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("Failed to connect to socket");
+    if (socket_fd != -1) {
+      close(socket_fd);
+    }
+    return 1;
+  }
+
+  int notif_fds[2];
+  if (pipe(notif_fds) != 0) {
+    perror("pipe failed");
+    close(socket_fd);
+    return 1;
+  }
+  conn->req_fd = socket_fd;
+  conn->resp_fd = socket_fd;
+  conn->notif_fd = notif_fds[0];
+  conn->notif_forward_fd = notif_fds[1];
+
+  FrameHeader header;
+  int result = send_frame(socket_fd, OP_CODE_CONNECT, 0, 0, NULL, 0) == 1 &&
+                       recv_packet(socket_fd, &header, NULL, 0) == 1 &&
+                       header.op_code == OP_CODE_CONNECT
+                   ? header.status
+                   : 1;
+  printf("Server returned %d for operation: connect\n", result);
+  if (result != 0) {
+    close_session_fds(conn);
+    return 1;
+  }
+
+  conn->socket_transport = 1;
+  if (start_session(conn) != 0) {
+    close_session_fds(conn);
+    return 1;
+  }
+  return 0;
+}
+
+// Connects through the register FIFO, with three named pipes of our own
+static int connect_fifo(KvsConnection *conn, char const *req_pipe_path, char const *resp_pipe_path,
+                        char const *notif_pipe_path, char const *server_pipe_path) {
+  if (strlen(req_pipe_path) >= MAX_PIPE_PATH_LENGTH || strlen(resp_pipe_path) >= MAX_PIPE_PATH_LENGTH ||
+      strlen(notif_pipe_path) >= MAX_PIPE_PATH_LENGTH) {
+    fprintf(stderr, "Pipe path too long\n");
+    return 1;
+  }
+
+  int fifo_fd_wr = open(server_pipe_path, O_WRONLY);
+  if (fifo_fd_wr == -1) {
     perror("Failed to open FIFO");
-    exit(EXIT_FAILURE);
+    return 1;
   }
 
-  NOTIF_FD_RD = open(notif_pipe_path, O_RDONLY);
-  if (NOTIF_FD_RD == -1) {
+  /* remove pipes if they exist, then create them */
+  const char *paths[] = {req_pipe_path, resp_pipe_path, notif_pipe_path};
+  for (size_t i = 0; i < 3; i++) {
+    int failed = unlink(paths[i]) != 0 && errno != ENOENT;
+    if (failed) {
+      perror("unlink failed");
+    } else if (mkfifo(paths[i], 0640) != 0) {
+      perror("mkfifo failed");
+      failed = 1;
+    }
+    if (failed) {
+      // Removes the pipes already created
+      while (i-- > 0) {
+        unlink(paths[i]);
+      }
+      close(fifo_fd_wr);
+      return 1;
+    }
+  }
+  strcpy(conn->req_pipe_path, req_pipe_path);
+  strcpy(conn->resp_pipe_path, resp_pipe_path);
+  strcpy(conn->notif_pipe_path, notif_pipe_path);
+
+  // send connect message to the register pipe and wait for response in response pipe
+  char payload[CONNECT_PAYLOAD_SIZE];
+  encode_connect(payload, req_pipe_path, resp_pipe_path, notif_pipe_path);
+  int result = send_frame(fifo_fd_wr, OP_CODE_CONNECT, 0, 0, payload, CONNECT_PAYLOAD_SIZE) == 1 ? 0 : 1;
+  close(fifo_fd_wr);
+
+  if (result == 0 && ((conn->resp_fd = open(resp_pipe_path, O_RDONLY)) == -1 ||
+                      (conn->req_fd = open(req_pipe_path, O_WRONLY)) == -1 ||
+                      (conn->notif_fd = open(notif_pipe_path, O_RDONLY)) == -1)) {
     perror("Failed to open FIFO");
-    exit(EXIT_FAILURE);
+    result = 1;
   }
-  *notif_pipe = NOTIF_FD_RD;
 
-  char result = read_msg(RESP_FD_RD);
-  printf("Server returned %c for operation: connect\n", result);
-  if (result != '0') {
-    close(fifo_fd_wr);
-    close(RESP_FD_RD);
-    close(REQ_FD_WR);
-    close(NOTIF_FD_RD);
+  if (result == 0) {
+    FrameHeader header;
+    result = recv_frame(conn->resp_fd, &header, NULL, 0, NULL) == 1 && header.op_code == OP_CODE_CONNECT
+                 ? header.status
+                 : 1;
+    printf("Server returned %d for operation: connect\n", result);
+  }
+  if (result != 0 || start_session(conn) != 0) {
+    close_session_fds(conn);
+    for (size_t i = 0; i < 3; i++) {
+      unlink(paths[i]);
+    }
     return 1;
   }
+  return 0;
+}
 
-  close(fifo_fd_wr);
+KvsConnection *kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
+                           char const *notif_pipe_path, char const *server_pipe_path, int *notif_pipe) {
+  KvsConnection *conn = connection_new();
+  if (conn == NULL) {
+    return NULL;
+  }
+
+  // The server may listen on a Unix socket instead of a register FIFO
+  struct stat server_stat;
+  int result = stat(server_pipe_path, &server_stat) == 0 && S_ISSOCK(server_stat.st_mode)
+                   ? connect_socket(conn, server_pipe_path)
+                   : connect_fifo(conn, req_pipe_path, resp_pipe_path, notif_pipe_path, server_pipe_path);
+  if (result != 0) {
+    connection_free(conn);
+    return NULL;
+  }
+  *notif_pipe = conn->notif_fd;
+  return conn;
+}
+
+// Ends a session the server may have kept open, as if it had closed it: the
+// server sees the requests end and closes the responses and notifications.
+static void end_session(KvsConnection *conn) {
+  if (conn->shm != NULL) {
+    shm_ring_close(&conn->shm->requests);
+    shm_ring_close(&conn->shm->responses);
+  }
+  if (conn->socket_transport) {
+    shutdown(conn->req_fd, SHUT_RDWR);
+  } else {
+    close(conn->req_fd);
+    conn->req_fd = -1;
+  }
+}
+
+int kvs_disconnect(KvsConnection *conn) {
+  int result = request(conn, OP_CODE_DISCONNECT, NULL, 0, NULL, 0);
+  printf("Server returned %d for operation: disconnect\n", result);
+  // The connection is released even if the request failed
+  if (result != 0) {
+    end_session(conn);
+  }
+
+  // The server closes the session after answering, which ends the response thread
+  pthread_join(conn->response_thread, NULL);
+  if (conn->shm != NULL && conn->socket_transport) {
+    pthread_join(conn->notif_thread, NULL);
+  }
+  detach_shm(conn);
+
+  // The notification pipe has closed too, which ends the dispatch thread
+  if (conn->dispatching) {
+    pthread_join(conn->dispatch_thread, NULL);
+  }
+
+  close_session_fds(conn);
+  if (!conn->socket_transport) {
+    // unlink pipe files
+    unlink(conn->req_pipe_path);
+    unlink(conn->resp_pipe_path);
+    unlink(conn->notif_pipe_path);
+  }
+  connection_free(conn);
+  return result != 0;
+}
+
+static void ignore_result(int result, void *arg) {
+  (void)result;
+  (void)arg;
+}
+
+// Records a subscription of the application before sending it, so that
+// notifications racing its response already reach the application.
+// @return 1 if the key was not recorded yet, and must be forgotten if the
+// subscription fails.
+static int track_key(KvsConnection *conn, const char *key) {
+  pthread_mutex_lock(&conn->handlers_mutex);
+  int added = keyset_count(conn->app_keys, key) == 0 && keyset_add(conn->app_keys, key) == 1;
+  pthread_mutex_unlock(&conn->handlers_mutex);
+  return added;
+}
+
+static void untrack_key(KvsConnection *conn, const char *key) {
+  pthread_mutex_lock(&conn->handlers_mutex);
+  keyset_remove(conn->app_keys, key);
+  pthread_mutex_unlock(&conn->handlers_mutex);
+}
+
+static int track_pattern(KvsConnection *conn, const char *pattern) {
+  pthread_mutex_lock(&conn->handlers_mutex);
+  if (conn->app_pattern_count == conn->app_pattern_capacity) {
+    size_t capacity = conn->app_pattern_capacity == 0 ? 4 : conn->app_pattern_capacity * 2;
+    char(*grown)[MAX_STRING_SIZE] = realloc(conn->app_patterns, capacity * MAX_STRING_SIZE);
+    if (grown == NULL) {
+      pthread_mutex_unlock(&conn->handlers_mutex);
+      return 1;
+    }
+    conn->app_patterns = grown;
+    conn->app_pattern_capacity = capacity;
+  }
+  snprintf(conn->app_patterns[conn->app_pattern_count++], MAX_STRING_SIZE, "%s", pattern);
+  pthread_mutex_unlock(&conn->handlers_mutex);
   return 0;
 }
 
-int kvs_disconnect(void) {
-  // close pipes and unlink pipe files
-  char message_to_send[42] = {0};
-  message_to_send[0] = 2;
-  send_msg(REQ_FD_WR, message_to_send);
-  char result = read_msg(RESP_FD_RD); //problema
-  printf("Server returned %d for operation: disconnect\n", (int) result);
-
-  if (result == '\0') {
-    close(RESP_FD_RD);
-    close(REQ_FD_WR);
-    close(NOTIF_FD_RD);
-    unlink(REQ_PIPE_PATH);
-    unlink(RESP_PIPE_PATH);
-    unlink(NOTIF_PIPE_PATH);
-    return 0;
+// Called with handlers_mutex
+static void untrack_pattern_locked(KvsConnection *conn, const char *pattern) {
+  for (size_t i = 0; i < conn->app_pattern_count; i++) {
+    if (strcmp(conn->app_patterns[i], pattern) == 0) {
+      memcpy(conn->app_patterns[i], conn->app_patterns[--conn->app_pattern_count], MAX_STRING_SIZE);
+      return;
+    }
+  }
+}
+
+// Mirrors an UNSUBSCRIBE that succeeded: the server removes the exact
+// subscription of the key if there is one, the application's or the
+// cache's, and otherwise a pattern with the same text.
+// @param cached 1 if the cache was subscribed to the key.
+static void untrack_unsubscribed(KvsConnection *conn, const char *key, int cached) {
+  pthread_mutex_lock(&conn->handlers_mutex);
+  if (keyset_count(conn->app_keys, key) > 0) {
+    keyset_remove(conn->app_keys, key);
+  } else if (!cached) {
+    untrack_pattern_locked(conn, key);
+  }
+  pthread_mutex_unlock(&conn->handlers_mutex);
+}
+
+// Whether the application subscribed to a key, exactly or through a
+// pattern. Called with handlers_mutex.
+static int app_wants(KvsConnection *conn, const char *key) {
+  if (keyset_count(conn->app_keys, key) > 0) {
+    return 1;
   }
+  for (size_t i = 0; i < conn->app_pattern_count; i++) {
+    if (fnmatch(conn->app_patterns[i], key, 0) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int request_async(KvsConnection *conn, PendingRequest *async, const void *payload, size_t length,
+                         size_t response_size);
+static int complete_status(const PendingRequest *pending, int status, const char *payload);
+
+static int complete_unsubscribe_cached(const PendingRequest *pending, int status, const char *payload) {
+  cache_unsubscribed(pending->conn->cache, pending->key);
+  return complete_status(pending, status, payload);
+}
+
+// Removes a subscription of the cache, leaving the application's alone.
+// Notifications for the key keep going to the cache until the response.
+static void unsubscribe_cached(KvsConnection *conn, const char *key) {
+  char payload[KEY_PAYLOAD_SIZE];
+  encode_field(payload, key, KEY_FIELD_SIZE);
+  PendingRequest async = {.op_code = OP_CODE_UNSUBSCRIBE, .complete = complete_unsubscribe_cached,
+                          .callback = ignore_result};
+  snprintf(async.key, MAX_STRING_SIZE, "%s", key);
+  if (request_async(conn, &async, payload, KEY_PAYLOAD_SIZE, 0) != 0) {
+    cache_unsubscribed(conn->cache, key);
+  }
+}
+
+// Hands a key the cache subscribed over to the application, which is about
+// to subscribe to it with its own options: the cache drops the key and its
+// subscription. Requests of a session run in order, so the unsubscribe takes
+// effect before the application's subscribe.
+static void release_cached(KvsConnection *conn, const char *key) {
+  if (conn->cache != NULL && cache_forget(conn->cache, key)) {
+    unsubscribe_cached(conn, key);
+  }
+}
 
-  return 1;
+int kvs_subscribe(KvsConnection *conn, const char *key) {
+  return kvs_subscribe_with(conn, key, 0, 0);
 }
 
-int kvs_subscribe(const char *key) {
-  char message_to_send[42] = {0};
-  message_to_send[0] = 3;
-  strncpy(message_to_send + 1, key, 41);
-  send_msg(REQ_FD_WR, message_to_send);
+int kvs_subscribe_with(KvsConnection *conn, const char *key, int coalesce, unsigned int max_rate) {
+  char value[MAX_STRING_SIZE];
+  uint64_t version;
+  return kvs_subscribe_versioned(conn, key, coalesce, max_rate, NULL, value, &version) != 0;
+}
 
-  //char result = read_msg(RESP_FD_RD);
-  char result = 's';
-  printf("Server returned %c for operation: subscribe\n", result);
+int kvs_subscribe_versioned(KvsConnection *conn, const char *key, int coalesce,
+                            unsigned int max_rate, const uint64_t *since, char *value,
+                            uint64_t *version) {
+  if (max_rate > UINT16_MAX) {
+    fprintf(stderr, "Maximum rate too large: %u\n", max_rate);
+    return 1;
+  }
+  release_cached(conn, key);
+  int tracked = track_key(conn, key);
 
-  //if (result != '\0') {
-  //  return 1;
-  //}
-    if (result != 's') {
+  // Without options the payload is just the key
+  char payload[SUBSCRIBE_RESUME_PAYLOAD_SIZE];
+  size_t length = KEY_PAYLOAD_SIZE;
+  uint8_t flags = (uint8_t)((coalesce ? SUBSCRIBE_COALESCE : 0) | (since != NULL ? SUBSCRIBE_RESUME : 0));
+  if (flags != 0 || max_rate > 0) {
+    encode_subscribe(payload, key, flags, (uint16_t)max_rate);
+    length = SUBSCRIBE_OPTIONS_PAYLOAD_SIZE;
+  } else {
+    encode_field(payload, key, KEY_FIELD_SIZE);
+  }
+  if (since != NULL) {
+    encode_version(payload + SUBSCRIBE_OPTIONS_PAYLOAD_SIZE, *since);
+    length = SUBSCRIBE_RESUME_PAYLOAD_SIZE;
+  }
+
+  char response[SUBSCRIBE_RESPONSE_SIZE];
+  int result = request(conn, OP_CODE_SUBSCRIBE, payload, length, response, SUBSCRIBE_RESPONSE_SIZE);
+  printf("Server returned %d for operation: subscribe\n", result);
+  if (result != 0 && result != 2) {
+    if (tracked) {
+      untrack_key(conn, key);
+    }
     return 1;
   }
+  decode_field(value, response, KEY_FIELD_SIZE);
+  *version = decode_version(response + KEY_FIELD_SIZE);
+  return result;
+}
 
-  return 0;
+int kvs_subscribe_pattern(KvsConnection *conn, const char *pattern) {
+  char payload[SUBSCRIBE_OPTIONS_PAYLOAD_SIZE];
+  encode_subscribe(payload, pattern, SUBSCRIBE_PATTERN, 0);
+  if (track_pattern(conn, pattern) != 0) {
+    return 1;
+  }
+
+  char response[SUBSCRIBE_RESPONSE_SIZE];
+  int result = request(conn, OP_CODE_SUBSCRIBE, payload, SUBSCRIBE_OPTIONS_PAYLOAD_SIZE, response,
+                       SUBSCRIBE_RESPONSE_SIZE);
+  printf("Server returned %d for operation: subscribe\n", result);
+  if (result != 0) {
+    pthread_mutex_lock(&conn->handlers_mutex);
+    untrack_pattern_locked(conn, pattern);
+    pthread_mutex_unlock(&conn->handlers_mutex);
+  }
+  return result != 0;
 }
 
-int kvs_unsubscribe(const char *key) {
-  char message_to_send[42] = {0};
-  message_to_send[0] = 4;
-  strncpy(message_to_send + 1, key, 41);
-  send_msg(REQ_FD_WR, message_to_send);
+int kvs_unsubscribe(KvsConnection *conn, const char *key) {
+  // The cache's subscription, if any, is the one removed
+  int cached = conn->cache != NULL && cache_forget(conn->cache, key);
+  char payload[KEY_PAYLOAD_SIZE];
+  encode_field(payload, key, KEY_FIELD_SIZE);
 
-  //char result = read_msg(RESP_FD_RD);
-  char result = 'u';
-  printf("Server returned %c for operation: unsubscribe\n", result);
+  int result = request(conn, OP_CODE_UNSUBSCRIBE, payload, KEY_PAYLOAD_SIZE, NULL, 0);
+  printf("Server returned %d for operation: unsubscribe\n", result);
+  if (cached) {
+    cache_unsubscribed(conn->cache, key);
+  }
+  if (result == 0) {
+    untrack_unsubscribed(conn, key, cached);
+  }
+  return result != 0;
+}
 
-  //if (result != '\0') {
-  //  return 1;
-  //}
-    if (result != 'u') {
+// The cached values of keys this connection changes are not served again
+// until the response arrives and the cache has caught up with its versions.
+// Called before sending the request.
+static void mark_stale(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], StaleKeys *stale) {
+  stale->count = num_keys;
+  for (size_t i = 0; i < num_keys; i++) {
+    memcpy(stale->keys[i], keys[i], MAX_STRING_SIZE);
+    stale->marks[i] = cache_mark_stale(conn->cache, keys[i]);
+  }
+}
+
+// Hands the versions of a response to the cache
+// @param versions Versions of the changes, NULL if the response was lost.
+// @param stride Bytes between versions in the response.
+static void mark_written(KvsConnection *conn, const StaleKeys *stale, const char *versions, size_t stride) {
+  for (size_t i = 0; i < stale->count; i++) {
+    uint64_t version = versions != NULL ? decode_version(versions + i * stride) : 0;
+    cache_written(conn->cache, stale->keys[i], stale->marks[i], version);
+  }
+}
+
+// Gives up on the versions of a request that was not sent
+static void release_stale(KvsConnection *conn, StaleKeys *stale) {
+  if (stale != NULL) {
+    mark_written(conn, stale, NULL, 0);
+    free(stale);
+  }
+}
+
+// Allocates the keys of an asynchronous write or delete, if there is a cache
+static StaleKeys *async_mark_stale(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE]) {
+  if (conn->cache == NULL) {
+    return NULL;
+  }
+  StaleKeys *stale = malloc(sizeof(StaleKeys));
+  if (stale != NULL) {
+    mark_stale(conn, num_keys, keys, stale);
+  }
+  return stale;
+}
+
+static void encode_keys(char *payload, size_t num_keys, char keys[][MAX_STRING_SIZE]) {
+  for (size_t i = 0; i < num_keys; i++) {
+    encode_field(payload + i * KEY_FIELD_SIZE, keys[i], KEY_FIELD_SIZE);
+  }
+}
+
+// key | value
+static void encode_pairs(char *payload, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+                         char values[][MAX_STRING_SIZE]) {
+  for (size_t i = 0; i < num_pairs; i++) {
+    encode_field(payload + i * PAIR_FIELD_SIZE, keys[i], KEY_FIELD_SIZE);
+    encode_field(payload + i * PAIR_FIELD_SIZE + KEY_FIELD_SIZE, values[i], KEY_FIELD_SIZE);
+  }
+}
+
+// found | value
+static void decode_read(const char *response, size_t num_keys, char values[][MAX_STRING_SIZE], int *found) {
+  for (size_t i = 0; i < num_keys; i++) {
+    found[i] = response[i * READ_ENTRY_SIZE] == 1;
+    decode_field(values[i], response + i * READ_ENTRY_SIZE + 1, MAX_STRING_SIZE);
+  }
+}
+
+// missing | version
+static void decode_delete(const char *response, size_t num_keys, int *missing) {
+  for (size_t i = 0; i < num_keys; i++) {
+    missing[i] = response[i * DELETE_ENTRY_SIZE] != 0;
+  }
+}
+
+static int read_from_server(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+                            char values[][MAX_STRING_SIZE], int *found) {
+  char payload[MAX_REQUEST_KEYS * KEY_FIELD_SIZE];
+  char response[MAX_REQUEST_KEYS * READ_ENTRY_SIZE];
+  encode_keys(payload, num_keys, keys);
+
+  int result = request(conn, OP_CODE_READ, payload, num_keys * KEY_FIELD_SIZE, response,
+                       num_keys * READ_ENTRY_SIZE);
+  if (result == -1) {
+    return -1;
+  }
+  decode_read(response, num_keys, values, found);
+  return result != 0;
+}
+
+static void fill_cache(KvsConnection *conn, const char *key);
+static void invalidate_cache(KvsConnection *conn);
+
+int kvs_read(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+             char values[][MAX_STRING_SIZE], int *found) {
+  if (num_keys == 0 || num_keys > MAX_REQUEST_KEYS) {
+    return -1;
+  }
+  if (conn->cache == NULL) {
+    return read_from_server(conn, num_keys, keys, values, found);
+  }
+
+  // Only the keys missing from the cache go to the server
+  char miss_keys[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+  size_t miss_index[MAX_REQUEST_KEYS];
+  size_t misses = 0;
+  for (size_t i = 0; i < num_keys; i++) {
+    if (cache_get(conn->cache, keys[i], values[i])) {
+      found[i] = 1;
+    } else {
+      memcpy(miss_keys[misses], keys[i], MAX_STRING_SIZE);
+      miss_index[misses++] = i;
+    }
+  }
+  if (misses == 0) {
+    return 0;
+  }
+
+  char miss_values[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+  int miss_found[MAX_REQUEST_KEYS];
+  int result = read_from_server(conn, misses, miss_keys, miss_values, miss_found);
+  if (result == -1) {
+    return -1;
+  }
+  for (size_t j = 0; j < misses; j++) {
+    memcpy(values[miss_index[j]], miss_values[j], MAX_STRING_SIZE);
+    found[miss_index[j]] = miss_found[j];
+    if (miss_found[j]) {
+      fill_cache(conn, miss_keys[j]);
+    }
+  }
+  return result;
+}
+
+int kvs_write(KvsConnection *conn, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+              char values[][MAX_STRING_SIZE]) {
+  if (num_pairs == 0 || num_pairs > MAX_REQUEST_KEYS) {
     return 1;
   }
 
+  char payload[MAX_REQUEST_KEYS * PAIR_FIELD_SIZE];
+  char response[MAX_REQUEST_KEYS * VERSION_FIELD_SIZE];
+  StaleKeys stale;
+  encode_pairs(payload, num_pairs, keys, values);
+  if (conn->cache != NULL) {
+    mark_stale(conn, num_pairs, keys, &stale);
+  }
+  int result = request(conn, OP_CODE_WRITE, payload, num_pairs * PAIR_FIELD_SIZE, response,
+                       num_pairs * VERSION_FIELD_SIZE);
+  if (conn->cache != NULL) {
+    mark_written(conn, &stale, result != -1 ? response : NULL, VERSION_FIELD_SIZE);
+  }
+  return result != 0;
+}
+
+int kvs_delete(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], int *missing) {
+  if (num_keys == 0 || num_keys > MAX_REQUEST_KEYS) {
+    return -1;
+  }
+
+  char payload[MAX_REQUEST_KEYS * KEY_FIELD_SIZE];
+  char response[MAX_REQUEST_KEYS * DELETE_ENTRY_SIZE];
+  StaleKeys stale;
+  encode_keys(payload, num_keys, keys);
+  if (conn->cache != NULL) {
+    mark_stale(conn, num_keys, keys, &stale);
+  }
+
+  int result = request(conn, OP_CODE_DELETE, payload, num_keys * KEY_FIELD_SIZE, response,
+                       num_keys * DELETE_ENTRY_SIZE);
+  if (conn->cache != NULL) {
+    mark_written(conn, &stale, result != -1 ? response + 1 : NULL, DELETE_ENTRY_SIZE);
+  }
+  if (result == -1) {
+    return -1;
+  }
+  decode_delete(response, num_keys, missing);
+  return result != 0;
+}
+
+// Sends a request whose response the response thread completes with
+// complete and then callback. Only waits if MAX_PENDING_REQUESTS requests are
+// already in flight.
+// @return 0 if the request was sent, -1 otherwise (callback is not called).
+static int request_async(KvsConnection *conn, PendingRequest *async, const void *payload, size_t length,
+                         size_t response_size) {
+  pthread_mutex_lock(&conn->pending_mutex);
+  PendingRequest *pending = claim_pending(conn, async->op_code, response_size);
+  if (pending == NULL) {
+    pthread_mutex_unlock(&conn->pending_mutex);
+    release_stale(conn, async->stale);
+    return -1;
+  }
+  pending->complete = async->complete;
+  pending->callback = async->callback;
+  pending->callback_arg = async->callback_arg;
+  pending->count = async->count;
+  pending->values = async->values;
+  pending->flags = async->flags;
+  pending->conn = conn;
+  pending->stale = async->stale;
+  memcpy(pending->key, async->key, MAX_STRING_SIZE);
+  pending->tracked = async->tracked;
+  PendingRequest sending = *pending;
+  pthread_mutex_unlock(&conn->pending_mutex);
+
+  if (send_request(conn, &sending, payload, length)) {
+    return 0;
+  }
+  // No response will come. If the session was lost meanwhile, the response
+  // thread has already completed the request with -1.
+  pthread_mutex_lock(&conn->pending_mutex);
+  int ours = pending->in_use && pending->request_id == sending.request_id && pending->callback != NULL;
+  if (ours) {
+    pending->in_use = 0;
+    pending->callback = NULL;
+    pthread_cond_broadcast(&conn->pending_slot_cond);
+  }
+  pthread_mutex_unlock(&conn->pending_mutex);
+  if (ours) {
+    release_stale(conn, sending.stale);
+  }
+  return ours ? -1 : 0;
+}
+
+static int complete_status(const PendingRequest *pending, int status, const char *payload) {
+  (void)pending;
+  (void)payload;
+  return status == -1 ? -1 : status != 0;
+}
+
+static int complete_read(const PendingRequest *pending, int status, const char *payload) {
+  if (payload == NULL || status == -1) {
+    return -1;
+  }
+  decode_read(payload, pending->count, pending->values, pending->flags);
+  return status != 0;
+}
+
+static int complete_write(const PendingRequest *pending, int status, const char *payload) {
+  if (pending->stale != NULL) {
+    mark_written(pending->conn, pending->stale, payload, VERSION_FIELD_SIZE);
+    free(pending->stale);
+  }
+  return complete_status(pending, status, payload);
+}
+
+static int complete_delete(const PendingRequest *pending, int status, const char *payload) {
+  if (pending->stale != NULL) {
+    mark_written(pending->conn, pending->stale, payload != NULL ? payload + 1 : NULL, DELETE_ENTRY_SIZE);
+    free(pending->stale);
+  }
+  if (payload == NULL || status == -1) {
+    return -1;
+  }
+  decode_delete(payload, pending->count, pending->flags);
+  return status != 0;
+}
+
+int kvs_read_async(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+                   char values[][MAX_STRING_SIZE], int *found, KvsCallback callback, void *arg) {
+  if (num_keys == 0 || num_keys > MAX_REQUEST_KEYS) {
+    return -1;
+  }
+
+  // Served from the cache only if every key is there
+  size_t hits = 0;
+  while (conn->cache != NULL && hits < num_keys && cache_get(conn->cache, keys[hits], values[hits])) {
+    found[hits++] = 1;
+  }
+  if (hits == num_keys && complete_locally(conn, callback, arg) == 0) {
+    return 0;
+  }
+
+  char payload[MAX_REQUEST_KEYS * KEY_FIELD_SIZE];
+  encode_keys(payload, num_keys, keys);
+  PendingRequest async = {.op_code = OP_CODE_READ, .complete = complete_read, .callback = callback,
+                          .callback_arg = arg, .count = num_keys, .values = values, .flags = found};
+  return request_async(conn, &async, payload, num_keys * KEY_FIELD_SIZE, num_keys * READ_ENTRY_SIZE);
+}
+
+int kvs_write_async(KvsConnection *conn, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+                    char values[][MAX_STRING_SIZE], KvsCallback callback, void *arg) {
+  if (num_pairs == 0 || num_pairs > MAX_REQUEST_KEYS) {
+    return -1;
+  }
+
+  char payload[MAX_REQUEST_KEYS * PAIR_FIELD_SIZE];
+  encode_pairs(payload, num_pairs, keys, values);
+  PendingRequest async = {.op_code = OP_CODE_WRITE, .complete = complete_write, .callback = callback,
+                          .callback_arg = arg, .stale = async_mark_stale(conn, num_pairs, keys)};
+  return request_async(conn, &async, payload, num_pairs * PAIR_FIELD_SIZE, num_pairs * VERSION_FIELD_SIZE);
+}
+
+int kvs_delete_async(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], int *missing,
+                     KvsCallback callback, void *arg) {
+  if (num_keys == 0 || num_keys > MAX_REQUEST_KEYS) {
+    return -1;
+  }
+
+  char payload[MAX_REQUEST_KEYS * KEY_FIELD_SIZE];
+  encode_keys(payload, num_keys, keys);
+  PendingRequest async = {.op_code = OP_CODE_DELETE, .complete = complete_delete, .callback = callback,
+                          .callback_arg = arg, .count = num_keys, .flags = missing,
+                          .stale = async_mark_stale(conn, num_keys, keys)};
+  return request_async(conn, &async, payload, num_keys * KEY_FIELD_SIZE, num_keys * DELETE_ENTRY_SIZE);
+}
+
+static int complete_subscribe(const PendingRequest *pending, int status, const char *payload) {
+  if (status != 0 && pending->tracked) {
+    untrack_key(pending->conn, pending->key);
+  }
+  return complete_status(pending, status, payload);
+}
+
+static int complete_unsubscribe(const PendingRequest *pending, int status, const char *payload) {
+  if (pending->tracked) {
+    cache_unsubscribed(pending->conn->cache, pending->key);
+  }
+  if (status == 0) {
+    untrack_unsubscribed(pending->conn, pending->key, pending->tracked);
+  }
+  return complete_status(pending, status, payload);
+}
+
+int kvs_subscribe_async(KvsConnection *conn, const char *key, KvsCallback callback, void *arg) {
+  release_cached(conn, key);
+  char payload[KEY_PAYLOAD_SIZE];
+  encode_field(payload, key, KEY_FIELD_SIZE);
+  PendingRequest async = {.op_code = OP_CODE_SUBSCRIBE, .complete = complete_subscribe, .callback = callback,
+                          .callback_arg = arg, .tracked = track_key(conn, key)};
+  snprintf(async.key, MAX_STRING_SIZE, "%s", key);
+  if (request_async(conn, &async, payload, KEY_PAYLOAD_SIZE, SUBSCRIBE_RESPONSE_SIZE) != 0) {
+    if (async.tracked) {
+      untrack_key(conn, key);
+    }
+    return -1;
+  }
+  return 0;
+}
+
+int kvs_unsubscribe_async(KvsConnection *conn, const char *key, KvsCallback callback, void *arg) {
+  char payload[KEY_PAYLOAD_SIZE];
+  encode_field(payload, key, KEY_FIELD_SIZE);
+  // tracked: whether the subscription removed is the cache's
+  PendingRequest async = {.op_code = OP_CODE_UNSUBSCRIBE, .complete = complete_unsubscribe, .callback = callback,
+                          .callback_arg = arg, .tracked = conn->cache != NULL && cache_forget(conn->cache, key)};
+  snprintf(async.key, MAX_STRING_SIZE, "%s", key);
+  if (request_async(conn, &async, payload, KEY_PAYLOAD_SIZE, 0) != 0) {
+    if (async.tracked) {
+      cache_unsubscribed(conn->cache, key);
+    }
+    return -1;
+  }
+  return 0;
+}
+
+// Waits for every request of a batch sent with request_async
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  size_t remaining;
+  int result;  // -1 if any request failed, else 1 if any key failed
+} BatchWait;
+
+static void batch_done(int result, void *arg) {
+  BatchWait *batch = arg;
+  pthread_mutex_lock(&batch->mutex);
+  if (batch->result != -1 && result != 0) {
+    batch->result = result;
+  }
+  if (--batch->remaining == 0) {
+    pthread_cond_signal(&batch->cond);
+  }
+  pthread_mutex_unlock(&batch->mutex);
+}
+
+static int complete_bitmap(const PendingRequest *pending, int status, const char *payload) {
+  if (payload == NULL || status == -1) {
+    return -1;
+  }
+  decode_bitmap(payload, pending->flags, pending->count);
+  return status != 0;
+}
+
+// Sends SUBSCRIBE_KEYS or UNSUBSCRIBE_KEYS requests for any number of keys,
+// pipelined, and waits for all of their responses
+static int request_keys(KvsConnection *conn, uint8_t op_code, size_t num_keys, char keys[][MAX_STRING_SIZE],
+                        int *done) {
+  if (num_keys == 0) {
+    return -1;
+  }
+  memset(done, 0, num_keys * sizeof(int));
+
+  BatchWait batch = {.remaining = 1, .result = 0};  // One for the sending loop
+  pthread_mutex_init(&batch.mutex, NULL);
+  pthread_cond_init(&batch.cond, NULL);
+  char payload[MAX_REQUEST_KEYS * KEY_FIELD_SIZE];
+  for (size_t first = 0; first < num_keys; first += MAX_REQUEST_KEYS) {
+    size_t count = num_keys - first < MAX_REQUEST_KEYS ? num_keys - first : MAX_REQUEST_KEYS;
+    encode_keys(payload, count, keys + first);
+    PendingRequest async = {.op_code = op_code, .complete = complete_bitmap, .callback = batch_done,
+                            .callback_arg = &batch, .count = count, .flags = done + first};
+    pthread_mutex_lock(&batch.mutex);
+    batch.remaining++;
+    pthread_mutex_unlock(&batch.mutex);
+    if (request_async(conn, &async, payload, count * KEY_FIELD_SIZE, KEY_BITMAP_SIZE(count)) != 0) {
+      batch_done(-1, &batch);
+      break;
+    }
+  }
+  batch_done(0, &batch);
+
+  pthread_mutex_lock(&batch.mutex);
+  while (batch.remaining > 0) {
+    pthread_cond_wait(&batch.cond, &batch.mutex);
+  }
+  pthread_mutex_unlock(&batch.mutex);
+  pthread_cond_destroy(&batch.cond);
+  pthread_mutex_destroy(&batch.mutex);
+  return batch.result;
+}
+
+int kvs_subscribe_keys(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], int *subscribed) {
+  int *tracked = malloc((num_keys > 0 ? num_keys : 1) * sizeof(int));
+  if (tracked == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < num_keys; i++) {
+    release_cached(conn, keys[i]);
+    tracked[i] = track_key(conn, keys[i]);
+  }
+  int result = request_keys(conn, OP_CODE_SUBSCRIBE_KEYS, num_keys, keys, subscribed);
+  printf("Server returned %d for operation: subscribe\n", result);
+  for (size_t i = 0; i < num_keys; i++) {
+    if (!subscribed[i] && tracked[i]) {
+      untrack_key(conn, keys[i]);
+    }
+  }
+  free(tracked);
+  return result;
+}
+
+int kvs_unsubscribe_keys(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+                         int *unsubscribed) {
+  int *cached = malloc((num_keys > 0 ? num_keys : 1) * sizeof(int));
+  if (cached == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < num_keys; i++) {
+    cached[i] = conn->cache != NULL && cache_forget(conn->cache, keys[i]);
+  }
+  int result = request_keys(conn, OP_CODE_UNSUBSCRIBE_KEYS, num_keys, keys, unsubscribed);
+  printf("Server returned %d for operation: unsubscribe\n", result);
+  for (size_t i = 0; i < num_keys; i++) {
+    if (cached[i]) {
+      cache_unsubscribed(conn->cache, keys[i]);
+    }
+    if (unsubscribed[i]) {
+      untrack_unsubscribed(conn, keys[i], cached[i]);
+    }
+  }
+  free(cached);
+  return result;
+}
+
+// Reads the notification pipe and runs the callback of each notification's
+// key, or the default one. When the pipe closes, tells the default callback.
+static void *thread_dispatch(void *arg) {
+  KvsConnection *conn = arg;
+  char notification[NOTIFICATION_PAYLOAD_SIZE];
+  char key[KEY_FIELD_SIZE];
+  char value[KEY_FIELD_SIZE];
+
+  for (;;) {
+    if (conn->cache != NULL) {
+      cache_notifications_read(conn->cache, conn->notif_fd);
+    }
+    FrameHeader header;
+    if (recv_frame(conn->notif_fd, &header, notification, sizeof(notification), NULL) != 1) {
+      break;
+    }
+    if (header.op_code != OP_CODE_NOTIFICATION || header.length != NOTIFICATION_PAYLOAD_SIZE) {
+      continue;
+    }
+    if (header.status == NOTIFICATION_LOST && conn->cache != NULL) {
+      invalidate_cache(conn);
+    }
+    // key | value | version
+    decode_field(key, notification, KEY_FIELD_SIZE);
+    decode_field(value, notification + KEY_FIELD_SIZE, KEY_FIELD_SIZE);
+    uint64_t version = decode_version(notification + 2 * KEY_FIELD_SIZE);
+    int cached = conn->cache != NULL && cache_apply(conn->cache, key, value, version);
+
+    pthread_mutex_lock(&conn->handlers_mutex);
+    // A key the cache subscribed only reaches the application if it
+    // subscribed to it as well
+    if (cached && !app_wants(conn, key)) {
+      pthread_mutex_unlock(&conn->handlers_mutex);
+      continue;
+    }
+    // Deleting a key ends its exact subscriptions, not the patterns
+    if (strcmp(value, "DELETED") == 0) {
+      keyset_remove(conn->app_keys, key);
+    }
+    KvsNotifyFn notify = conn->default_notify;
+    void *notify_arg = conn->default_arg;
+    for (size_t i = 0; i < conn->handler_count; i++) {
+      if (strcmp(conn->handlers[i].key, key) == 0) {
+        notify = conn->handlers[i].notify;
+        notify_arg = conn->handlers[i].arg;
+        break;
+      }
+    }
+    pthread_mutex_unlock(&conn->handlers_mutex);
+
+    if (notify != NULL) {
+      notify(key, value, version, notify_arg);
+    }
+  }
+
+  pthread_mutex_lock(&conn->handlers_mutex);
+  KvsNotifyFn notify = conn->default_notify;
+  void *notify_arg = conn->default_arg;
+  pthread_mutex_unlock(&conn->handlers_mutex);
+  if (notify != NULL) {
+    notify(NULL, NULL, 0, notify_arg);
+  }
+  return NULL;
+}
+
+// Starts the dispatch thread, if not running yet. Called with handlers_mutex.
+static int start_dispatch(KvsConnection *conn) {
+  if (conn->dispatching) {
+    return 0;
+  }
+  if (pthread_create(&conn->dispatch_thread, NULL, thread_dispatch, conn) != 0) {
+    fprintf(stderr, "Failed to create notification dispatch thread\n");
+    return 1;
+  }
+  conn->dispatching = 1;
   return 0;
 }
 
+int kvs_on_notification(KvsConnection *conn, const char *key, KvsNotifyFn notify, void *arg) {
+  pthread_mutex_lock(&conn->handlers_mutex);
+  int result = 0;
+  if (key == NULL) {
+    conn->default_notify = notify;
+    conn->default_arg = arg;
+  } else {
+    size_t i = 0;
+    while (i < conn->handler_count && strcmp(conn->handlers[i].key, key) != 0) {
+      i++;
+    }
+    if (notify == NULL) {
+      // Removes the handler, moving the last one into its place
+      if (i < conn->handler_count) {
+        conn->handlers[i] = conn->handlers[--conn->handler_count];
+      }
+    } else if (i == MAX_NOTIFICATION_HANDLERS) {
+      fprintf(stderr, "Too many notification handlers\n");
+      result = 1;
+    } else {
+      snprintf(conn->handlers[i].key, MAX_STRING_SIZE, "%s", key);
+      conn->handlers[i].notify = notify;
+      conn->handlers[i].arg = arg;
+      if (i == conn->handler_count) {
+        conn->handler_count++;
+      }
+    }
+  }
+
+  if (result == 0) {
+    result = start_dispatch(conn);
+  }
+  pthread_mutex_unlock(&conn->handlers_mutex);
+  return result;
+}
+
+// Subscription of the cache to a key it read, completed by the response thread
+typedef struct {
+  KvsConnection *conn;
+  char key[MAX_STRING_SIZE];
+  uint64_t fill_id;
+} CacheFill;
+
+static int complete_fill(const PendingRequest *pending, int status, const char *payload) {
+  CacheFill *fill = pending->callback_arg;
+  char value[MAX_STRING_SIZE] = "";
+  uint64_t version = 0;
+  if (payload != NULL && status == 0) {
+    decode_field(value, payload, KEY_FIELD_SIZE);
+    version = decode_version(payload + KEY_FIELD_SIZE);
+  }
+  cache_end_fill(fill->conn->cache, fill->key, fill->fill_id, payload != NULL && status == 0, value, version);
+  return status;
+}
+
+static void free_arg(int result, void *arg) {
+  (void)result;
+  free(arg);
+}
+
+// Starts caching a key just read from the server, by subscribing to it
+// without waiting for the response
+static void fill_cache(KvsConnection *conn, const char *key) {
+  // The cache's subscription would fail, as the key is subscribed already
+  pthread_mutex_lock(&conn->handlers_mutex);
+  int subscribed = keyset_count(conn->app_keys, key) > 0;
+  pthread_mutex_unlock(&conn->handlers_mutex);
+  if (subscribed) {
+    return;
+  }
+
+  char evicted[MAX_STRING_SIZE];
+  int has_evicted;
+  uint64_t fill_id = cache_begin_fill(conn->cache, key, evicted, &has_evicted);
+  if (has_evicted) {
+    unsubscribe_cached(conn, evicted);
+  }
+  if (fill_id == 0) {
+    return;
+  }
+
+  CacheFill *fill = malloc(sizeof(CacheFill));
+  if (fill == NULL) {
+    cache_end_fill(conn->cache, key, fill_id, 0, "", 0);
+    return;
+  }
+  fill->conn = conn;
+  snprintf(fill->key, MAX_STRING_SIZE, "%s", key);
+  fill->fill_id = fill_id;
+
+  char payload[KEY_PAYLOAD_SIZE];
+  encode_field(payload, key, KEY_FIELD_SIZE);
+  PendingRequest async = {.op_code = OP_CODE_SUBSCRIBE, .complete = complete_fill, .callback = free_arg,
+                          .callback_arg = fill};
+  if (request_async(conn, &async, payload, KEY_PAYLOAD_SIZE, SUBSCRIBE_RESPONSE_SIZE) != 0) {
+    cache_end_fill(conn->cache, key, fill_id, 0, "", 0);
+    free(fill);
+  }
+}
+
+// Keys the cache unsubscribes with one UNSUBSCRIBE_KEYS request
+typedef struct {
+  size_t count;
+  char keys[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+} CacheKeys;
+
+static int complete_unsubscribe_cache_keys(const PendingRequest *pending, int status, const char *payload) {
+  const CacheKeys *batch = pending->callback_arg;
+  for (size_t i = 0; i < batch->count; i++) {
+    cache_unsubscribed(pending->conn->cache, batch->keys[i]);
+  }
+  return status == 0 && payload != NULL ? 0 : -1;
+}
+
+// The notifications of some keys were lost, so no cached value can be
+// trusted: drops them all and unsubscribes the cache from them
+static void invalidate_cache(KvsConnection *conn) {
+  size_t count = cache_invalidate(conn->cache, conn->invalidated);
+  for (size_t first = 0; first < count; first += MAX_REQUEST_KEYS) {
+    size_t batch_count = count - first < MAX_REQUEST_KEYS ? count - first : MAX_REQUEST_KEYS;
+    CacheKeys *batch = malloc(sizeof(CacheKeys));
+    if (batch == NULL) {
+      for (size_t i = first; i < first + batch_count; i++) {
+        unsubscribe_cached(conn, conn->invalidated[i]);
+      }
+      continue;
+    }
+    batch->count = batch_count;
+    memcpy(batch->keys, conn->invalidated + first, batch_count * MAX_STRING_SIZE);
+
+    char payload[MAX_REQUEST_KEYS * KEY_FIELD_SIZE];
+    encode_keys(payload, batch_count, batch->keys);
+    PendingRequest async = {.op_code = OP_CODE_UNSUBSCRIBE_KEYS, .complete = complete_unsubscribe_cache_keys,
+                            .callback = free_arg, .callback_arg = batch};
+    if (request_async(conn, &async, payload, batch_count * KEY_FIELD_SIZE, KEY_BITMAP_SIZE(batch_count)) != 0) {
+      for (size_t i = 0; i < batch_count; i++) {
+        cache_unsubscribed(conn->cache, batch->keys[i]);
+      }
+      free(batch);
+    }
+  }
+}
+
+int kvs_cache_enable(KvsConnection *conn, size_t capacity) {
+  if (conn->cache != NULL) {
+    return 1;
+  }
+  conn->invalidated = malloc(capacity * MAX_STRING_SIZE);
+  conn->cache = conn->invalidated != NULL ? cache_new(capacity) : NULL;
+  if (conn->cache == NULL) {
+    fprintf(stderr, "Failed to create cache\n");
+    free(conn->invalidated);
+    conn->invalidated = NULL;
+    return 1;
+  }
+  pthread_mutex_lock(&conn->handlers_mutex);
+  int result = start_dispatch(conn);
+  pthread_mutex_unlock(&conn->handlers_mutex);
+  return result;
+}
+
+void kvs_cache_stats(KvsConnection *conn, unsigned long *hits, unsigned long *misses, size_t *size) {
+  *hits = *misses = 0;
+  *size = 0;
+  if (conn->cache != NULL) {
+    cache_stats(conn->cache, hits, misses, size);
+  }
+}
+
 // void sigusr1(int signal){
 // printf("Received SIGUSR1\n");
 //   if (REQ_PIPE_PATH == {0} || RESP_PIPE_PATH == {0} || NOTIF_PIPE_PATH == {0}){
@@ -232,3 +1682,60 @@ int kvs_unsubscribe(const char *key) {
 
 // printf("Successfully disconnected all clients\n");
 // }
+
+int kvs_cdc_open(const char *cdc_socket_path, uint64_t since, uint64_t *start, int *fd) {
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(cdc_socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", cdc_socket_path);
+    return 1;
+  }
+  strcpy(addr.sun_path, cdc_socket_path);
+
+  int socket_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (socket_fd == -1 || connect(socket_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    perror("Failed to connect to CDC socket");
+    if (socket_fd != -1) {
+      close(socket_fd);
+    }
+    return 1;
+  }
+
+  char payload[CDC_PAYLOAD_SIZE];
+  encode_version(payload, since);
+  FrameHeader header;
+  if (send_frame(socket_fd, OP_CODE_CDC, 0, 0, payload, CDC_PAYLOAD_SIZE) != 1 ||
+      recv_frame(socket_fd, &header, payload, sizeof(payload), NULL) != 1 ||
+      header.op_code != OP_CODE_CDC || header.length != CDC_PAYLOAD_SIZE) {
+    close(socket_fd);
+    return 1;
+  }
+  *start = decode_version(payload);
+  if (header.status != 0) {
+    close(socket_fd);
+    return 2;
+  }
+  *fd = socket_fd;
+  return 0;
+}
+
+int kvs_cdc_next(int fd, char *key, char *value, uint64_t *version, int *deleted) {
+  char payload[CHANGE_PAYLOAD_SIZE];
+  FrameHeader header;
+  if (recv_frame(fd, &header, payload, sizeof(payload), NULL) != 1) {
+    close(fd);
+    return 1;
+  }
+  if (header.op_code == OP_CODE_CDC) {
+    // The consumer fell behind the changes the server keeps
+    close(fd);
+    return 2;
+  }
+  if (header.op_code != OP_CODE_CHANGE || header.length != CHANGE_PAYLOAD_SIZE) {
+    close(fd);
+    return 1;
+  }
+  *deleted = decode_change(payload, key, value, version);
+  return 0;
+}
@@ -2,34 +2,229 @@
 #define CLIENT_API_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "src/common/constants.h"
+#include "src/common/protocol.h"
+
+// A session with the server. A process may hold any number of them, e.g. a
+// pool, and each has its own pipes (or socket) and response thread.
+typedef struct KvsConnection KvsConnection;
+
+// Every function below that takes a connection, except kvs_disconnect, may be
+// called from several threads at once on the same connection. Their requests
+// are pipelined on the session (up to MAX_PENDING_REQUESTS in flight) and each
+// call waits only for its own response.
 
 /// Connects to a kvs server.
 /// @param req_pipe_path Path to the name pipe to be created for requests.
 /// @param resp_pipe_path Path to the name pipe to be created for responses.
-/// @param server_pipe_path Path to the name pipe where the server is listening.
-/// @return 0 if the connection was established successfully, 1 otherwise.
-int kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
-                char const *notif_pipe_path, char const *server_pipe_path,
-                int *notif_pipe);
-/// Disconnects from an KVS server.
-/// @return 0 in case of success, 1 otherwise.
-int kvs_disconnect(void);
+/// @param server_pipe_path Path to the name pipe where the server is listening,
+/// or to its Unix socket. With a socket no pipes are created: the request and
+/// response pipe paths are unused, and notifications are read from an internal
+/// pipe returned in notif_pipe.
+/// @param notif_pipe Where to store the descriptor notifications are read from.
+/// @return The connection, or NULL if it could not be established.
+KvsConnection *kvs_connect(char const *req_pipe_path, char const *resp_pipe_path,
+                           char const *notif_pipe_path, char const *server_pipe_path,
+                           int *notif_pipe);
+/// Disconnects from an KVS server. Must not race with other calls on the
+/// same connection.
+/// @return 0 in case of success, 1 if the server did not confirm it. The
+/// connection is released either way.
+int kvs_disconnect(KvsConnection *conn);
 
 /// Requests a subscription for a key
 /// @param key Key to be subscribed
-/// @return 1 if the key was subscribed successfully (key existing), 0
+/// @return 0 if the key was subscribed successfully (key existing), 1
 /// otherwise.
 
-int kvs_subscribe(const char *key);
+int kvs_subscribe(KvsConnection *conn, const char *key);
+
+/// Requests a subscription for a key, with delivery options.
+/// @param key Key to be subscribed
+/// @param coalesce If non-zero, notifications for the key that are still
+/// waiting to be sent collapse to the latest value.
+/// @param max_rate Maximum notifications per second for the key (at most
+/// 65535), or 0 for no limit. Values written in between collapse to the
+/// latest one.
+/// @return 0 if the key was subscribed successfully (key existing), 1
+/// otherwise.
+int kvs_subscribe_with(KvsConnection *conn, const char *key, int coalesce, unsigned int max_rate);
+
+/// Requests a subscription for a key and returns its value and version at
+/// that moment. Notifications for the key carry versions too, and one whose
+/// version is not above the last seen for the key is a repeat.
+/// @param key Key to be subscribed
+/// @param coalesce As in kvs_subscribe_with.
+/// @param max_rate As in kvs_subscribe_with.
+/// @param since If not NULL, the last version seen for the key before the
+/// session was lost: the changes made after it arrive as notifications, in
+/// order and before any later change.
+/// @param value Buffer with MAX_STRING_SIZE bytes for the current value.
+/// @param version Where to store the version of the current value.
+/// @return 0 if the key was subscribed successfully, 2 if it was subscribed
+/// but the server no longer keeps every change after *since (the current
+/// value is all there is), 1 otherwise.
+int kvs_subscribe_versioned(KvsConnection *conn, const char *key, int coalesce,
+                            unsigned int max_rate, const uint64_t *since, char *value,
+                            uint64_t *version);
 
-/// Remove a subscription for a key
+/// Requests a subscription for every key matching a pattern, existing or
+/// not. The pattern follows fnmatch rules; "sensor*" matches every key
+/// starting with "sensor".
+/// @param pattern Pattern to be subscribed
+/// @return 0 if the pattern was subscribed successfully, 1 otherwise.
+int kvs_subscribe_pattern(KvsConnection *conn, const char *pattern);
+
+/// Remove a subscription for a key (or, failing that, for a pattern with the
+/// same text)
 /// @param key Key to be unsubscribed
 /// @return 0 if the key was unsubscribed successfully  (subscription existed
 /// and was removed), 1 otherwise.
 
-int kvs_unsubscribe(const char *key);
+int kvs_unsubscribe(KvsConnection *conn, const char *key);
+
+/// Subscribes several keys, without options, in as few requests as possible:
+/// up to MAX_REQUEST_KEYS keys per request, all sent before waiting for any
+/// response.
+/// @param num_keys Number of keys.
+/// @param keys Keys to be subscribed.
+/// @param subscribed Where to store, for each key, 1 if it was subscribed
+/// and 0 if it does not exist or was already subscribed.
+/// @return 0 if every key was subscribed, 1 if some key was not, -1 if a
+/// request failed.
+int kvs_subscribe_keys(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], int *subscribed);
+
+/// Removes the subscriptions of several keys, as kvs_subscribe_keys.
+/// @param unsubscribed Where to store, for each key, 1 if its subscription
+/// was removed and 0 if it had none.
+/// @return 0 if every subscription was removed, 1 if some key had none, -1
+/// if a request failed.
+int kvs_unsubscribe_keys(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+                         int *unsubscribed);
+
+/// Reads the values of several keys in a single request.
+/// @param num_keys Number of keys, at most MAX_REQUEST_KEYS.
+/// @param keys Keys to read.
+/// @param values Where to store the values (empty for missing keys).
+/// @param found Where to store, for each key, 1 if it exists and 0 otherwise.
+/// @return 0 if every key exists, 1 if some key is missing, -1 if the request
+/// failed.
+int kvs_read(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+             char values[][MAX_STRING_SIZE], int *found);
+
+/// Writes several key-value pairs in a single request.
+/// @param num_pairs Number of pairs, at most MAX_REQUEST_KEYS.
+/// @param keys Keys to write.
+/// @param values Values to write.
+/// @return 0 if the pairs were written successfully, 1 otherwise.
+int kvs_write(KvsConnection *conn, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+              char values[][MAX_STRING_SIZE]);
+
+/// Deletes several keys in a single request.
+/// @param num_keys Number of keys, at most MAX_REQUEST_KEYS.
+/// @param keys Keys to delete.
+/// @param missing Where to store, for each key, 1 if it did not exist and 0
+/// if it was deleted.
+/// @return 0 if every key was deleted, 1 if some key is missing, -1 if the
+/// request failed.
+int kvs_delete(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], int *missing);
+
+// Asynchronous API. Each call below sends its request and returns at once
+// (it only waits if MAX_PENDING_REQUESTS requests are already in flight).
+// When the response arrives, the connection's response thread decodes it into
+// the buffers given and calls the callback with the result the synchronous
+// call would have returned, or -1 if the session was lost. Keys are copied
+// before returning, but output buffers must stay valid until the callback.
+// Callbacks may send asynchronous requests, but must not wait for a
+// synchronous one on the same connection, nor disconnect it.
+typedef void (*KvsCallback)(int result, void *arg);
+
+/// As kvs_read, without waiting.
+/// @return 0 if the request was sent, -1 otherwise (the callback is not called).
+int kvs_read_async(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE],
+                   char values[][MAX_STRING_SIZE], int *found, KvsCallback callback, void *arg);
+
+/// As kvs_write, without waiting.
+/// @return 0 if the request was sent, -1 otherwise (the callback is not called).
+int kvs_write_async(KvsConnection *conn, size_t num_pairs, char keys[][MAX_STRING_SIZE],
+                    char values[][MAX_STRING_SIZE], KvsCallback callback, void *arg);
+
+/// As kvs_delete, without waiting.
+/// @return 0 if the request was sent, -1 otherwise (the callback is not called).
+int kvs_delete_async(KvsConnection *conn, size_t num_keys, char keys[][MAX_STRING_SIZE], int *missing,
+                     KvsCallback callback, void *arg);
+
+/// As kvs_subscribe, without waiting.
+/// @return 0 if the request was sent, -1 otherwise (the callback is not called).
+int kvs_subscribe_async(KvsConnection *conn, const char *key, KvsCallback callback, void *arg);
+
+/// As kvs_unsubscribe, without waiting.
+/// @return 0 if the request was sent, -1 otherwise (the callback is not called).
+int kvs_unsubscribe_async(KvsConnection *conn, const char *key, KvsCallback callback, void *arg);
+
+// Receives a notification: the key, its new value ("DELETED" if deleted) and
+// the version of the change. A default callback is also called once with a
+// NULL key when the notifications end, i.e. the session was closed or lost.
+typedef void (*KvsNotifyFn)(const char *key, const char *value, uint64_t version, void *arg);
+
+/// Sets the callback for the notifications of a key. The first call starts
+/// a thread that reads the notification pipe and runs every callback of the
+/// connection, one at a time; from then on the caller must not read
+/// notif_pipe itself. Notifications from pattern subscriptions carry the
+/// key that changed.
+/// @param key Key, or NULL for the default callback, which gets the
+/// notifications of keys without a callback of their own.
+/// @param notify Callback, or NULL to remove it.
+/// @param arg Passed to the callback.
+/// @return 0 on success, 1 if MAX_NOTIFICATION_HANDLERS keys already have a
+/// callback or the thread could not be started.
+int kvs_on_notification(KvsConnection *conn, const char *key, KvsNotifyFn notify, void *arg);
+
+/// Enables the near cache of a connection. kvs_read then answers keys read
+/// before from the cache, without asking the server, and sends only the
+/// other keys. Every key read from the server is cached and subscribed by
+/// the cache (in the background), whose notifications update the value or,
+/// on a delete, drop the key; they are not passed to the notification
+/// callbacks. Keys this connection writes or deletes are read from the
+/// server until the notification of the change arrives. Once capacity keys
+/// are cached, the least recently read one is evicted and unsubscribed.
+/// Subscribing to a cached key hands it over to the application. Like
+/// kvs_on_notification, it starts the dispatch thread, so the caller must
+/// not read notif_pipe itself. Must be called before the connection is used
+/// by several threads.
+/// @param capacity Maximum number of cached keys.
+/// @return 0 on success, 1 otherwise.
+int kvs_cache_enable(KvsConnection *conn, size_t capacity);
+
+/// @param hits Where to store how many keys were read from the cache.
+/// @param misses Where to store how many had to be read from the server.
+/// @param size Where to store how many keys are cached.
+void kvs_cache_stats(KvsConnection *conn, unsigned long *hits, unsigned long *misses, size_t *size);
+
+/// Opens a change-data-capture stream on the server's CDC socket. It does
+/// not need a session and is independent of kvs_connect.
+/// @param cdc_socket_path Path of the socket given to the server with -c.
+/// @param since Last version already consumed, or 0 to start with the next
+/// change.
+/// @param start Where to store the version the stream starts after.
+/// @param fd Where to store the descriptor to pass to kvs_cdc_next.
+/// @return 0 if the stream was opened, 2 if the server no longer keeps every
+/// change after since, 1 otherwise.
+int kvs_cdc_open(const char *cdc_socket_path, uint64_t since, uint64_t *start, int *fd);
+
+/// Waits for the next change of a CDC stream. Changes arrive in version
+/// order, every write and delete exactly once.
+/// @param fd Descriptor from kvs_cdc_open.
+/// @param key Buffer with MAX_STRING_SIZE bytes.
+/// @param value Buffer with MAX_STRING_SIZE bytes ("DELETED" for a delete).
+/// @param version Where to store the version of the change.
+/// @param deleted Where to store 1 if the key was deleted, 0 if written.
+/// @return 0 on a change, 2 if the server dropped the stream because it fell
+/// behind (resume from the last version consumed), 1 if the stream ended.
+/// After 1 or 2 the descriptor is closed.
+int kvs_cdc_next(int fd, char *key, char *value, uint64_t *version, int *deleted);
 
  
 #endif  // CLIENT_API_H
\ No newline at end of file
@@ -0,0 +1,148 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/client/api.h"
+#include "src/common/constants.h"
+
+// Measures the throughput of 1-key READs on a single session, either with
+// several threads making synchronous calls (each waits for its response) or
+// with one thread keeping a number of asynchronous calls in flight. Against
+// a server started with -m the session runs over the shared memory rings.
+
+static KvsConnection *conn;
+static long ops_per_thread;
+
+// In-flight asynchronous reads, updated by the response thread
+static pthread_mutex_t inflight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inflight_cond = PTHREAD_COND_INITIALIZER;
+static long inflight;
+static int failed;
+
+static void *sync_reader(void *arg) {
+  (void)arg;
+  char keys[1][MAX_STRING_SIZE] = {"bench"};
+  char values[1][MAX_STRING_SIZE];
+  int found[1];
+  for (long i = 0; i < ops_per_thread; i++) {
+    if (kvs_read(conn, 1, keys, values, found) != 0) {
+      failed = 1;
+      break;
+    }
+  }
+  return NULL;
+}
+
+static void read_done(int result, void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&inflight_mutex);
+  if (result != 0) {
+    failed = 1;
+  }
+  inflight--;
+  pthread_cond_signal(&inflight_cond);
+  pthread_mutex_unlock(&inflight_mutex);
+}
+
+// Keeps up to depth reads in flight until ops have been answered
+static void async_reads(long ops, long depth) {
+  char keys[1][MAX_STRING_SIZE] = {"bench"};
+  // Only the response thread writes these, one response at a time
+  static char values[1][MAX_STRING_SIZE];
+  static int found[1];
+  for (long i = 0; i < ops && !failed; i++) {
+    pthread_mutex_lock(&inflight_mutex);
+    while (inflight >= depth) {
+      pthread_cond_wait(&inflight_cond, &inflight_mutex);
+    }
+    inflight++;
+    pthread_mutex_unlock(&inflight_mutex);
+    if (kvs_read_async(conn, 1, keys, values, found, read_done, NULL) != 0) {
+      read_done(-1, NULL);
+    }
+  }
+  pthread_mutex_lock(&inflight_mutex);
+  while (inflight > 0) {
+    pthread_cond_wait(&inflight_cond, &inflight_mutex);
+  }
+  pthread_mutex_unlock(&inflight_mutex);
+}
+
+int main(int argc, char *argv[]) {
+  long threads = 1;
+  long depth = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+    switch (opt) {
+    case 't':
+      threads = atol(optarg);
+      break;
+    case 'd':
+      depth = atol(optarg);
+      break;
+    default:
+      threads = 0;
+      break;
+    }
+  }
+  if (argc - optind != 2 || threads <= 0 || threads > 128 || depth < 0 || atol(argv[optind + 1]) <= 0) {
+    fprintf(stderr, "Usage: %s [-t threads | -d depth] <register_pipe_path> <ops>\n", argv[0]);
+    return 1;
+  }
+  long ops = atol(argv[optind + 1]);
+
+  char req_pipe_path[64];
+  char resp_pipe_path[64];
+  char notif_pipe_path[64];
+  snprintf(req_pipe_path, sizeof(req_pipe_path), "/tmp/reqbench%d", getpid());
+  snprintf(resp_pipe_path, sizeof(resp_pipe_path), "/tmp/respbench%d", getpid());
+  snprintf(notif_pipe_path, sizeof(notif_pipe_path), "/tmp/notifbench%d", getpid());
+  int notif_pipe_fd;
+  conn = kvs_connect(req_pipe_path, resp_pipe_path, notif_pipe_path, argv[optind], &notif_pipe_fd);
+  if (conn == NULL) {
+    fprintf(stderr, "Failed to connect to the server\n");
+    return 1;
+  }
+  char keys[1][MAX_STRING_SIZE] = {"bench"};
+  char values[1][MAX_STRING_SIZE] = {"value"};
+  if (kvs_write(conn, 1, keys, values) != 0) {
+    fprintf(stderr, "Failed to write the key\n");
+    return 1;
+  }
+
+  struct timespec start;
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (depth > 0) {
+    async_reads(ops, depth);
+  } else {
+    ops_per_thread = ops / threads;
+    ops = ops_per_thread * threads;
+    pthread_t readers[128];
+    for (long i = 0; i < threads; i++) {
+      if (pthread_create(&readers[i], NULL, sync_reader, NULL) != 0) {
+        fprintf(stderr, "Failed to create thread\n");
+        return 1;
+      }
+    }
+    for (long i = 0; i < threads; i++) {
+      pthread_join(readers[i], NULL);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (failed) {
+    fprintf(stderr, "A read failed\n");
+    return 1;
+  }
+  double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  if (depth > 0) {
+    printf("depth=%ld ops=%ld ops/s=%.0f\n", depth, ops, (double)ops / seconds);
+  } else {
+    printf("threads=%ld ops=%ld ops/s=%.0f\n", threads, ops, (double)ops / seconds);
+  }
+  kvs_disconnect(conn);
+  return 0;
+}
@@ -0,0 +1,345 @@
+#include "cache.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include "keyset.h"
+
+enum {
+  ENTRY_FREE,
+  ENTRY_FILLING,  // Read from the server, waiting for its subscription
+  ENTRY_READY,
+};
+
+typedef struct {
+  char key[MAX_STRING_SIZE];
+  char value[MAX_STRING_SIZE];
+  uint64_t version;         // Version of value, 0 if not known yet
+  unsigned int writes;      // Writes of this connection still unanswered
+  uint64_t written;         // Newest version written by this connection
+  int state;
+  uint64_t fill_id;
+  long bucket_next;  // Next entry in the same bucket, or in the free list
+  long lru_prev;     // Towards the most recently used
+  long lru_next;     // Towards the least recently used
+} CacheEntry;
+
+struct NearCache {
+  pthread_mutex_t mutex;
+  CacheEntry *entries;
+  size_t capacity;
+  size_t size;
+  long *buckets;  // First entry of each bucket, -1 if empty
+  size_t bucket_mask;
+  long free_list;
+  long lru_head;
+  long lru_tail;
+  uint64_t next_fill_id;
+  // Keys dropped whose UNSUBSCRIBE is still in flight, and then those whose
+  // response arrived while notifications sent before it may still be unread:
+  // notifications for them still belong to the cache
+  KeySet *unsubscribing;
+  KeySet *released;
+  unsigned long hits;
+  unsigned long misses;
+};
+
+// FNV-1a
+static size_t hash_key(const char *key) {
+  size_t hash = 14695981039346656037u;
+  for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+    hash = (hash ^ *c) * 1099511628211u;
+  }
+  return hash;
+}
+
+NearCache *cache_new(size_t capacity) {
+  if (capacity == 0) {
+    return NULL;
+  }
+  NearCache *cache = calloc(1, sizeof(NearCache));
+  if (cache == NULL) {
+    return NULL;
+  }
+  size_t bucket_count = 2;
+  while (bucket_count < capacity) {
+    bucket_count <<= 1;
+  }
+  cache->entries = calloc(capacity, sizeof(CacheEntry));
+  cache->buckets = malloc(bucket_count * sizeof(long));
+  cache->unsubscribing = keyset_new();
+  cache->released = keyset_new();
+  if (cache->entries == NULL || cache->buckets == NULL || cache->unsubscribing == NULL ||
+      cache->released == NULL) {
+    free(cache->entries);
+    free(cache->buckets);
+    if (cache->unsubscribing != NULL) {
+      keyset_free(cache->unsubscribing);
+    }
+    if (cache->released != NULL) {
+      keyset_free(cache->released);
+    }
+    free(cache);
+    return NULL;
+  }
+  for (size_t i = 0; i < bucket_count; i++) {
+    cache->buckets[i] = -1;
+  }
+  for (size_t i = 0; i < capacity; i++) {
+    cache->entries[i].bucket_next = i + 1 < capacity ? (long)i + 1 : -1;
+  }
+  cache->capacity = capacity;
+  cache->bucket_mask = bucket_count - 1;
+  cache->free_list = 0;
+  cache->lru_head = -1;
+  cache->lru_tail = -1;
+  cache->next_fill_id = 1;
+  pthread_mutex_init(&cache->mutex, NULL);
+  return cache;
+}
+
+void cache_free(NearCache *cache) {
+  pthread_mutex_destroy(&cache->mutex);
+  free(cache->entries);
+  free(cache->buckets);
+  keyset_free(cache->unsubscribing);
+  keyset_free(cache->released);
+  free(cache);
+}
+
+// The functions below are called with the cache's mutex
+
+static long find(NearCache *cache, const char *key) {
+  long i = cache->buckets[hash_key(key) & cache->bucket_mask];
+  while (i != -1 && strcmp(cache->entries[i].key, key) != 0) {
+    i = cache->entries[i].bucket_next;
+  }
+  return i;
+}
+
+static void lru_unlink(NearCache *cache, long i) {
+  CacheEntry *entry = &cache->entries[i];
+  if (entry->lru_prev != -1) {
+    cache->entries[entry->lru_prev].lru_next = entry->lru_next;
+  } else {
+    cache->lru_head = entry->lru_next;
+  }
+  if (entry->lru_next != -1) {
+    cache->entries[entry->lru_next].lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_tail = entry->lru_prev;
+  }
+}
+
+static void lru_push_front(NearCache *cache, long i) {
+  CacheEntry *entry = &cache->entries[i];
+  entry->lru_prev = -1;
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head != -1) {
+    cache->entries[cache->lru_head].lru_prev = i;
+  } else {
+    cache->lru_tail = i;
+  }
+  cache->lru_head = i;
+}
+
+static void remove_entry(NearCache *cache, long i) {
+  CacheEntry *entry = &cache->entries[i];
+  long *link = &cache->buckets[hash_key(entry->key) & cache->bucket_mask];
+  while (*link != i) {
+    link = &cache->entries[*link].bucket_next;
+  }
+  *link = entry->bucket_next;
+  lru_unlink(cache, i);
+
+  entry->state = ENTRY_FREE;
+  entry->bucket_next = cache->free_list;
+  cache->free_list = i;
+  cache->size--;
+}
+
+int cache_get(NearCache *cache, const char *key, char *value) {
+  pthread_mutex_lock(&cache->mutex);
+  long i = find(cache, key);
+  int hit = i != -1 && cache->entries[i].state == ENTRY_READY && cache->entries[i].writes == 0 &&
+            cache->entries[i].version >= cache->entries[i].written;
+  if (hit) {
+    memcpy(value, cache->entries[i].value, MAX_STRING_SIZE);
+    lru_unlink(cache, i);
+    lru_push_front(cache, i);
+    cache->hits++;
+  } else {
+    cache->misses++;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return hit;
+}
+
+uint64_t cache_begin_fill(NearCache *cache, const char *key, char *evicted, int *has_evicted) {
+  *has_evicted = 0;
+  pthread_mutex_lock(&cache->mutex);
+  if (find(cache, key) != -1) {
+    pthread_mutex_unlock(&cache->mutex);
+    return 0;
+  }
+
+  if (cache->free_list == -1) {
+    // Entries still waiting for their subscription are not evicted
+    long victim = cache->lru_tail;
+    while (victim != -1 && cache->entries[victim].state != ENTRY_READY) {
+      victim = cache->entries[victim].lru_prev;
+    }
+    if (victim == -1) {
+      pthread_mutex_unlock(&cache->mutex);
+      return 0;
+    }
+    memcpy(evicted, cache->entries[victim].key, MAX_STRING_SIZE);
+    *has_evicted = 1;
+    keyset_add(cache->unsubscribing, evicted);
+    remove_entry(cache, victim);
+  }
+
+  long i = cache->free_list;
+  CacheEntry *entry = &cache->entries[i];
+  cache->free_list = entry->bucket_next;
+  snprintf(entry->key, MAX_STRING_SIZE, "%s", key);
+  entry->value[0] = '\0';
+  entry->version = 0;
+  entry->writes = 0;
+  entry->written = 0;
+  entry->state = ENTRY_FILLING;
+  entry->fill_id = cache->next_fill_id++;
+  long *bucket = &cache->buckets[hash_key(key) & cache->bucket_mask];
+  entry->bucket_next = *bucket;
+  *bucket = i;
+  lru_push_front(cache, i);
+  cache->size++;
+
+  uint64_t fill_id = entry->fill_id;
+  pthread_mutex_unlock(&cache->mutex);
+  return fill_id;
+}
+
+void cache_end_fill(NearCache *cache, const char *key, uint64_t fill_id, int subscribed, const char *value,
+                    uint64_t version) {
+  pthread_mutex_lock(&cache->mutex);
+  // The entry may be gone already, e.g. if the key was deleted meanwhile
+  long i = find(cache, key);
+  if (i != -1 && cache->entries[i].state == ENTRY_FILLING && cache->entries[i].fill_id == fill_id) {
+    CacheEntry *entry = &cache->entries[i];
+    if (!subscribed) {
+      remove_entry(cache, i);
+    } else {
+      // A notification newer than the subscription may have arrived first
+      if (version >= entry->version) {
+        snprintf(entry->value, MAX_STRING_SIZE, "%s", value);
+        entry->version = version;
+      }
+      entry->state = ENTRY_READY;
+    }
+  }
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+int cache_apply(NearCache *cache, const char *key, const char *value, uint64_t version) {
+  pthread_mutex_lock(&cache->mutex);
+  long i = find(cache, key);
+  if (i == -1) {
+    int unsubscribing = keyset_count(cache->unsubscribing, key) > 0 || keyset_count(cache->released, key) > 0;
+    pthread_mutex_unlock(&cache->mutex);
+    return unsubscribing;
+  }
+  CacheEntry *entry = &cache->entries[i];
+  if (strcmp(value, "DELETED") == 0) {
+    remove_entry(cache, i);
+  } else if (version > entry->version) {
+    snprintf(entry->value, MAX_STRING_SIZE, "%s", value);
+    entry->version = version;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return 1;
+}
+
+uint64_t cache_mark_stale(NearCache *cache, const char *key) {
+  pthread_mutex_lock(&cache->mutex);
+  long i = find(cache, key);
+  uint64_t mark = 0;
+  if (i != -1) {
+    cache->entries[i].writes++;
+    mark = cache->entries[i].fill_id;
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return mark;
+}
+
+void cache_written(NearCache *cache, const char *key, uint64_t mark, uint64_t version) {
+  if (mark == 0) {
+    return;
+  }
+  pthread_mutex_lock(&cache->mutex);
+  // An entry cached again since has its own count, and already sees the write
+  long i = find(cache, key);
+  if (i != -1 && cache->entries[i].fill_id == mark && cache->entries[i].writes > 0) {
+    cache->entries[i].writes--;
+    if (version > cache->entries[i].written) {
+      cache->entries[i].written = version;
+    }
+  }
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+int cache_forget(NearCache *cache, const char *key) {
+  pthread_mutex_lock(&cache->mutex);
+  long i = find(cache, key);
+  // An entry being filled is subscribed once its subscription completes;
+  // dropping it makes cache_end_fill ignore it, so it counts as subscribed
+  int subscribed = i != -1;
+  if (i != -1) {
+    keyset_add(cache->unsubscribing, key);
+    remove_entry(cache, i);
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return subscribed;
+}
+
+size_t cache_invalidate(NearCache *cache, char keys[][MAX_STRING_SIZE]) {
+  pthread_mutex_lock(&cache->mutex);
+  // Entries being filled count as subscribed, as in cache_forget
+  size_t count = 0;
+  while (cache->lru_head != -1) {
+    long i = cache->lru_head;
+    memcpy(keys[count++], cache->entries[i].key, MAX_STRING_SIZE);
+    keyset_add(cache->unsubscribing, cache->entries[i].key);
+    remove_entry(cache, i);
+  }
+  pthread_mutex_unlock(&cache->mutex);
+  return count;
+}
+
+void cache_unsubscribed(NearCache *cache, const char *key) {
+  pthread_mutex_lock(&cache->mutex);
+  keyset_remove(cache->unsubscribing, key);
+  keyset_add(cache->released, key);
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+void cache_notifications_read(NearCache *cache, int notif_fd) {
+  pthread_mutex_lock(&cache->mutex);
+  // Under the mutex, so no key released after the check is forgotten
+  int available = 0;
+  if (keyset_size(cache->released) > 0 && ioctl(notif_fd, FIONREAD, &available) == 0 && available == 0) {
+    keyset_clear(cache->released);
+  }
+  pthread_mutex_unlock(&cache->mutex);
+}
+
+void cache_stats(NearCache *cache, unsigned long *hits, unsigned long *misses, size_t *size) {
+  pthread_mutex_lock(&cache->mutex);
+  *hits = cache->hits;
+  *misses = cache->misses;
+  *size = cache->size;
+  pthread_mutex_unlock(&cache->mutex);
+}
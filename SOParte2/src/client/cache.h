@@ -0,0 +1,90 @@
+#ifndef CLIENT_CACHE_H
+#define CLIENT_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "src/common/constants.h"
+
+// Near cache of a connection: the values of recently read keys, each kept
+// up to date by a subscription of the cache's own. Entries are evicted in
+// LRU order once the cache is full. All functions are thread-safe.
+typedef struct NearCache NearCache;
+
+/// Creates an empty cache.
+/// @param capacity Maximum number of keys.
+/// @return The cache, or NULL if there is not enough memory.
+NearCache *cache_new(size_t capacity);
+
+void cache_free(NearCache *cache);
+
+/// Looks a key up and marks it as the most recently used.
+/// @param value Buffer with MAX_STRING_SIZE bytes for the value.
+/// @return 1 if the key is cached and up to date, 0 otherwise.
+int cache_get(NearCache *cache, const char *key, char *value);
+
+/// Reserves an entry for a key just read from the server, which the caller
+/// then subscribes to finish the entry with cache_end_fill. Evicts the least
+/// recently used key if the cache is full.
+/// @param evicted Buffer with MAX_STRING_SIZE bytes for the evicted key.
+/// @param has_evicted Set to 1 if the caller must unsubscribe evicted, and
+/// call cache_unsubscribed once the response arrives.
+/// @return A non-zero id for cache_end_fill, or 0 if the key is already
+/// cached or being filled, or no entry could be evicted.
+uint64_t cache_begin_fill(NearCache *cache, const char *key, char *evicted, int *has_evicted);
+
+/// Finishes an entry reserved by cache_begin_fill.
+/// @param fill_id Id returned by cache_begin_fill.
+/// @param subscribed 1 if the subscription succeeded, 0 to drop the entry.
+/// @param value Value returned by the subscription.
+/// @param version Version of that value.
+void cache_end_fill(NearCache *cache, const char *key, uint64_t fill_id, int subscribed, const char *value,
+                    uint64_t version);
+
+/// Applies a notification. A delete drops the entry, as the server ends
+/// the subscription; an older version than the cached one is ignored.
+/// @return 1 if the notification came from a subscription of the cache,
+/// including one being unsubscribed.
+int cache_apply(NearCache *cache, const char *key, const char *value, uint64_t version);
+
+/// Marks a key that this connection is about to write or delete as stale,
+/// so it is read from the server until the response of the write arrives
+/// and the cached value is at least as new as the version it assigned.
+/// @return A mark for cache_written, 0 if the key is not cached.
+uint64_t cache_mark_stale(NearCache *cache, const char *key);
+
+/// Records the response of a write or delete marked with cache_mark_stale.
+/// @param mark Mark returned by cache_mark_stale.
+/// @param version Version the server assigned to the change, 0 if the key
+/// was not changed or the response was lost.
+void cache_written(NearCache *cache, const char *key, uint64_t mark, uint64_t version);
+
+/// Drops a key, e.g. before the application subscribes to it itself.
+/// @return 1 if the cache was subscribed to it, in which case the caller
+/// unsubscribes it and calls cache_unsubscribed once the response arrives.
+int cache_forget(NearCache *cache, const char *key);
+
+/// Drops every key, e.g. after notifications were lost, as the cached
+/// values can no longer be trusted.
+/// @param keys Buffer with room for the capacity of the cache, for the keys
+/// the caller must unsubscribe and then pass to cache_unsubscribed.
+/// @return The number of keys stored in keys.
+size_t cache_invalidate(NearCache *cache, char keys[][MAX_STRING_SIZE]);
+
+/// Records the response to the UNSUBSCRIBE of a key evicted or forgotten,
+/// whatever its result. Notifications for the key sent before the response
+/// are still the cache's until cache_notifications_read.
+void cache_unsubscribed(NearCache *cache, const char *key);
+
+/// Called by the thread reading notifications between two of them: once the
+/// notification pipe is empty, every notification sent before the responses
+/// recorded with cache_unsubscribed has been applied, and those keys are no
+/// longer the cache's.
+void cache_notifications_read(NearCache *cache, int notif_fd);
+
+/// @param hits Where to store how many lookups found the key.
+/// @param misses Where to store how many did not.
+/// @param size Where to store the number of cached keys.
+void cache_stats(NearCache *cache, unsigned long *hits, unsigned long *misses, size_t *size);
+
+#endif  // CLIENT_CACHE_H
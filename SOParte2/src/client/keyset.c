@@ -0,0 +1,135 @@
+#include "keyset.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct KeyNode {
+  char key[MAX_STRING_SIZE];
+  size_t count;
+  struct KeyNode *next;
+} KeyNode;
+
+struct KeySet {
+  KeyNode **buckets;
+  size_t bucket_count;  // A power of two
+  size_t size;          // Distinct keys
+};
+
+#define KEYSET_INITIAL_BUCKETS 16
+
+// FNV-1a
+static size_t hash_key(const char *key) {
+  size_t hash = 14695981039346656037u;
+  for (const unsigned char *c = (const unsigned char *)key; *c != '\0'; c++) {
+    hash = (hash ^ *c) * 1099511628211u;
+  }
+  return hash;
+}
+
+KeySet *keyset_new(void) {
+  KeySet *set = calloc(1, sizeof(KeySet));
+  if (set == NULL) {
+    return NULL;
+  }
+  set->buckets = calloc(KEYSET_INITIAL_BUCKETS, sizeof(KeyNode *));
+  if (set->buckets == NULL) {
+    free(set);
+    return NULL;
+  }
+  set->bucket_count = KEYSET_INITIAL_BUCKETS;
+  return set;
+}
+
+void keyset_free(KeySet *set) {
+  keyset_clear(set);
+  free(set->buckets);
+  free(set);
+}
+
+static KeyNode **find(const KeySet *set, const char *key) {
+  KeyNode **link = &set->buckets[hash_key(key) & (set->bucket_count - 1)];
+  while (*link != NULL && strcmp((*link)->key, key) != 0) {
+    link = &(*link)->next;
+  }
+  return link;
+}
+
+// Doubles the buckets once there are more keys than buckets. Without memory
+// the set keeps working, only with longer chains.
+static void grow(KeySet *set) {
+  size_t bucket_count = set->bucket_count * 2;
+  KeyNode **buckets = calloc(bucket_count, sizeof(KeyNode *));
+  if (buckets == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < set->bucket_count; i++) {
+    KeyNode *node = set->buckets[i];
+    while (node != NULL) {
+      KeyNode *next = node->next;
+      size_t bucket = hash_key(node->key) & (bucket_count - 1);
+      node->next = buckets[bucket];
+      buckets[bucket] = node;
+      node = next;
+    }
+  }
+  free(set->buckets);
+  set->buckets = buckets;
+  set->bucket_count = bucket_count;
+}
+
+size_t keyset_add(KeySet *set, const char *key) {
+  KeyNode **link = find(set, key);
+  if (*link != NULL) {
+    return ++(*link)->count;
+  }
+  KeyNode *node = malloc(sizeof(KeyNode));
+  if (node == NULL) {
+    return 0;
+  }
+  snprintf(node->key, MAX_STRING_SIZE, "%s", key);
+  node->count = 1;
+  node->next = NULL;
+  *link = node;
+  if (++set->size > set->bucket_count) {
+    grow(set);
+  }
+  return 1;
+}
+
+size_t keyset_remove(KeySet *set, const char *key) {
+  KeyNode **link = find(set, key);
+  KeyNode *node = *link;
+  if (node == NULL) {
+    return 0;
+  }
+  if (--node->count > 0) {
+    return node->count;
+  }
+  *link = node->next;
+  free(node);
+  set->size--;
+  return 0;
+}
+
+size_t keyset_count(const KeySet *set, const char *key) {
+  KeyNode *node = *find(set, key);
+  return node != NULL ? node->count : 0;
+}
+
+size_t keyset_size(const KeySet *set) {
+  return set->size;
+}
+
+void keyset_clear(KeySet *set) {
+  for (size_t i = 0; i < set->bucket_count; i++) {
+    KeyNode *node = set->buckets[i];
+    while (node != NULL) {
+      KeyNode *next = node->next;
+      free(node);
+      node = next;
+    }
+    set->buckets[i] = NULL;
+  }
+  set->size = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef CLIENT_KEYSET_H
+#define CLIENT_KEYSET_H
+
+#include <stddef.h>
+
+#include "src/common/constants.h"
+
+// Multiset of keys in a hash table that grows with it. Not thread-safe: the
+// caller holds the lock that protects the set.
+typedef struct KeySet KeySet;
+
+/// @return An empty set, or NULL if there is not enough memory.
+KeySet *keyset_new(void);
+
+void keyset_free(KeySet *set);
+
+/// Adds one occurrence of a key.
+/// @return The number of occurrences of the key now, 0 if there is not
+/// enough memory.
+size_t keyset_add(KeySet *set, const char *key);
+
+/// Removes one occurrence of a key, if it has any.
+/// @return The number of occurrences left.
+size_t keyset_remove(KeySet *set, const char *key);
+
+/// @return The number of occurrences of a key.
+size_t keyset_count(const KeySet *set, const char *key);
+
+/// @return The number of distinct keys.
+size_t keyset_size(const KeySet *set);
+
+/// Removes every key.
+void keyset_clear(KeySet *set);
+
+#endif  // CLIENT_KEYSET_H
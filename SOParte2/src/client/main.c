@@ -10,38 +10,76 @@
 #include "src/client/api.h"
 #include "src/common/constants.h"
 #include "src/common/io.h"
+#include "src/common/protocol.h"
 
-void *thread_notif(void* arg) {
-  int* notif_fd = (int*)arg;
-  
-  char notification[2*MAX_STRING_SIZE];
-  char key[MAX_STRING_SIZE];
-  char value[MAX_STRING_SIZE];
+// Prints every notification; runs on the library's dispatch thread
+static void print_notification(const char *key, const char *value, uint64_t version, void *arg) {
+  (void)version;
+  (void)arg;
+  if (key == NULL) {
+    fprintf(stderr, "pipe closed\n");
+    return;
+  }
+  printf("(%s,%s)\n", key, value);
+}
 
-  while(1) {
-    ssize_t bytes_read = read(*notif_fd, notification, 2*MAX_STRING_SIZE);
-    if (bytes_read == 0) {
-      // bytes_read == 0 indica EOF
-      fprintf(stderr, "pipe closed\n");
-      return NULL;
-    } else if (bytes_read == -1) {
-      // bytes_read == -1 indica erro
-      fprintf(stderr, "read failed: %s\n", strerror(errno));
-      exit(EXIT_FAILURE);
+// Prints the keys a SUBSCRIBE or UNSUBSCRIBE of several keys did not apply to
+static void print_failed_keys(size_t num, char keys[][MAX_STRING_SIZE], const int *done) {
+  printf("[");
+  for (size_t i = 0; i < num; i++) {
+    if (!done[i]) {
+      printf("(%s,KVSERROR)", keys[i]);
     }
+  }
+  printf("]\n");
+}
 
-    strncpy(key, notification + 2, MAX_STRING_SIZE);
-    strncpy(value, notification + 2, MAX_STRING_SIZE);
+// Prints every change of the server's CDC stream until it ends
+static int consume_cdc(const char *cdc_socket_path, const char *since_arg) {
+  char *end = NULL;
+  uint64_t since = since_arg != NULL ? strtoull(since_arg, &end, 10) : 0;
+  if (since_arg != NULL && (*since_arg == '\0' || *end != '\0')) {
+    fprintf(stderr, "Invalid version: %s\n", since_arg);
+    return 1;
+  }
 
-    printf("(%s,%s)\n", key, value);
+  uint64_t version;
+  int fd;
+  switch (kvs_cdc_open(cdc_socket_path, since, &version, &fd)) {
+  case 0:
+    printf("Streaming changes after version %llu\n", (unsigned long long)version);
+    break;
+  case 2:
+    fprintf(stderr, "Changes since version %llu are gone\n", (unsigned long long)version);
+    return 1;
+  default:
+    fprintf(stderr, "Failed to open the CDC stream\n");
+    return 1;
+  }
 
+  char key[MAX_STRING_SIZE];
+  char value[MAX_STRING_SIZE];
+  int deleted;
+  int result;
+  while ((result = kvs_cdc_next(fd, key, value, &version, &deleted)) == 0) {
+    printf("%llu %s (%s,%s)\n", (unsigned long long)version, deleted ? "DELETE" : "WRITE", key, value);
+    fflush(stdout);
+  }
+  if (result == 2) {
+    fprintf(stderr, "Fell behind the server's change log; resume from the last version printed\n");
+    return 1;
   }
+  return 0;
 }
 
 int main(int argc, char *argv[]) {
+  if (argc >= 3 && strcmp(argv[1], "--cdc") == 0) {
+    return consume_cdc(argv[2], argc > 3 ? argv[3] : NULL);
+  }
   if (argc < 3) {
-    fprintf(stderr, "Usage: %s <client_unique_id> <register_pipe_path>\n",
-            argv[0]);
+    fprintf(stderr, "Usage: %s <client_unique_id> <register_pipe_path> [cache_size]\n"
+                    "       %s --cdc <cdc_socket_path> [since_version]\n",
+            argv[0], argv[0]);
     return 1;
   }
 
@@ -51,9 +89,13 @@ int main(int argc, char *argv[]) {
   char resp_pipe_path[256] = "/tmp/resp";
   char notif_pipe_path[256] = "/tmp/notif";
 
-  char keys[MAX_NUMBER_SUB][MAX_STRING_SIZE] = {0};
+  char keys[MAX_REQUEST_KEYS][MAX_STRING_SIZE] = {0};
+  char values[MAX_REQUEST_KEYS][MAX_STRING_SIZE] = {0};
+  int results[MAX_REQUEST_KEYS];
   unsigned int delay_ms;
   size_t num;
+  SubscribeOptions options;
+  uint64_t version;
 
   // Permite ao cliente receber notificações
   int notif_pipe_fd;
@@ -63,51 +105,163 @@ int main(int argc, char *argv[]) {
   strncat(notif_pipe_path, argv[1], strlen(argv[1]) * sizeof(char));
 
   // TODO open pipes
-  if (kvs_connect(req_pipe_path, resp_pipe_path, notif_pipe_path, register_pipe_path, &notif_pipe_fd) != 0) {
+  KvsConnection *conn = kvs_connect(req_pipe_path, resp_pipe_path, notif_pipe_path, register_pipe_path,
+                                    &notif_pipe_fd);
+  if (conn == NULL) {
     fprintf(stderr, "Failed to connect to the server\n");
     return 1;
   }
 
-  pthread_t notif_thread;
-  pthread_create(&notif_thread, NULL, thread_notif, &notif_pipe_fd);
+  // With a cache size, repeated reads of a key are answered locally
+  if (argc > 3 && (atoi(argv[3]) <= 0 || kvs_cache_enable(conn, (size_t)atoi(argv[3])) != 0)) {
+    fprintf(stderr, "Invalid cache size: %s\n", argv[3]);
+    return 1;
+  }
+  if (kvs_on_notification(conn, NULL, print_notification, NULL) != 0) {
+    fprintf(stderr, "Failed to receive notifications\n");
+    return 1;
+  }
 
   while (1) {
     switch (get_next(STDIN_FILENO)) {
     case CMD_DISCONNECT:
-      if (kvs_disconnect() != 0) {
+      if (argc > 3) {
+        unsigned long hits;
+        unsigned long misses;
+        size_t cached;
+        kvs_cache_stats(conn, &hits, &misses, &cached);
+        fprintf(stderr, "Cache: hits=%lu misses=%lu keys=%zu\n", hits, misses, cached);
+      }
+      if (kvs_disconnect(conn) != 0) {
         fprintf(stderr, "Failed to disconnect to the server\n");
         return 1;
       }
-      // TODO: end notifications thread
       printf("Disconnected from server\n");
       return 0;
 
     case CMD_SUBSCRIBE:
-      num = parse_list(STDIN_FILENO, keys, 1, MAX_STRING_SIZE);
+      num = parse_subscribe(STDIN_FILENO, keys, MAX_REQUEST_KEYS, &options);
       if (num == 0) {
         fprintf(stderr, "Invalid command. See HELP for usage\n");
         continue;
       }
 
-      if (kvs_subscribe(keys[0])) {
-        fprintf(stderr, "Command subscribe failed\n");
+      // Several keys go in a single request, with the keys not subscribed listed
+      if (num > 1) {
+        int subscribed = kvs_subscribe_keys(conn, num, keys, results);
+        if (subscribed == -1) {
+          fprintf(stderr, "Command subscribe failed\n");
+        } else if (subscribed == 1) {
+          print_failed_keys(num, keys, results);
+        }
+        break;
+      }
+
+      if (options.pattern) {
+        if (kvs_subscribe_pattern(conn, keys[0])) {
+          fprintf(stderr, "Command subscribe failed\n");
+        }
+        break;
+      }
+      if (!options.resume) {
+        if (kvs_subscribe_with(conn, keys[0], options.coalesce, options.max_rate)) {
+          fprintf(stderr, "Command subscribe failed\n");
+        }
+        break;
       }
 
+      // With SINCE the missed changes are printed as notifications
+      switch (kvs_subscribe_versioned(conn, keys[0], options.coalesce, options.max_rate, &options.since,
+                                      values[0], &version)) {
+      case 0:
+        printf("Resumed (%s,%s) at version %llu\n", keys[0], values[0], (unsigned long long)version);
+        break;
+      case 2:
+        printf("Changes since version %llu are gone: (%s,%s) at version %llu\n",
+               (unsigned long long)options.since, keys[0], values[0], (unsigned long long)version);
+        break;
+      default:
+        fprintf(stderr, "Command subscribe failed\n");
+        break;
+      }
       break;
 
     case CMD_UNSUBSCRIBE:
-      num = parse_list(STDIN_FILENO, keys, 1, MAX_STRING_SIZE);
+      num = parse_list(STDIN_FILENO, keys, MAX_REQUEST_KEYS, MAX_STRING_SIZE);
       if (num == 0) {
         fprintf(stderr, "Invalid command. See HELP for usage\n");
         continue;
       }
 
-      if (kvs_unsubscribe(keys[0])) {
+      if (num > 1) {
+        int unsubscribed = kvs_unsubscribe_keys(conn, num, keys, results);
+        if (unsubscribed == -1) {
+          fprintf(stderr, "Command unsubscribe failed\n");
+        } else if (unsubscribed == 1) {
+          print_failed_keys(num, keys, results);
+        }
+        break;
+      }
+      if (kvs_unsubscribe(conn, keys[0])) {
         fprintf(stderr, "Command subscribe failed\n");
       }
 
       break;
 
+    case CMD_READ:
+      num = parse_list(STDIN_FILENO, keys, MAX_REQUEST_KEYS, MAX_STRING_SIZE);
+      if (num == 0) {
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_read(conn, num, keys, values, results) == -1) {
+        fprintf(stderr, "Command read failed\n");
+        break;
+      }
+
+      printf("[");
+      for (size_t i = 0; i < num; i++) {
+        printf("(%s,%s)", keys[i], results[i] ? values[i] : "KVSERROR");
+      }
+      printf("]\n");
+      break;
+
+    case CMD_WRITE:
+      num = parse_pairs(STDIN_FILENO, keys, values, MAX_REQUEST_KEYS, MAX_STRING_SIZE);
+      if (num == 0) {
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      if (kvs_write(conn, num, keys, values)) {
+        fprintf(stderr, "Command write failed\n");
+      }
+
+      break;
+
+    case CMD_DELETE:
+      num = parse_list(STDIN_FILENO, keys, MAX_REQUEST_KEYS, MAX_STRING_SIZE);
+      if (num == 0) {
+        fprintf(stderr, "Invalid command. See HELP for usage\n");
+        continue;
+      }
+
+      int deleted = kvs_delete(conn, num, keys, results);
+      if (deleted == -1) {
+        fprintf(stderr, "Command delete failed\n");
+      } else if (deleted == 1) {
+        printf("[");
+        for (size_t i = 0; i < num; i++) {
+          if (results[i]) {
+            printf("(%s,KVSMISSING)", keys[i]);
+          }
+        }
+        printf("]\n");
+      }
+
+      break;
+
     case CMD_DELAY:
       if (parse_delay(STDIN_FILENO, &delay_ms) == -1) {
         fprintf(stderr, "Invalid command. See HELP for usage\n");
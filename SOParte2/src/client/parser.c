@@ -1,6 +1,8 @@
 #include "parser.h"
 
+#include <errno.h>
 #include <limits.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -115,8 +117,31 @@ enum Command get_next(int fd) {
 
       return CMD_UNSUBSCRIBE;
 
+    case 'R':
+      if (read(fd, buf + 1, 4) != 4 || strncmp(buf, "READ ", 5) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_READ;
+
+    case 'W':
+      if (read(fd, buf + 1, 5) != 5 || strncmp(buf, "WRITE ", 6) != 0) {
+        cleanup(fd);
+        return CMD_INVALID;
+      }
+
+      return CMD_WRITE;
+
     case 'D':
       if (read(fd, buf + 1, 5) != 5 || strncmp(buf, "DELAY ", 6) != 0) {
+        if (strncmp(buf, "DELETE", 6) == 0) {
+          if (read(fd, buf + 6, 1) != 1 || buf[6] != ' ') {
+            cleanup(fd);
+            return CMD_INVALID;
+          }
+          return CMD_DELETE;
+        }
         if (read(fd, buf + 6, 4) != 4 || strncmp(buf, "DISCONNECT", 10) != 0) {
           cleanup(fd);
           return CMD_INVALID;
@@ -181,6 +206,126 @@ size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t
   return num_keys;
 }
 
+size_t parse_pairs(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+                   size_t max_pairs, size_t max_string_size) {
+  char ch;
+
+  if (read(fd, &ch, 1) != 1 || ch != '[') {
+    cleanup(fd);
+    return 0;
+  }
+
+  if (read(fd, &ch, 1) != 1 || ch != '(') {
+    cleanup(fd);
+    return 0;
+  }
+
+  size_t num_pairs = 0;
+  char key[max_string_size];
+  char value[max_string_size];
+  while (num_pairs < max_pairs) {
+    if (read_string(fd, key, max_string_size - 1) != 0 ||
+        read_string(fd, value, max_string_size - 1) != 1) {
+      cleanup(fd);
+      return 0;
+    }
+
+    strcpy(keys[num_pairs], key);
+    strcpy(values[num_pairs++], value);
+
+    if (read(fd, &ch, 1) != 1 || (ch != '(' && ch != ']')) {
+      cleanup(fd);
+      return 0;
+    }
+
+    if (ch == ']') {
+      break;
+    }
+  }
+
+  if (num_pairs == max_pairs && ch != ']') {
+    cleanup(fd);
+    return 0;
+  }
+
+  if (read(fd, &ch, 1) != 1 || (ch != '\n' && ch != '\0')) {
+    cleanup(fd);
+    return 0;
+  }
+
+  return num_pairs;
+}
+
+size_t parse_subscribe(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, SubscribeOptions *options) {
+  char ch;
+  memset(options, 0, sizeof(*options));
+
+  if (read(fd, &ch, 1) != 1 || ch != '[') {
+    cleanup(fd);
+    return 0;
+  }
+  size_t num_keys = 0;
+  int output = 0;
+  while (output == 0) {
+    if (num_keys == max_keys) {
+      cleanup(fd);
+      return 0;
+    }
+    output = read_string(fd, keys[num_keys++], MAX_STRING_SIZE - 1);
+    if (output != 0 && output != 2) {
+      cleanup(fd);
+      return 0;
+    }
+  }
+
+  // Rest of the line: the options, if any
+  char line[64];
+  size_t length = 0;
+  while (read(fd, &ch, 1) == 1 && ch != '\n') {
+    if (length == sizeof(line) - 1) {
+      cleanup(fd);
+      return 0;
+    }
+    line[length++] = ch;
+  }
+  line[length] = '\0';
+
+  char *saveptr;
+  for (char *token = strtok_r(line, " ", &saveptr); token != NULL;
+       token = strtok_r(NULL, " ", &saveptr)) {
+    char *end;
+    if (strcmp(token, "COALESCE") == 0) {
+      options->coalesce = 1;
+    } else if (strcmp(token, "PATTERN") == 0) {
+      options->pattern = 1;
+    } else if (strcmp(token, "SINCE") == 0) {
+      token = strtok_r(NULL, " ", &saveptr);
+      if (token == NULL) {
+        return 0;
+      }
+      errno = 0;
+      unsigned long long since = strtoull(token, &end, 10);
+      if (*end != '\0' || errno == ERANGE) {
+        return 0;
+      }
+      options->resume = 1;
+      options->since = (uint64_t)since;
+    } else {
+      unsigned long rate = strtoul(token, &end, 10);
+      if (*end != '\0' || rate == 0 || rate > UINT16_MAX) {
+        return 0;
+      }
+      options->max_rate = (unsigned int)rate;
+    }
+  }
+  // Patterns take no other option, and lists of keys take none
+  int has_options = options->coalesce || options->max_rate != 0 || options->resume;
+  if ((options->pattern && has_options) || (num_keys > 1 && (options->pattern || has_options))) {
+    return 0;
+  }
+  return num_keys;
+}
+
 int parse_delay(int fd, unsigned int *delay) {
   char ch;
 
@@ -2,6 +2,7 @@
 #define KVS_PARSER_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include "src/common/constants.h"
 
@@ -10,6 +11,9 @@ enum Command {
   CMD_SUBSCRIBE,
   CMD_UNSUBSCRIBE,
   CMD_DELAY,
+  CMD_READ,
+  CMD_WRITE,
+  CMD_DELETE,
   CMD_EMPTY,
   CMD_INVALID,
   EOC  // End of commands
@@ -30,6 +34,37 @@ enum Command get_next(int fd);
 //          of keys parsed
 size_t parse_list(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, size_t max_string_size);
 
+// Parses a list of pairs, in the form [(key,value)(key,value)]
+// @param fd File descriptor to read from.
+// @param keys Array to store the keys
+// @param values Array to store the values
+// @param max_pairs Maximum number of pairs it will write.
+// @param max_string_size Maximum string size allowed.
+// @return 0 if the command was not parsed successfully, otherwise return the
+//          number of pairs parsed
+size_t parse_pairs(int fd, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+                   size_t max_pairs, size_t max_string_size);
+
+// Options of a SUBSCRIBE command
+typedef struct {
+  int coalesce;           // COALESCE was given
+  unsigned int max_rate;  // Maximum rate, 0 if none was given
+  int pattern;            // PATTERN was given
+  int resume;             // SINCE <version> was given
+  uint64_t since;
+} SubscribeOptions;
+
+// Parses the arguments of a SUBSCRIBE command: [key], optionally followed by
+// COALESCE, the maximum number of notifications per second and/or
+// SINCE <version>, or by PATTERN alone; or a list of keys, [key1,key2,...],
+// with no options.
+// @param fd File descriptor to read from.
+// @param keys Array of buffers with MAX_STRING_SIZE bytes for the keys.
+// @param max_keys Maximum number of keys.
+// @param options Where to store the options.
+// @return Number of keys parsed, or 0 if the command is invalid.
+size_t parse_subscribe(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys, SubscribeOptions *options);
+
 // Parses a DELAY command.
 // @param fd File descriptor to read from.
 // @param delay Pointer to the variable to store the wait delay in.
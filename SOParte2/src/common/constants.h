@@ -1,6 +1,8 @@
 // constantes partilhadas entre cliente e servidor
-#define MAX_SESSION_COUNT 3 // num max de sessoes no server, 1 default, necessario alterar mais tarde
+#define MAX_SESSION_COUNT 3 // threads que abrem os pipes dos clientes (o num de sessoes e configuravel no server com -s)
 #define STATE_ACCESS_DELAY_US  // delay a aplicar no server
 #define MAX_PIPE_PATH_LENGTH 80 // tamanho max do caminho do pipe
 #define MAX_STRING_SIZE 40
-#define MAX_NUMBER_SUB 10
\ No newline at end of file
+#define MAX_NUMBER_SUB 10
+#define MAX_PENDING_REQUESTS 64 // pedidos em curso ao mesmo tempo numa sessao do cliente
+#define MAX_NOTIFICATION_HANDLERS 64 // chaves com callback de notificacoes numa sessao do cliente
@@ -78,4 +78,170 @@ void delay(unsigned int time_ms) {
     nanosleep(&delay, NULL);
 }
 
+void encode_frame_header(char *frame, uint8_t op_code, uint8_t status, uint32_t request_id,
+                         size_t length) {
+  frame[0] = (char)op_code;
+  frame[1] = (char)status;
+  frame[2] = (char)(length & 0xff);
+  frame[3] = (char)(length >> 8);
+  frame[4] = (char)(request_id & 0xff);
+  frame[5] = (char)(request_id >> 8);
+  frame[6] = (char)(request_id >> 16);
+  frame[7] = (char)(request_id >> 24);
+}
+
+size_t encode_frame(char *frame, uint8_t op_code, uint8_t status, uint32_t request_id,
+                    const void *payload, size_t length) {
+  encode_frame_header(frame, op_code, status, request_id, length);
+  if (length > 0) {
+    memcpy(frame + FRAME_HEADER_SIZE, payload, length);
+  }
+  return FRAME_HEADER_SIZE + length;
+}
+
+int send_frame(int fd, uint8_t op_code, uint8_t status, uint32_t request_id, const void *payload,
+               size_t length) {
+  if (length > FRAME_MAX_PAYLOAD) {
+    fprintf(stderr, "Frame payload too large: %zu bytes\n", length);
+    return -1;
+  }
+
+  char frame[FRAME_MAX_SIZE];
+  size_t size = encode_frame(frame, op_code, status, request_id, payload, length);
+  return write_all(fd, frame, size);
+}
+
+void decode_frame_header(const void *frame, FrameHeader *header) {
+  const unsigned char *raw = frame;
+  header->op_code = raw[0];
+  header->status = raw[1];
+  header->length = (uint16_t)(raw[2] | raw[3] << 8);
+  header->request_id = (uint32_t)raw[4] | (uint32_t)raw[5] << 8 | (uint32_t)raw[6] << 16 |
+                       (uint32_t)raw[7] << 24;
+}
+
+int recv_frame(int fd, FrameHeader *header, void *payload, size_t capacity, int *intr) {
+  unsigned char raw[FRAME_HEADER_SIZE];
+  int result = read_all(fd, raw, FRAME_HEADER_SIZE, intr);
+  if (result != 1) {
+    return result;
+  }
+
+  decode_frame_header(raw, header);
+  if (header->length > capacity) {
+    fprintf(stderr, "Frame payload too large: %u bytes\n", header->length);
+    return -1;
+  }
+  if (header->length == 0) {
+    return 1;
+  }
+  return read_all(fd, payload, header->length, intr);
+}
+
+int recv_packet(int fd, FrameHeader *header, void *payload, size_t capacity) {
+  char frame[FRAME_MAX_SIZE];
+  ssize_t result;
+  do {
+    result = read(fd, frame, FRAME_MAX_SIZE);
+  } while (result == -1 && errno == EINTR);
+  if (result <= 0) {
+    return (int)result;
+  }
+
+  size_t size = (size_t)result;
+  if (size < FRAME_HEADER_SIZE) {
+    fprintf(stderr, "Truncated frame: %zu bytes\n", size);
+    return -1;
+  }
+  decode_frame_header(frame, header);
+  if (size != FRAME_HEADER_SIZE + (size_t)header->length || header->length > capacity) {
+    fprintf(stderr, "Invalid frame length: %u bytes\n", header->length);
+    return -1;
+  }
+  if (header->length > 0) {
+    memcpy(payload, frame + FRAME_HEADER_SIZE, header->length);
+  }
+  return 1;
+}
 
+void encode_field(char *field, const char *str, size_t size) {
+  size_t len = strnlen(str, size - 1);
+  memcpy(field, str, len);
+  memset(field + len, '\0', size - len);
+}
+
+void decode_field(char *str, const char *field, size_t size) {
+  memcpy(str, field, size);
+  str[size - 1] = '\0';
+}
+
+void encode_connect(char *payload, const char *req_pipe_path, const char *resp_pipe_path,
+                    const char *notif_pipe_path) {
+  encode_field(payload, req_pipe_path, PATH_FIELD_SIZE);
+  encode_field(payload + PATH_FIELD_SIZE, resp_pipe_path, PATH_FIELD_SIZE);
+  encode_field(payload + 2 * PATH_FIELD_SIZE, notif_pipe_path, PATH_FIELD_SIZE);
+}
+
+void decode_connect(const char *payload, char *req_pipe_path, char *resp_pipe_path,
+                    char *notif_pipe_path) {
+  decode_field(req_pipe_path, payload, PATH_FIELD_SIZE);
+  decode_field(resp_pipe_path, payload + PATH_FIELD_SIZE, PATH_FIELD_SIZE);
+  decode_field(notif_pipe_path, payload + 2 * PATH_FIELD_SIZE, PATH_FIELD_SIZE);
+}
+
+void encode_subscribe(char *payload, const char *key, uint8_t flags, uint16_t max_rate) {
+  encode_field(payload, key, KEY_FIELD_SIZE);
+  payload[KEY_FIELD_SIZE] = (char)flags;
+  payload[KEY_FIELD_SIZE + 1] = (char)(max_rate & 0xff);
+  payload[KEY_FIELD_SIZE + 2] = (char)(max_rate >> 8);
+}
+
+void encode_version(char *field, uint64_t version) {
+  for (int i = 0; i < VERSION_FIELD_SIZE; i++) {
+    field[i] = (char)(version >> (8 * i) & 0xff);
+  }
+}
+
+uint64_t decode_version(const char *field) {
+  const unsigned char *bytes = (const unsigned char *)field;
+  uint64_t version = 0;
+  for (int i = 0; i < VERSION_FIELD_SIZE; i++) {
+    version |= (uint64_t)bytes[i] << (8 * i);
+  }
+  return version;
+}
+
+void encode_bitmap(char *bitmap, const int *bits, size_t count) {
+  memset(bitmap, 0, KEY_BITMAP_SIZE(count));
+  for (size_t i = 0; i < count; i++) {
+    if (bits[i]) {
+      bitmap[i / 8] = (char)(bitmap[i / 8] | 1 << (i % 8));
+    }
+  }
+}
+
+void decode_bitmap(const char *bitmap, int *bits, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    bits[i] = (bitmap[i / 8] >> (i % 8) & 1) != 0;
+  }
+}
+
+void decode_subscribe_options(const char *payload, uint8_t *flags, uint16_t *max_rate) {
+  const unsigned char *options = (const unsigned char *)payload + KEY_FIELD_SIZE;
+  *flags = options[0];
+  *max_rate = (uint16_t)(options[1] | options[2] << 8);
+}
+
+void encode_change(char *payload, int deleted, const char *key, const char *value, uint64_t version) {
+  payload[0] = deleted ? CHANGE_DELETE : CHANGE_WRITE;
+  encode_field(payload + 1, key, KEY_FIELD_SIZE);
+  encode_field(payload + 1 + KEY_FIELD_SIZE, value, KEY_FIELD_SIZE);
+  encode_version(payload + 1 + 2 * KEY_FIELD_SIZE, version);
+}
+
+int decode_change(const char *payload, char *key, char *value, uint64_t *version) {
+  decode_field(key, payload + 1, KEY_FIELD_SIZE);
+  decode_field(value, payload + 1 + KEY_FIELD_SIZE, KEY_FIELD_SIZE);
+  *version = decode_version(payload + 1 + 2 * KEY_FIELD_SIZE);
+  return payload[0] == CHANGE_DELETE;
+}
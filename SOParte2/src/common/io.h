@@ -2,6 +2,9 @@
 #define COMMON_IO_H
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include "src/common/protocol.h"
 
 /// Reads a given number of bytes from a file descriptor. Will block until all
 /// bytes are read, or fail if not all bytes could be read.
@@ -24,4 +27,111 @@ int write_all(int fd, const void *buffer, size_t size);
 
 void delay(unsigned int time_ms);
 
+/// Writes the header of a frame whose payload is sent separately.
+/// @param frame Destination, with room for FRAME_HEADER_SIZE bytes.
+/// @param length Size of the payload that follows, at most FRAME_MAX_PAYLOAD.
+void encode_frame_header(char *frame, uint8_t op_code, uint8_t status, uint32_t request_id,
+                         size_t length);
+
+/// Writes a frame (header and payload) into a buffer.
+/// @param frame Destination, with room for FRAME_HEADER_SIZE + length bytes.
+/// @param length Payload size, at most FRAME_MAX_PAYLOAD.
+/// @return Size of the encoded frame.
+size_t encode_frame(char *frame, uint8_t op_code, uint8_t status, uint32_t request_id,
+                    const void *payload, size_t length);
+
+/// Sends a frame (header and payload) with a single write, so that frames
+/// written concurrently to the same pipe never interleave.
+/// @param fd File descriptor to write to.
+/// @param op_code Operation code of the frame.
+/// @param status Result of the operation (0 in requests).
+/// @param request_id Identifier chosen by the client, echoed in the response.
+/// @param payload Payload to send, may be NULL if length is 0.
+/// @param length Payload size, at most FRAME_MAX_PAYLOAD.
+/// @return On success, returns 1, on error, returns -1
+int send_frame(int fd, uint8_t op_code, uint8_t status, uint32_t request_id, const void *payload,
+               size_t length);
+
+/// Decodes the header at the start of a frame.
+/// @param frame Buffer with at least FRAME_HEADER_SIZE bytes.
+/// @param header Where to store the decoded header.
+void decode_frame_header(const void *frame, FrameHeader *header);
+
+/// Receives a frame. Blocks until the whole frame is read.
+/// @param fd File descriptor to read from.
+/// @param header Where to store the decoded header.
+/// @param payload Buffer for the payload.
+/// @param capacity Size of the payload buffer.
+/// @param intr Pointer to a variable that will be set to 1 if the read was interrupted.
+/// @return On success, returns 1, on end of file, returns 0, on error or if
+/// the payload does not fit in the buffer, returns -1
+int recv_frame(int fd, FrameHeader *header, void *payload, size_t capacity, int *intr);
+
+/// Receives a frame from a SOCK_SEQPACKET socket, where each frame is a
+/// single message and must be read with a single read.
+/// @param fd Socket to read from.
+/// @param header Where to store the decoded header.
+/// @param payload Buffer for the payload.
+/// @param capacity Size of the payload buffer.
+/// @return On success, returns 1, on end of file, returns 0, on error or if
+/// the message is not a valid frame, returns -1
+int recv_packet(int fd, FrameHeader *header, void *payload, size_t capacity);
+
+/// Copies a string into a fixed-size, NUL-padded field.
+/// @param field Field to write (size bytes).
+/// @param str String to copy, truncated to size - 1 characters.
+/// @param size Size of the field.
+void encode_field(char *field, const char *str, size_t size);
+
+/// Copies a fixed-size field into a NUL-terminated string.
+/// @param str Destination, with room for size bytes.
+/// @param field Field to read (size bytes).
+/// @param size Size of the field.
+void decode_field(char *str, const char *field, size_t size);
+
+/// Builds the payload of a CONNECT frame.
+/// @param payload Buffer with CONNECT_PAYLOAD_SIZE bytes.
+void encode_connect(char *payload, const char *req_pipe_path, const char *resp_pipe_path,
+                    const char *notif_pipe_path);
+
+/// Parses the payload of a CONNECT frame.
+/// @param payload Buffer with CONNECT_PAYLOAD_SIZE bytes.
+/// Each path buffer must have room for PATH_FIELD_SIZE bytes.
+void decode_connect(const char *payload, char *req_pipe_path, char *resp_pipe_path,
+                    char *notif_pipe_path);
+
+/// Builds the payload of a SUBSCRIBE frame with options.
+/// @param payload Buffer with SUBSCRIBE_OPTIONS_PAYLOAD_SIZE bytes.
+/// @param flags SUBSCRIBE_COALESCE or 0.
+/// @param max_rate Maximum notifications per second, 0 for no limit.
+void encode_subscribe(char *payload, const char *key, uint8_t flags, uint16_t max_rate);
+
+/// Writes a version as a VERSION_FIELD_SIZE little-endian field.
+void encode_version(char *field, uint64_t version);
+
+/// Reads a version written by encode_version.
+uint64_t decode_version(const char *field);
+
+/// Parses the options of a SUBSCRIBE frame with SUBSCRIBE_OPTIONS_PAYLOAD_SIZE
+/// bytes; the key is decoded with decode_field.
+void decode_subscribe_options(const char *payload, uint8_t *flags, uint16_t *max_rate);
+
+/// Packs one bit per key into a KEY_BITMAP_SIZE(count) bitmap.
+/// @param bits Flags to pack, non-zero for a set bit.
+void encode_bitmap(char *bitmap, const int *bits, size_t count);
+
+/// Unpacks a bitmap written by encode_bitmap into 0/1 flags.
+void decode_bitmap(const char *bitmap, int *bits, size_t count);
+
+/// Builds the payload of a CHANGE frame.
+/// @param payload Buffer with CHANGE_PAYLOAD_SIZE bytes.
+/// @param deleted 1 if the key was deleted.
+void encode_change(char *payload, int deleted, const char *key, const char *value, uint64_t version);
+
+/// Parses the payload of a CHANGE frame.
+/// @param key Buffer with KEY_FIELD_SIZE bytes.
+/// @param value Buffer with KEY_FIELD_SIZE bytes.
+/// @return 1 if the key was deleted, 0 if it was written.
+int decode_change(const char *payload, char *key, char *value, uint64_t *version);
+
 #endif  // COMMON_IO_H
@@ -0,0 +1,143 @@
+#include "mpmc.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+int mpmc_init(MpmcQueue *queue, size_t capacity) {
+  size_t size = 2;
+  while (size < capacity) {
+    size <<= 1;
+  }
+
+  queue->cells = malloc(size * sizeof(MpmcCell));
+  if (queue->cells == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < size; i++) {
+    atomic_init(&queue->cells[i].sequence, i);
+    queue->cells[i].item = NULL;
+  }
+  queue->mask = size - 1;
+  atomic_init(&queue->enqueue_pos, 0);
+  atomic_init(&queue->dequeue_pos, 0);
+
+  if (size > SEM_VALUE_MAX || sem_init(&queue->items, 0, 0) != 0 ||
+      sem_init(&queue->slots, 0, (unsigned int)size) != 0) {
+    free(queue->cells);
+    return -1;
+  }
+  return 0;
+}
+
+void mpmc_destroy(MpmcQueue *queue) {
+  sem_destroy(&queue->items);
+  sem_destroy(&queue->slots);
+  free(queue->cells);
+  queue->cells = NULL;
+}
+
+size_t mpmc_capacity(const MpmcQueue *queue) {
+  return queue->mask + 1;
+}
+
+size_t mpmc_size(MpmcQueue *queue) {
+  size_t enqueued = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  size_t dequeued = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+// Claims a position and stores the item. Called only after a slot has been
+// reserved, or to probe for one.
+static int enqueue(MpmcQueue *queue, void *item) {
+  size_t pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+  for (;;) {
+    MpmcCell *cell = &queue->cells[pos & queue->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        cell->item = item;
+        atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+        return 1;
+      }
+      // pos was reloaded by the failed compare-and-swap
+    } else if (diff < 0) {
+      return 0;  // Full: the consumer of the previous lap has not emptied the slot
+    } else {
+      pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+static int dequeue(MpmcQueue *queue, void **item) {
+  size_t pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+  for (;;) {
+    MpmcCell *cell = &queue->cells[pos & queue->mask];
+    size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+                                                memory_order_relaxed, memory_order_relaxed)) {
+        *item = cell->item;
+        // Frees the slot for the producer of the next lap
+        atomic_store_explicit(&cell->sequence, pos + queue->mask + 1, memory_order_release);
+        return 1;
+      }
+    } else if (diff < 0) {
+      return 0;  // Empty
+    } else {
+      pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+    }
+  }
+}
+
+// The semaphores count reserved slots and items, so once one is taken the
+// matching enqueue or dequeue is guaranteed to find its cell; it may only
+// have to wait, yielding the CPU, while another thread finishes publishing it.
+void mpmc_push(MpmcQueue *queue, void *item) {
+  while (sem_wait(&queue->slots) != 0 && errno == EINTR) {
+  }
+  while (!enqueue(queue, item)) {
+    sched_yield();
+  }
+  sem_post(&queue->items);
+}
+
+int mpmc_try_push(MpmcQueue *queue, void *item) {
+  if (sem_trywait(&queue->slots) != 0) {
+    return 0;
+  }
+  while (!enqueue(queue, item)) {
+    sched_yield();
+  }
+  sem_post(&queue->items);
+  return 1;
+}
+
+void *mpmc_pop(MpmcQueue *queue) {
+  void *item;
+  while (sem_wait(&queue->items) != 0 && errno == EINTR) {
+  }
+  while (!dequeue(queue, &item)) {
+    sched_yield();
+  }
+  sem_post(&queue->slots);
+  return item;
+}
+
+int mpmc_try_pop(MpmcQueue *queue, void **item) {
+  if (sem_trywait(&queue->items) != 0) {
+    return 0;
+  }
+  while (!dequeue(queue, item)) {
+    sched_yield();
+  }
+  sem_post(&queue->slots);
+  return 1;
+}
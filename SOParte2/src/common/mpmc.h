@@ -0,0 +1,64 @@
+#ifndef COMMON_MPMC_H
+#define COMMON_MPMC_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <semaphore.h>
+
+#define MPMC_CACHE_LINE 64
+
+// Slot of the queue. `sequence` tells producers and consumers whose turn it
+// is: a producer may fill the slot for position p when sequence == p, and a
+// consumer may empty it when sequence == p + 1.
+typedef struct {
+  _Atomic size_t sequence;
+  void *item;
+} MpmcCell;
+
+// Bounded multi-producer, multi-consumer queue of pointers (Vyukov's
+// algorithm). Pushing and popping never take a lock: each side claims a
+// position with a compare-and-swap on its own counter, kept on separate
+// cache lines. The blocking variants only touch the semaphores, whose post is
+// a plain atomic increment when nobody is waiting.
+typedef struct {
+  MpmcCell *cells;
+  size_t mask;  // capacity - 1, the capacity being a power of two
+  _Alignas(MPMC_CACHE_LINE) _Atomic size_t enqueue_pos;
+  _Alignas(MPMC_CACHE_LINE) _Atomic size_t dequeue_pos;
+  _Alignas(MPMC_CACHE_LINE) sem_t items;  // Items ready to be popped
+  sem_t slots;                            // Free slots
+} MpmcQueue;
+
+/// Initialises an empty queue.
+/// @param queue Queue to initialise.
+/// @param capacity Maximum number of items, rounded up to a power of two.
+/// @return 0 on success, -1 on error.
+int mpmc_init(MpmcQueue *queue, size_t capacity);
+
+/// Frees the memory of a queue. Items still in it are not freed.
+void mpmc_destroy(MpmcQueue *queue);
+
+/// @return Capacity of the queue.
+size_t mpmc_capacity(const MpmcQueue *queue);
+
+/// @return Approximate number of items in the queue.
+size_t mpmc_size(MpmcQueue *queue);
+
+/// Adds an item, waiting while the queue is full.
+/// @param item Pointer to store; ownership passes to the consumer.
+void mpmc_push(MpmcQueue *queue, void *item);
+
+/// Adds an item if there is room.
+/// @return 1 if the item was added, 0 if the queue was full.
+int mpmc_try_push(MpmcQueue *queue, void *item);
+
+/// Removes the oldest item, waiting while the queue is empty.
+/// @return The item.
+void *mpmc_pop(MpmcQueue *queue);
+
+/// Removes the oldest item if there is one.
+/// @param item Where to store the item.
+/// @return 1 if an item was removed, 0 if the queue was empty.
+int mpmc_try_pop(MpmcQueue *queue, void **item);
+
+#endif  // COMMON_MPMC_H
@@ -1,15 +1,133 @@
 #ifndef COMMON_PROTOCOL_H
 #define COMMON_PROTOCOL_H
 
+#include <stdint.h>
+
+#include "src/common/constants.h"
+
 // Opcodes for client-server communication
 // estes opcodes sao usados num switch case para determinar o que fazer com a mensagem recebida no server
 // usam estes opcodes tambem nos clientes quando enviam mensagens para o server
 enum {
-  OP_CODE_CONNECT = '1',
-  OP_CODE_DISCONNECT = '2',
-  OP_CODE_SUBSCRIBE = '3',
-  OP_CODE_UNSUBSCRIBE = '4',
-  // TODO mais opcodes para cada operacao
+  OP_CODE_CONNECT = 1,
+  OP_CODE_DISCONNECT = 2,
+  OP_CODE_SUBSCRIBE = 3,
+  OP_CODE_UNSUBSCRIBE = 4,
+  OP_CODE_NOTIFICATION = 5,  // server -> client, on the notification pipe
+  OP_CODE_READ = 6,
+  OP_CODE_WRITE = 7,
+  OP_CODE_DELETE = 8,
+  OP_CODE_ATTACH_SHM = 9,
+  OP_CODE_CDC = 10,     // consumer -> server, on the change-data-capture socket
+  OP_CODE_CHANGE = 11,  // server -> consumer, one per change
+  OP_CODE_SUBSCRIBE_KEYS = 12,
+  OP_CODE_UNSUBSCRIBE_KEYS = 13,
 };
 
-#endif  // COMMON_PROTOCOL_H
\ No newline at end of file
+// Every message on the register FIFO and on the session pipes is a frame:
+// a fixed header followed by `length` bytes of payload.
+//
+//   op_code (1 byte) | status (1 byte) | length (2 bytes) | request_id (4 bytes) | payload
+//
+// Integers are little-endian. `status` is 0 in requests; in responses it is 0
+// on success and non-zero otherwise. `request_id` is chosen by the client and
+// copied into the response, so a client can keep several requests in flight
+// on one session; the server executes them in the order they were sent. It
+// is 0 in CONNECT and NOTIFICATION frames.
+//
+// A frame is always sent with a single write of at most FRAME_MAX_SIZE bytes,
+// which POSIX guarantees to be atomic on a pipe, so frames from concurrent
+// writers never interleave.
+//
+// Sessions may also use an AF_UNIX SOCK_SEQPACKET socket instead of the
+// register FIFO and the three session pipes. The client sends a CONNECT frame
+// with no payload right after connecting, and requests, responses and
+// notifications then share the socket. Each request is one message; a
+// message from the server may carry several response frames back to back.
+#define FRAME_HEADER_SIZE 8
+#define FRAME_MAX_SIZE 4096  // PIPE_BUF on Linux
+#define FRAME_MAX_PAYLOAD (FRAME_MAX_SIZE - FRAME_HEADER_SIZE)
+
+// Fixed-size, NUL-padded fields used inside payloads
+#define KEY_FIELD_SIZE (MAX_STRING_SIZE + 1)
+#define PATH_FIELD_SIZE MAX_PIPE_PATH_LENGTH
+#define VERSION_FIELD_SIZE 8
+
+// CONNECT: request pipe path | response pipe path | notification pipe path
+#define CONNECT_PAYLOAD_SIZE (3 * PATH_FIELD_SIZE)
+// SUBSCRIBE / UNSUBSCRIBE: key
+#define KEY_PAYLOAD_SIZE KEY_FIELD_SIZE
+// SUBSCRIBE may also carry options: key | flags (1 byte) | max rate (2 bytes)
+// With SUBSCRIBE_COALESCE, notifications for the key still waiting to be sent
+// collapse to the latest value. A non-zero max rate delivers at most that many
+// notifications per second for the key; values written in between collapse to
+// the latest one, which is sent when the interval ends.
+#define SUBSCRIBE_OPTIONS_PAYLOAD_SIZE (KEY_FIELD_SIZE + 3)
+#define SUBSCRIBE_COALESCE 0x01
+// With SUBSCRIBE_PATTERN the key is a pattern (fnmatch rules: *, ? and [...])
+// and every key it matches is subscribed, whether it exists yet or not.
+// Pattern subscriptions take no other option and survive deleting the keys;
+// UNSUBSCRIBE with the same text removes them.
+#define SUBSCRIBE_PATTERN 0x02
+// With SUBSCRIBE_RESUME the options are followed by a version (8 bytes LE):
+// the changes to the key after that version still kept by the server are
+// sent as notifications before any later one. Status 2 means the key was
+// subscribed but those changes are no longer kept.
+#define SUBSCRIBE_RESUME 0x04
+#define SUBSCRIBE_RESUME_PAYLOAD_SIZE (SUBSCRIBE_OPTIONS_PAYLOAD_SIZE + VERSION_FIELD_SIZE)
+// SUBSCRIBE response: value | version of the key when it was subscribed,
+// zeroed for patterns and failures
+#define SUBSCRIBE_RESPONSE_SIZE (KEY_FIELD_SIZE + VERSION_FIELD_SIZE)
+// NOTIFICATION: key | value | version. Versions increase with every change
+// to any key, also across server restarts, so a notification with a version
+// not above the last one seen for its key is a repeat and can be ignored.
+// Status NOTIFICATION_LOST means the server dropped notifications of the
+// session (its queue was full) since the previous one it sent.
+#define NOTIFICATION_PAYLOAD_SIZE (2 * KEY_FIELD_SIZE + VERSION_FIELD_SIZE)
+#define NOTIFICATION_LOST 1
+
+// READ / DELETE: n keys; WRITE: n (key | value) pairs
+// READ response: n (found (1 byte) | value) entries
+// WRITE response: n versions, the version of each change (0 if not written)
+// DELETE response: n (result (1 byte, 0 deleted, 1 missing) | version) entries
+// The response status is 0 only if the operation succeeded for every key.
+#define PAIR_FIELD_SIZE (2 * KEY_FIELD_SIZE)
+#define READ_ENTRY_SIZE (1 + KEY_FIELD_SIZE)
+#define DELETE_ENTRY_SIZE (1 + VERSION_FIELD_SIZE)
+#define MAX_REQUEST_KEYS (FRAME_MAX_PAYLOAD / PAIR_FIELD_SIZE)
+
+// SUBSCRIBE_KEYS / UNSUBSCRIBE_KEYS: n keys, as in READ. Subscribes or
+// unsubscribes every key in one pass, without options or values. The
+// response is a bitmap with a bit per key, set if the key was subscribed
+// (unsubscribed): key i is bit i % 8 of byte i / 8. The status is 0 only if
+// every bit is set.
+#define KEY_BITMAP_SIZE(n) (((n) + 7) / 8)
+
+// ATTACH_SHM: empty request; the response carries the name of a shared
+// memory segment (PATH_FIELD_SIZE) with a request ring and a response ring
+// (see src/common/shm.h). From then on requests and responses use the rings
+// and only notifications keep using the notification pipe or the socket.
+// A non-zero status means the server does not offer shared memory.
+
+// Change-data-capture (CDC): a consumer connects to the server's CDC socket
+// (SOCK_STREAM) and sends a CDC frame with the version it has seen up to, or
+// 0 to start with the next change. The response carries the same field with
+// the version the stream starts after; status 1 means the server no longer
+// keeps every change after it, and the socket is closed. Then every write and
+// delete follows as a CHANGE frame, in version order, with nothing in
+// between. A consumer that falls behind the changes the server keeps gets a
+// CDC frame with status 1 and is disconnected.
+#define CDC_PAYLOAD_SIZE VERSION_FIELD_SIZE
+// CHANGE: type ('W' write, 'D' delete) | key | value | version
+#define CHANGE_PAYLOAD_SIZE (1 + 2 * KEY_FIELD_SIZE + VERSION_FIELD_SIZE)
+#define CHANGE_WRITE 'W'
+#define CHANGE_DELETE 'D'
+
+typedef struct {
+  uint8_t op_code;
+  uint8_t status;
+  uint16_t length;
+  uint32_t request_id;
+} FrameHeader;
+
+#endif  // COMMON_PROTOCOL_H
@@ -0,0 +1,248 @@
+#include "shm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "src/common/io.h"
+
+static int ring_init(ShmRing *ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->closed, 0);
+  atomic_init(&ring->reader_waiting, 0);
+  atomic_init(&ring->writer_waiting, 0);
+  atomic_init(&ring->reader_pid, 0);
+  atomic_init(&ring->writer_pid, 0);
+  atomic_init(&ring->woken, 0);
+  if (sem_init(&ring->readable, 1, 0) != 0 || sem_init(&ring->writable, 1, 0) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+ShmSegment *shm_segment_create(const char *name) {
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd == -1) {
+    perror("shm_open failed");
+    return NULL;
+  }
+  if (ftruncate(fd, sizeof(ShmSegment)) != 0) {
+    perror("ftruncate failed");
+    close(fd);
+    shm_unlink(name);
+    return NULL;
+  }
+
+  ShmSegment *segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    perror("mmap failed");
+    shm_unlink(name);
+    return NULL;
+  }
+
+  if (ring_init(&segment->requests) != 0 || ring_init(&segment->responses) != 0) {
+    perror("sem_init failed");
+    munmap(segment, sizeof(ShmSegment));
+    shm_unlink(name);
+    return NULL;
+  }
+  return segment;
+}
+
+ShmSegment *shm_segment_attach(const char *name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  if (fd == -1) {
+    perror("shm_open failed");
+    return NULL;
+  }
+  shm_unlink(name);
+
+  ShmSegment *segment = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (segment == MAP_FAILED) {
+    perror("mmap failed");
+    return NULL;
+  }
+  return segment;
+}
+
+void shm_segment_detach(ShmSegment *segment) {
+  munmap(segment, sizeof(ShmSegment));
+}
+
+// A peer that has not attached yet gets SHM_ATTACH_TIMEOUT_MS to do so
+static int peer_alive(pid_t pid, unsigned int waited_ms) {
+  if (pid == 0) {
+    return waited_ms < SHM_ATTACH_TIMEOUT_MS;
+  }
+  return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+// Polling only helps when the peer runs on another CPU at the same time
+static int spin_count(void) {
+  static _Atomic int count = -1;
+  int value = atomic_load(&count);
+  if (value == -1) {
+    value = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_COUNT : 0;
+    atomic_store(&count, value);
+  }
+  return value;
+}
+
+// Waits until ready(ring) holds. Polls first and then sleeps on sem with
+// *waiting set, checking every SHM_WAIT_MS that the peer is still alive.
+// @return 1 when ready, 0 if the ring was closed, -1 if the peer died.
+static int ring_wait(ShmRing *ring, int (*ready)(ShmRing *, size_t), size_t size, sem_t *sem,
+                     _Atomic int *waiting, _Atomic pid_t *peer) {
+  int spins = spin_count();
+  for (int i = 0; i < spins; i++) {
+    if (ready(ring, size)) {
+      return 1;
+    }
+    if (atomic_load(&ring->closed)) {
+      return 0;
+    }
+  }
+
+  unsigned int waited_ms = 0;
+  for (;;) {
+    atomic_store(waiting, 1);
+    // Checked again after announcing the wait, so a post cannot be missed
+    if (ready(ring, size)) {
+      atomic_store(waiting, 0);
+      return 1;
+    }
+    if (atomic_load(&ring->closed)) {
+      atomic_store(waiting, 0);
+      return 0;
+    }
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += SHM_WAIT_MS * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+    if (sem_timedwait(sem, &deadline) != 0 && errno == ETIMEDOUT) {
+      waited_ms += SHM_WAIT_MS;
+      if (!peer_alive(atomic_load(peer), waited_ms)) {
+        atomic_store(waiting, 0);
+        return -1;
+      }
+    }
+  }
+}
+
+static int has_bytes(ShmRing *ring, size_t size) {
+  return atomic_load(&ring->tail) - atomic_load(&ring->head) >= size;
+}
+
+static int has_space(ShmRing *ring, size_t size) {
+  return SHM_RING_SIZE - (atomic_load(&ring->tail) - atomic_load(&ring->head)) >= size;
+}
+
+int shm_ring_write(ShmRing *ring, const void *buffer, size_t size) {
+  const char *bytes = buffer;
+  while (size > 0) {
+    size_t chunk = size < SHM_RING_SIZE ? size : SHM_RING_SIZE;
+    if (ring_wait(ring, has_space, chunk, &ring->writable, &ring->writer_waiting, &ring->reader_pid) != 1) {
+      return -1;
+    }
+
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t offset = tail % SHM_RING_SIZE;
+    size_t first = chunk < SHM_RING_SIZE - offset ? chunk : SHM_RING_SIZE - offset;
+    memcpy(ring->data + offset, bytes, first);
+    memcpy(ring->data, bytes + first, chunk - first);
+    atomic_store(&ring->tail, tail + (uint32_t)chunk);
+
+    if (atomic_exchange(&ring->reader_waiting, 0)) {
+      sem_post(&ring->readable);
+    }
+    bytes += chunk;
+    size -= chunk;
+  }
+  return 1;
+}
+
+int shm_ring_read(ShmRing *ring, void *buffer, size_t size) {
+  char *bytes = buffer;
+  while (size > 0) {
+    size_t chunk = size < SHM_RING_SIZE ? size : SHM_RING_SIZE;
+    int result = ring_wait(ring, has_bytes, chunk, &ring->readable, &ring->reader_waiting, &ring->writer_pid);
+    if (result != 1) {
+      return result;
+    }
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t offset = head % SHM_RING_SIZE;
+    size_t first = chunk < SHM_RING_SIZE - offset ? chunk : SHM_RING_SIZE - offset;
+    memcpy(bytes, ring->data + offset, first);
+    memcpy(bytes + first, ring->data, chunk - first);
+    atomic_store(&ring->head, head + (uint32_t)chunk);
+
+    if (atomic_exchange(&ring->writer_waiting, 0)) {
+      sem_post(&ring->writable);
+    }
+    bytes += chunk;
+    size -= chunk;
+  }
+  return 1;
+}
+
+int shm_ring_recv_frame(ShmRing *ring, FrameHeader *header, void *payload, size_t capacity) {
+  char raw[FRAME_HEADER_SIZE];
+  int result = shm_ring_read(ring, raw, FRAME_HEADER_SIZE);
+  if (result != 1) {
+    return result;
+  }
+
+  decode_frame_header(raw, header);
+  if (header->length > capacity) {
+    fprintf(stderr, "Frame payload too large: %u bytes\n", header->length);
+    return -1;
+  }
+  if (header->length == 0) {
+    return 1;
+  }
+  return shm_ring_read(ring, payload, header->length);
+}
+
+// A whole frame is visible once its header is, as frames fit in the ring
+static int has_header_or_woken(ShmRing *ring, size_t size) {
+  return has_bytes(ring, size) || atomic_load(&ring->woken);
+}
+
+int shm_ring_wait_frame(ShmRing *ring) {
+  int result = ring_wait(ring, has_header_or_woken, FRAME_HEADER_SIZE, &ring->readable, &ring->reader_waiting,
+                         &ring->writer_pid);
+  if (result == 1 && atomic_exchange(&ring->woken, 0)) {
+    return 2;
+  }
+  return result;
+}
+
+void shm_ring_wake(ShmRing *ring) {
+  atomic_store(&ring->woken, 1);
+  if (atomic_exchange(&ring->reader_waiting, 0)) {
+    sem_post(&ring->readable);
+  }
+}
+
+int shm_ring_has_data(ShmRing *ring) {
+  return has_bytes(ring, 1);
+}
+
+void shm_ring_close(ShmRing *ring) {
+  atomic_store(&ring->closed, 1);
+  sem_post(&ring->readable);
+  sem_post(&ring->writable);
+}
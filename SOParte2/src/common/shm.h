@@ -0,0 +1,87 @@
+#ifndef COMMON_SHM_H
+#define COMMON_SHM_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <semaphore.h>
+#include <sys/types.h>
+
+#include "src/common/protocol.h"
+
+#define SHM_RING_SIZE (64 * 1024)  // Bytes per ring, a power of two
+#define SHM_SPIN_COUNT 2000        // Polls before sleeping, on multi-CPU hosts
+#define SHM_WAIT_MS 100            // Sleep between checks that the peer is alive
+#define SHM_ATTACH_TIMEOUT_MS 2000 // Time the peer has to map the segment
+
+// Single-producer, single-consumer byte ring in shared memory. Frames are
+// copied in and out with the same encoding as on the pipes. Each side polls
+// for a while before sleeping on a process-shared semaphore, and the other
+// side only posts it when someone is asleep, so a busy session makes no
+// system calls at all.
+typedef struct {
+  _Atomic uint32_t head;           // Read position, only moved by the consumer
+  _Atomic uint32_t tail;           // Write position, only moved by the producer
+  _Atomic int closed;              // Set by either side to end the session
+  _Atomic int reader_waiting;      // The consumer is asleep on `readable`
+  _Atomic int writer_waiting;      // The producer is asleep on `writable`
+  _Atomic pid_t reader_pid;        // 0 until the consumer has attached
+  _Atomic pid_t writer_pid;        // 0 until the producer has attached
+  _Atomic int woken;               // Set by shm_ring_wake, in the consumer's process
+  sem_t readable;
+  sem_t writable;
+  char data[SHM_RING_SIZE];
+} ShmRing;
+
+// Shared segment of a session: requests flow client -> server, responses
+// server -> client. Notifications stay on the notification pipe, since many
+// server threads may write them.
+typedef struct {
+  ShmRing requests;
+  ShmRing responses;
+} ShmSegment;
+
+/// Creates and maps a new segment, initialising both rings.
+/// @param name Name for shm_open, starting with '/'.
+/// @return The mapped segment, or NULL on error.
+ShmSegment *shm_segment_create(const char *name);
+
+/// Maps an existing segment and removes its name, so nothing is left behind
+/// once both sides unmap it.
+/// @param name Name given to shm_segment_create.
+/// @return The mapped segment, or NULL on error.
+ShmSegment *shm_segment_attach(const char *name);
+
+/// Unmaps a segment.
+void shm_segment_detach(ShmSegment *segment);
+
+/// Writes bytes into the ring, waiting for space if it is full. The bytes only
+/// become visible to the consumer once they have all been copied, as long as
+/// they fit in the ring.
+/// @return 1 on success, -1 if the ring was closed or the consumer died.
+int shm_ring_write(ShmRing *ring, const void *buffer, size_t size);
+
+/// Reads exactly size bytes from the ring, waiting for them.
+/// @return 1 on success, 0 if the ring was closed, -1 if the producer died.
+int shm_ring_read(ShmRing *ring, void *buffer, size_t size);
+
+/// Reads a frame written with shm_ring_write.
+/// @return Same as recv_frame.
+int shm_ring_recv_frame(ShmRing *ring, FrameHeader *header, void *payload, size_t capacity);
+
+/// Waits until a frame can be read or the consumer is woken with
+/// shm_ring_wake, whichever comes first.
+/// @return 1 if a frame is waiting, 2 if woken, 0 if the ring was closed, -1
+/// if the producer died.
+int shm_ring_wait_frame(ShmRing *ring);
+
+/// Wakes a consumer waiting in shm_ring_wait_frame, e.g. from another thread
+/// of its own process.
+void shm_ring_wake(ShmRing *ring);
+
+/// @return 1 if there are bytes waiting to be read, 0 otherwise.
+int shm_ring_has_data(ShmRing *ring);
+
+/// Closes the ring and wakes both sides.
+void shm_ring_close(ShmRing *ring);
+
+#endif  // COMMON_SHM_H
@@ -0,0 +1,355 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "cdc.h"
+#include "changelog.h"
+#include "operations.h"
+#include "src/common/io.h"
+#include "src/common/protocol.h"
+
+#define CDC_FRAME_SIZE (FRAME_HEADER_SIZE + CHANGE_PAYLOAD_SIZE)
+#define CDC_START_SIZE (FRAME_HEADER_SIZE + CDC_PAYLOAD_SIZE)
+
+// Consumidor ligado ao socket do CDC
+typedef struct {
+    int fd;           // -1 se a posição estiver livre
+    int started;      // 1 depois de receber a trama CDC e responder
+    uint64_t cursor;  // Última versão já posta no buffer de saída
+    char in[CDC_START_SIZE];
+    size_t in_len;
+    char out[CDC_BATCH * CDC_FRAME_SIZE + CDC_START_SIZE];  // Com espaço para a trama CDC final
+    size_t out_len;   // Bytes no buffer de saída
+    size_t out_sent;  // Bytes do buffer já enviados
+    int waiting_out;  // 1 se o epoll vigia EPOLLOUT
+    int closing;      // 1 se fecha assim que o buffer de saída for enviado
+} Consumer;
+
+static Consumer consumers[CDC_MAX_CONSUMERS];
+static int listen_fd = -1;
+static int wake_fd = -1;
+static int epoll_fd = -1;
+static int block_writers = 0;
+
+// Só se acorda a thread quando há consumidores, e uma vez por cada ronda
+static atomic_int consumer_count = 0;
+static atomic_int wake_pending = 0;
+
+static atomic_ulong cdc_sent = 0;
+static atomic_ulong cdc_dropped = 0;
+static atomic_ulong cdc_gaps = 0;
+
+void cdc_mutation(const char *key, const char *value, uint64_t version, int deleted) {
+    (void)key;
+    (void)value;
+    (void)version;
+    (void)deleted;
+    if (atomic_load(&consumer_count) == 0 || atomic_exchange(&wake_pending, 1)) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        perror("Failed to wake CDC thread");
+    }
+}
+
+static void consumer_close(Consumer *consumer) {
+    close(consumer->fd);  // Sai também do epoll
+    consumer->fd = -1;
+    atomic_fetch_sub(&consumer_count, 1);
+}
+
+static int consumer_watch(Consumer *consumer, uint32_t events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = consumer;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, consumer->fd, &event);
+}
+
+// Envia o que houver no buffer de saída. Se o socket encher, o epoll avisa
+// quando houver espaço; entretanto o consumidor não lê mais do registo.
+// @return 0 se o consumidor continua ligado, -1 se saiu.
+static int consumer_flush(Consumer *consumer) {
+    while (consumer->out_sent < consumer->out_len) {
+        ssize_t sent = send(consumer->fd, consumer->out + consumer->out_sent,
+                            consumer->out_len - consumer->out_sent, MSG_DONTWAIT);
+        if (sent == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                consumer_close(consumer);
+                return -1;
+            }
+            if (!consumer->waiting_out && consumer_watch(consumer, EPOLLIN | EPOLLOUT) == 0) {
+                consumer->waiting_out = 1;
+            }
+            return 0;
+        }
+        consumer->out_sent += (size_t)sent;
+    }
+    consumer->out_len = 0;
+    consumer->out_sent = 0;
+    if (consumer->closing) {
+        consumer_close(consumer);
+        return -1;
+    }
+    if (consumer->waiting_out && consumer_watch(consumer, EPOLLIN) == 0) {
+        consumer->waiting_out = 0;
+    }
+    return 0;
+}
+
+// Desliga um consumidor que perdeu alterações, avisando-o com uma trama CDC
+// com estado 1. O aviso vai no espaço reservado no fim do buffer de saída,
+// depois do que ainda houver por enviar, e o socket só fecha quando tudo
+// tiver sido enviado.
+static void consumer_drop(Consumer *consumer) {
+    char version[CDC_PAYLOAD_SIZE];
+    encode_version(version, consumer->cursor);
+    consumer->out_len += encode_frame(consumer->out + consumer->out_len, OP_CODE_CDC, 1, 0, version,
+                                      CDC_PAYLOAD_SIZE);
+    consumer->closing = 1;
+    atomic_fetch_add(&cdc_dropped, 1);
+    consumer_flush(consumer);
+}
+
+// Lê do registo e envia tudo o que o consumidor ainda não recebeu, até o
+// socket encher.
+static void consumer_pump(Consumer *consumer) {
+    Change changes[CDC_BATCH];
+    while (consumer->fd != -1 && consumer->out_len == 0) {
+        long count = changelog_read(consumer->cursor, changes, CDC_BATCH);
+        if (count == -1) {
+            atomic_fetch_add(&cdc_gaps, 1);
+            consumer_drop(consumer);
+            return;
+        }
+        if (count == 0) {
+            return;
+        }
+        for (long i = 0; i < count; i++) {
+            char payload[CHANGE_PAYLOAD_SIZE];
+            encode_change(payload, changes[i].deleted, changes[i].key, changes[i].value, changes[i].version);
+            consumer->out_len += encode_frame(consumer->out + consumer->out_len, OP_CODE_CHANGE, 0, 0, payload,
+                                              CHANGE_PAYLOAD_SIZE);
+        }
+        consumer->cursor = changes[count - 1].version;
+        atomic_fetch_add(&cdc_sent, (unsigned long)count);
+        consumer_flush(consumer);
+    }
+}
+
+// Trata a trama CDC com que o consumidor escolhe a posição inicial
+static void consumer_start(Consumer *consumer) {
+    FrameHeader header;
+    decode_frame_header(consumer->in, &header);
+    if (header.op_code != OP_CODE_CDC || header.length != CDC_PAYLOAD_SIZE) {
+        fprintf(stderr, "Invalid CDC request\n");
+        consumer_close(consumer);
+        return;
+    }
+
+    uint64_t since = decode_version(consumer->in + FRAME_HEADER_SIZE);
+    if (since == 0) {
+        since = changelog_last();
+    }
+    uint8_t status = changelog_covers(since) ? 0 : 1;
+    char version[CDC_PAYLOAD_SIZE];
+    encode_version(version, since);
+    consumer->out_len = encode_frame(consumer->out, OP_CODE_CDC, status, header.request_id, version,
+                                     CDC_PAYLOAD_SIZE);
+    consumer->out_sent = 0;
+    consumer->cursor = since;
+    consumer->started = 1;
+    if (status != 0) {
+        // Fecha depois de enviar a resposta
+        atomic_fetch_add(&cdc_gaps, 1);
+        consumer->closing = 1;
+    }
+    consumer_flush(consumer);
+}
+
+// Lê a trama inicial, ou deteta que o consumidor fechou o socket. Depois
+// do início o consumidor não envia mais nada.
+static void consumer_readable(Consumer *consumer) {
+    char buffer[CDC_START_SIZE];
+    char *dest = consumer->started ? buffer : consumer->in + consumer->in_len;
+    size_t room = consumer->started ? sizeof(buffer) : CDC_START_SIZE - consumer->in_len;
+    ssize_t received = recv(consumer->fd, dest, room, MSG_DONTWAIT);
+    if (received == 0 || (received == -1 && errno != EAGAIN && errno != EINTR)) {
+        consumer_close(consumer);
+        return;
+    }
+    if (received <= 0 || consumer->started) {
+        return;
+    }
+    consumer->in_len += (size_t)received;
+    if (consumer->in_len == CDC_START_SIZE) {
+        consumer_start(consumer);
+    }
+}
+
+static void accept_consumer(void) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+        return;
+    }
+
+    Consumer *consumer = NULL;
+    for (int i = 0; i < CDC_MAX_CONSUMERS; i++) {
+        if (consumers[i].fd == -1) {
+            consumer = &consumers[i];
+            break;
+        }
+    }
+    if (consumer == NULL) {
+        fprintf(stderr, "Too many CDC consumers\n");
+        close(fd);
+        return;
+    }
+
+    memset(consumer, 0, sizeof(*consumer));
+    consumer->fd = fd;
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = consumer;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        perror("Failed to register CDC consumer");
+        close(fd);
+        consumer->fd = -1;
+        return;
+    }
+    atomic_fetch_add(&consumer_count, 1);
+}
+
+// Com -b, o registo guarda as alterações que o consumidor mais atrasado
+// ainda não leu
+static void retain_slowest(void) {
+    uint64_t oldest = 0;
+    for (int i = 0; i < CDC_MAX_CONSUMERS; i++) {
+        if (consumers[i].fd != -1 && consumers[i].started && !consumers[i].closing &&
+            (oldest == 0 || consumers[i].cursor + 1 < oldest)) {
+            oldest = consumers[i].cursor + 1;
+        }
+    }
+    changelog_retain(oldest);
+}
+
+static void *thread_cdc(void *arg) {
+    (void)arg;
+    struct epoll_event events[CDC_MAX_CONSUMERS + 2];
+
+    for (;;) {
+        int ready = epoll_wait(epoll_fd, events, CDC_MAX_CONSUMERS + 2, -1);
+        if (ready == -1) {
+            if (errno != EINTR) {
+                perror("epoll_wait failed");
+            }
+            continue;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            void *source = events[i].data.ptr;
+            if (source == &listen_fd) {
+                accept_consumer();
+            } else if (source == &wake_fd) {
+                // Limpo antes de ler o registo: uma alteração posterior volta a acordar
+                uint64_t count;
+                atomic_store(&wake_pending, 0);
+                if (read(wake_fd, &count, sizeof(count)) == -1 && errno != EAGAIN) {
+                    perror("Failed to read CDC wakeup");
+                }
+            } else {
+                Consumer *consumer = source;
+                if (consumer->fd != -1 && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+                    consumer_readable(consumer);
+                }
+                if (consumer->fd != -1 && (events[i].events & EPOLLOUT)) {
+                    consumer_flush(consumer);
+                }
+            }
+        }
+
+        for (int i = 0; i < CDC_MAX_CONSUMERS; i++) {
+            if (consumers[i].fd != -1 && consumers[i].started) {
+                consumer_pump(&consumers[i]);
+            }
+        }
+        if (block_writers) {
+            retain_slowest();
+        }
+    }
+    return NULL;
+}
+
+int cdc_init(const char *socket_path, int block) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", socket_path);
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+    if (unlink(socket_path) != 0 && errno != ENOENT) {
+        perror("Failed to remove CDC socket");
+        return 1;
+    }
+
+    for (int i = 0; i < CDC_MAX_CONSUMERS; i++) {
+        consumers[i].fd = -1;
+    }
+    block_writers = block;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        perror("Failed to create CDC socket");
+        return 1;
+    }
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    epoll_fd = epoll_create1(0);
+    if (wake_fd == -1 || epoll_fd == -1) {
+        perror("Failed to create CDC reactor");
+        return 1;
+    }
+
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.ptr = &listen_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &event) != 0) {
+        perror("Failed to watch CDC socket");
+        return 1;
+    }
+    event.data.ptr = &wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) != 0) {
+        perror("Failed to watch CDC wakeups");
+        return 1;
+    }
+
+    if (kvs_add_mutation_hook(cdc_mutation) != 0) {
+        return 1;
+    }
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, thread_cdc, NULL) != 0) {
+        return 1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void cdc_report(FILE *out) {
+    unsigned long waits;
+    unsigned long timeouts;
+    changelog_stats(&waits, &timeouts);
+    fprintf(out, "cdc: consumers=%d sent=%lu dropped=%lu gaps=%lu block=%d writer_waits=%lu writer_timeouts=%lu\n",
+            atomic_load(&consumer_count), atomic_load(&cdc_sent), atomic_load(&cdc_dropped),
+            atomic_load(&cdc_gaps), block_writers, waits, timeouts);
+}
@@ -0,0 +1,25 @@
+#ifndef KVS_CDC_H
+#define KVS_CDC_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/// Abre o socket Unix do CDC e arranca a thread que o serve. Cada consumidor
+/// recebe, por ordem de versão, todas as escritas e remoções do KVS a partir
+/// da posição que pede (ver OP_CODE_CDC em protocol.h). O registo de
+/// alterações é o buffer partilhado por todos os consumidores: um consumidor
+/// que deixe de estar coberto por ele é desligado.
+/// @param socket_path Caminho do socket.
+/// @param block 1 para as escritas esperarem pelos consumidores em vez de os
+/// desligar, até CDC_BLOCK_TIMEOUT_MS por escrita.
+/// @return 0 em caso de sucesso, 1 caso contrário.
+int cdc_init(const char *socket_path, int block);
+
+/// Avisa a thread do CDC de uma alteração. Registada com
+/// kvs_add_mutation_hook; a ordem vem do registo, não das chamadas.
+void cdc_mutation(const char *key, const char *value, uint64_t version, int deleted);
+
+/// Escreve as métricas do CDC.
+void cdc_report(FILE *out);
+
+#endif  // KVS_CDC_H
@@ -0,0 +1,216 @@
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "changelog.h"
+#include "kvs.h"
+
+// Posição do anel. Quem lê sem lock copia a alteração e confirma depois
+// que owner não mudou entretanto.
+typedef struct {
+    _Atomic uint64_t owner;  // Versão que ocupa a posição, já escrita ou a meio, 0 se nenhuma
+    _Atomic uint64_t seq;    // Versão já escrita por inteiro, 0 se nenhuma
+    uint64_t prev;  // Alteração anterior no mesmo balde do índice, 0 se não houver
+    Change change;
+} Slot;
+
+// Anel com as últimas alterações: a de versão v está na posição
+// v % CHANGELOG_SIZE enquanto não for substituída. As escritas não têm lock
+// comum: cada uma reserva a sua versão e escreve a sua posição.
+static Slot changes_ring[CHANGELOG_SIZE];
+static uint64_t start_version = 0;
+static _Atomic uint64_t last_version = 0;  // Última versão reservada, talvez ainda por escrever
+
+// Índice das alterações por chave: cada balde guarda a última alteração das
+// suas chaves, e cada alteração a anterior do mesmo balde. Os baldes de um
+// índice da tabela só mudam com o lock de escrita desse índice, que
+// changelog_append exige, por isso cada lista segue a ordem das versões.
+static uint64_t index_last[TABLE_SIZE * CHANGELOG_INDEX_BUCKETS];
+
+// Alterações que o CDC ainda não leu e as escritas que esperam por elas
+static pthread_mutex_t retained_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint64_t retained = 0;
+static pthread_cond_t retained_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long retain_waits = 0;
+static unsigned long retain_timeouts = 0;
+
+void changelog_init(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    start_version = ((uint64_t)now.tv_sec << 32) + ((uint64_t)now.tv_nsec << 32) / 1000000000u;
+    atomic_store(&last_version, start_version);
+}
+
+// Balde do índice de uma chave, dentro do seu índice da tabela
+static size_t index_bucket(const char *key) {
+    int table_index = hash(key);
+    uint32_t fnv = 2166136261u; // FNV-1a
+    for (const char *c = key; *c != '\0'; c++) {
+        fnv = (fnv ^ (uint8_t)*c) * 16777619u;
+    }
+    return (size_t)(table_index < 0 ? 0 : table_index) * CHANGELOG_INDEX_BUCKETS + fnv % CHANGELOG_INDEX_BUCKETS;
+}
+
+// Espera que a alteração que a versão vai substituir seja lida
+static void wait_retained(uint64_t version) {
+    uint64_t oldest = atomic_load(&retained);
+    if (oldest == 0 || version - oldest < CHANGELOG_SIZE) {
+        return;
+    }
+
+    pthread_mutex_lock(&retained_mutex);
+    retain_waits++;
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += CDC_BLOCK_TIMEOUT_MS / 1000;
+    deadline.tv_nsec += (CDC_BLOCK_TIMEOUT_MS % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while ((oldest = atomic_load(&retained)) != 0 && version - oldest >= CHANGELOG_SIZE) {
+        if (pthread_cond_timedwait(&retained_cond, &retained_mutex, &deadline) == ETIMEDOUT) {
+            // O leitor não acompanha: perde a posição e as escritas seguem
+            atomic_store(&retained, 0);
+            retain_timeouts++;
+        }
+    }
+    pthread_mutex_unlock(&retained_mutex);
+}
+
+uint64_t changelog_append(const char *key, const char *value, int deleted) {
+    uint64_t version = atomic_fetch_add(&last_version, 1) + 1;
+    wait_retained(version);
+
+    // A alteração de há uma volta do anel pode ainda estar a ser escrita
+    Slot *slot = &changes_ring[version % CHANGELOG_SIZE];
+    uint64_t previous = version - start_version > CHANGELOG_SIZE ? version - CHANGELOG_SIZE : 0;
+    while (atomic_load(&slot->seq) != previous) {
+        sched_yield();
+    }
+
+    atomic_store(&slot->owner, version);
+    atomic_thread_fence(memory_order_release);
+    size_t bucket = index_bucket(key);
+    slot->prev = index_last[bucket];
+    index_last[bucket] = version;
+    slot->change.version = version;
+    snprintf(slot->change.key, MAX_STRING_SIZE, "%s", key);
+    snprintf(slot->change.value, MAX_STRING_SIZE, "%s", value);
+    slot->change.deleted = deleted;
+    atomic_store_explicit(&slot->seq, version, memory_order_release);
+    return version;
+}
+
+// Uma versão reservada continua no anel (escrita ou por escrever) enquanto
+// a da volta seguinte não começar a ocupar a sua posição
+static int kept(uint64_t version) {
+    return atomic_load(&changes_ring[version % CHANGELOG_SIZE].owner) <= version;
+}
+
+static int covers(uint64_t after) {
+    uint64_t last = atomic_load(&last_version);
+    // Basta ver a primeira em falta: as seguintes são confirmadas ao ler cada posição
+    return after >= start_version && after <= last && (after == last || kept(after + 1));
+}
+
+// Copia a alteração com uma versão sem tomar nenhum lock.
+// @return 1 se a copiou, 0 se ainda está a ser escrita, -1 se já saiu do anel.
+static int read_slot(uint64_t version, Change *change, uint64_t *prev) {
+    const Slot *slot = &changes_ring[version % CHANGELOG_SIZE];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != version) {
+        return kept(version) ? 0 : -1;
+    }
+    *change = slot->change;
+    *prev = slot->prev;
+    atomic_thread_fence(memory_order_acquire);
+    // Substituída enquanto era copiada
+    return atomic_load_explicit(&slot->owner, memory_order_relaxed) == version ? 1 : -1;
+}
+
+long changelog_since(const char *key, uint64_t since, Change *changes, size_t max) {
+    // Basta a versão ser desta execução: uma alteração da chave que já saiu
+    // do anel interrompe a lista do seu balde
+    if (since < start_version || since > atomic_load(&last_version)) {
+        return -1;
+    }
+
+    // Percorre as alterações do balde da chave da mais recente para trás.
+    // Com o lock da chave, nenhuma deste balde está a meio de ser escrita.
+    size_t count = 0;
+    uint64_t version = index_last[index_bucket(key)];
+    while (version > since) {
+        Change change;
+        uint64_t prev;
+        if (read_slot(version, &change, &prev) != 1) {
+            return -1;
+        }
+        if (strcmp(change.key, key) == 0) {
+            if (count == max) {
+                return -1;
+            }
+            changes[count++] = change;
+        }
+        version = prev;
+    }
+
+    for (size_t i = 0; i < count / 2; i++) {
+        Change change = changes[i];
+        changes[i] = changes[count - 1 - i];
+        changes[count - 1 - i] = change;
+    }
+    return (long)count;
+}
+
+long changelog_read(uint64_t after, Change *changes, size_t max) {
+    if (!covers(after)) {
+        return -1;
+    }
+    // Para na primeira alteração ainda por escrever, para as entregar por ordem
+    size_t count = 0;
+    uint64_t last = atomic_load(&last_version);
+    for (uint64_t version = after + 1; version <= last && count < max; version++) {
+        uint64_t prev;
+        int result = read_slot(version, &changes[count], &prev);
+        if (result == -1 && count == 0) {
+            return -1;
+        }
+        if (result != 1) {
+            break;
+        }
+        count++;
+    }
+    return (long)count;
+}
+
+int changelog_covers(uint64_t after) {
+    return covers(after);
+}
+
+uint64_t changelog_last(void) {
+    return atomic_load(&last_version);
+}
+
+void changelog_retain(uint64_t version) {
+    pthread_mutex_lock(&retained_mutex);
+    // Uma versão que já saiu do registo não se pode reter
+    atomic_store(&retained, version != 0 && covers(version - 1) ? version : 0);
+    pthread_cond_broadcast(&retained_cond);
+    pthread_mutex_unlock(&retained_mutex);
+}
+
+void changelog_stats(unsigned long *waits, unsigned long *timeouts) {
+    pthread_mutex_lock(&retained_mutex);
+    *waits = retain_waits;
+    *timeouts = retain_timeouts;
+    pthread_mutex_unlock(&retained_mutex);
+}
+
+uint64_t changelog_start(void) {
+    // Só muda em changelog_init, antes de haver threads
+    return start_version;
+}
@@ -0,0 +1,78 @@
+#ifndef KVS_CHANGELOG_H
+#define KVS_CHANGELOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+// Alteração de uma chave, com a versão que lhe foi atribuída
+typedef struct {
+    uint64_t version;
+    char key[MAX_STRING_SIZE];
+    char value[MAX_STRING_SIZE];  // "DELETED" se a chave foi apagada
+    int deleted;
+} Change;
+
+/// Prepara o registo das últimas CHANGELOG_SIZE alterações. As versões são
+/// consecutivas e começam no instante do arranque, em segundos com 32 bits
+/// de parte fracionária, por isso crescem também entre execuções do
+/// servidor, mesmo reiniciado no mesmo segundo: uma execução só alcançaria
+/// o início da seguinte com mais de 2^32 alterações por segundo.
+void changelog_init(void);
+
+/// Atribui a próxima versão a uma alteração e guarda-a no registo, que
+/// esquece a mais antiga quando está cheio. Não toma nenhum lock comum às
+/// outras escritas, mas deve ser chamado com o lock de escrita do índice da
+/// tabela da chave, para as versões de cada chave seguirem a ordem das
+/// alterações.
+/// Se a mais antiga estiver retida (changelog_retain), espera até
+/// CDC_BLOCK_TIMEOUT_MS que seja lida; depois disso deixa de a reter.
+/// @param key Chave alterada.
+/// @param value Novo valor, ou "DELETED".
+/// @param deleted 1 se a chave foi apagada.
+/// @return Versão da alteração.
+uint64_t changelog_append(const char *key, const char *value, int deleted);
+
+/// Copia as alterações de uma chave posteriores a uma versão, por ordem, sem
+/// percorrer as das outras chaves (salvo as que partilham o seu balde do
+/// índice) nem tomar locks. Deve ser chamado com o lock da chave, para que
+/// nenhuma alteração da chave fique de fora nem chegue entretanto.
+/// @param key Chave.
+/// @param since Última versão conhecida de quem pede.
+/// @param changes Onde copiar as alterações.
+/// @param max Número máximo de alterações a copiar.
+/// @return Número de alterações copiadas, ou -1 se o registo já não tiver
+/// todas as alterações depois de since ou se forem mais do que max.
+long changelog_since(const char *key, uint64_t since, Change *changes, size_t max);
+
+/// Copia as alterações de todas as chaves posteriores a uma versão, por
+/// ordem, até à primeira que ainda esteja a ser escrita.
+/// @param after Última versão já lida.
+/// @param changes Onde copiar as alterações.
+/// @param max Número máximo de alterações a copiar.
+/// @return Número de alterações copiadas, ou -1 se o registo já não tiver a
+/// alteração seguinte a after.
+long changelog_read(uint64_t after, Change *changes, size_t max);
+
+/// @return 1 se o registo ainda tem todas as alterações depois de after, 0
+/// caso contrário.
+int changelog_covers(uint64_t after);
+
+/// @return Versão da última alteração, que pode ainda estar a ser escrita.
+uint64_t changelog_last(void);
+
+/// Pede ao registo que não substitua alterações a partir de uma versão
+/// enquanto não forem lidas, o que atrasa as escritas (backpressure).
+/// @param version Versão mais antiga por ler, 0 para não reter nenhuma.
+void changelog_retain(uint64_t version);
+
+/// @param waits Onde guardar quantas alterações esperaram por leitores.
+/// @param timeouts Onde guardar quantas desistiram de esperar.
+void changelog_stats(unsigned long *waits, unsigned long *timeouts);
+
+/// @return Versão anterior à primeira alteração desta execução, que é a das
+/// chaves recuperadas do WAL.
+uint64_t changelog_start(void);
+
+#endif  // KVS_CHANGELOG_H
@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "compress.h"
+#include "src/common/io.h"
+
+#define LZ_HASH_BITS 12
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_LAST_LITERALS 5   // Os últimos bytes são sempre literais
+#define LZ_MATCH_MARGIN 12   // Não se procuram correspondências tão perto do fim
+#define LZ_STORED_FLAG 0x80000000u
+
+static int compression = 0;
+
+void compress_set_enabled(int enabled) {
+    compression = enabled;
+}
+
+int compress_enabled(void) {
+    return compression;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static unsigned int hash4(uint32_t sequence) {
+    return (unsigned int)((sequence * 2654435761u) >> (32 - LZ_HASH_BITS));
+}
+
+static void put_le32(unsigned char *p, uint32_t value) {
+    p[0] = (unsigned char)value;
+    p[1] = (unsigned char)(value >> 8);
+    p[2] = (unsigned char)(value >> 16);
+    p[3] = (unsigned char)(value >> 24);
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// Escreve o excesso de um comprimento em bytes de 255 terminados por um < 255
+static unsigned char *write_length(unsigned char *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static unsigned char *write_sequence(unsigned char *op, const unsigned char *literals, size_t lit, size_t match_len, size_t offset, int last) {
+    unsigned char *token = op++;
+    *token = (unsigned char)((lit >= 15 ? 15 : lit) << 4);
+    if (lit >= 15) {
+        op = write_length(op, lit - 15);
+    }
+    memcpy(op, literals, lit);
+    op += lit;
+    if (last) {
+        return op;
+    }
+
+    *op++ = (unsigned char)offset;
+    *op++ = (unsigned char)(offset >> 8);
+    *token |= (unsigned char)(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15) {
+        op = write_length(op, match_len - 15);
+    }
+    return op;
+}
+
+size_t lz_bound(size_t len) {
+    return len + len / 255 + 16;
+}
+
+size_t lz_compress(const char *src, size_t len, char *dst) {
+    const unsigned char *base = (const unsigned char *)src;
+    const unsigned char *ip = base;
+    const unsigned char *anchor = base;
+    const unsigned char *end = base + len;
+    const unsigned char *match_limit = len > LZ_MATCH_MARGIN ? end - LZ_MATCH_MARGIN : base;
+    unsigned char *op = (unsigned char *)dst;
+    uint32_t table[1 << LZ_HASH_BITS] = {0};
+
+    while (ip < match_limit) {
+        uint32_t sequence = read32(ip);
+        unsigned int h = hash4(sequence);
+        const unsigned char *ref = base + table[h];
+        table[h] = (uint32_t)(ip - base);
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != sequence) {
+            ip++;
+            continue;
+        }
+
+        // Estende a correspondência o mais possível
+        const unsigned char *mp = ip + LZ_MIN_MATCH;
+        const unsigned char *rp = ref + LZ_MIN_MATCH;
+        while (mp < end - LZ_LAST_LITERALS && *mp == *rp) {
+            mp++;
+            rp++;
+        }
+
+        op = write_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(mp - ip) - LZ_MIN_MATCH, (size_t)(ip - ref), 0);
+        ip = mp;
+        anchor = ip;
+    }
+
+    op = write_sequence(op, anchor, (size_t)(end - anchor), 0, 0, 1);
+    return (size_t)(op - (unsigned char *)dst);
+}
+
+// Lê o excesso de um comprimento; devolve 0 se os dados acabarem antes
+static int read_length(const unsigned char **ip, const unsigned char *iend, size_t *len) {
+    unsigned char byte;
+    do {
+        if (*ip >= iend) {
+            return 0;
+        }
+        byte = *(*ip)++;
+        *len += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+long lz_decompress(const char *src, size_t len, char *dst, size_t capacity) {
+    const unsigned char *ip = (const unsigned char *)src;
+    const unsigned char *iend = ip + len;
+    unsigned char *op = (unsigned char *)dst;
+    unsigned char *ostart = op;
+    unsigned char *oend = op + capacity;
+
+    while (ip < iend) {
+        unsigned char token = *ip++;
+
+        size_t lit = token >> 4;
+        if (lit == 15 && !read_length(&ip, iend, &lit)) {
+            return -1;
+        }
+        if (lit > (size_t)(iend - ip) || lit > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit);
+        ip += lit;
+        op += lit;
+
+        // A última sequência só tem literais
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - ostart)) {
+            return -1;
+        }
+
+        size_t match_len = token & 15;
+        if (match_len == 15 && !read_length(&ip, iend, &match_len)) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+        if (match_len > (size_t)(oend - op)) {
+            return -1;
+        }
+
+        // Cópia byte a byte, porque a origem pode sobrepor-se ao destino
+        const unsigned char *ref = op - offset;
+        while (match_len-- > 0) {
+            *op++ = *ref++;
+        }
+    }
+
+    return (long)(op - ostart);
+}
+
+char *compress_frame(const char *raw, size_t len, size_t *out_len) {
+    if (len >= LZ_STORED_FLAG) {
+        return NULL;
+    }
+
+    char *frame = malloc(COMPRESS_BLOCK_HEADER + lz_bound(len));
+    if (frame == NULL) {
+        return NULL;
+    }
+
+    size_t stored = lz_compress(raw, len, frame + COMPRESS_BLOCK_HEADER);
+    uint32_t stored_field = (uint32_t)stored;
+    if (stored >= len) {
+        // Não compensa: guarda o bloco em claro
+        memcpy(frame + COMPRESS_BLOCK_HEADER, raw, len);
+        stored = len;
+        stored_field = (uint32_t)len | LZ_STORED_FLAG;
+    }
+
+    put_le32((unsigned char *)frame, (uint32_t)len);
+    put_le32((unsigned char *)frame + 4, stored_field);
+    *out_len = COMPRESS_BLOCK_HEADER + stored;
+    return frame;
+}
+
+int compress_write_header(int fd) {
+    if (!compression) {
+        return 1;
+    }
+    return write_all(fd, COMPRESS_MAGIC, COMPRESS_MAGIC_SIZE);
+}
+
+int compress_write(int fd, const char *buffer, size_t len) {
+    if (!compression) {
+        return write_all(fd, buffer, len);
+    }
+
+    size_t frame_len;
+    char *frame = compress_frame(buffer, len, &frame_len);
+    if (frame == NULL) {
+        return -1;
+    }
+    int result = write_all(fd, frame, frame_len);
+    free(frame);
+    return result;
+}
+
+// Descomprime todos os blocos de um ficheiro comprimido para um novo buffer
+static char *decompress_blocks(const char *data, size_t size, size_t *len) {
+    const unsigned char *ip = (const unsigned char *)data + COMPRESS_MAGIC_SIZE;
+    const unsigned char *iend = (const unsigned char *)data + size;
+
+    // Primeira passagem: tamanho total em claro
+    size_t total = 0;
+    for (const unsigned char *p = ip; p < iend;) {
+        if (iend - p < COMPRESS_BLOCK_HEADER) {
+            return NULL;
+        }
+        size_t stored = get_le32(p + 4) & ~LZ_STORED_FLAG;
+        total += get_le32(p);
+        p += COMPRESS_BLOCK_HEADER;
+        if (stored > (size_t)(iend - p)) {
+            return NULL;
+        }
+        p += stored;
+    }
+
+    char *out = malloc(total + 1);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    size_t offset = 0;
+    while (ip < iend) {
+        size_t raw_len = get_le32(ip);
+        uint32_t stored_field = get_le32(ip + 4);
+        size_t stored = stored_field & ~LZ_STORED_FLAG;
+        ip += COMPRESS_BLOCK_HEADER;
+
+        if (stored_field & LZ_STORED_FLAG) {
+            if (stored != raw_len) {
+                free(out);
+                return NULL;
+            }
+            memcpy(out + offset, ip, stored);
+        } else if (lz_decompress((const char *)ip, stored, out + offset, raw_len) != (long)raw_len) {
+            free(out);
+            return NULL;
+        }
+        ip += stored;
+        offset += raw_len;
+    }
+
+    out[total] = '\0';
+    *len = total;
+    return out;
+}
+
+char *compress_read_file(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t size = (size_t)st.st_size;
+    char *data = malloc(size + 1);
+    if (data == NULL || (size > 0 && read_all(fd, data, size, NULL) != 1)) {
+        free(data);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    data[size] = '\0';
+
+    if (size < COMPRESS_MAGIC_SIZE || memcmp(data, COMPRESS_MAGIC, COMPRESS_MAGIC_SIZE) != 0) {
+        *len = size;
+        return data;
+    }
+
+    char *out = decompress_blocks(data, size, len);
+    free(data);
+    if (out == NULL) {
+        fprintf(stderr, "Corrupted compressed file: %s\n", path);
+    }
+    return out;
+}
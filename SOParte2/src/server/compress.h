@@ -0,0 +1,66 @@
+#ifndef KVS_COMPRESS_H
+#define KVS_COMPRESS_H
+
+#include <stddef.h>
+
+// Formato de um ficheiro comprimido: COMPRESS_MAGIC seguido de blocos.
+// Cada bloco tem um cabeçalho de 8 bytes (tamanho original e tamanho guardado,
+// ambos little-endian) e os dados. O bit mais alto do tamanho guardado indica
+// que o bloco foi guardado sem compressão por não compensar.
+#define COMPRESS_MAGIC "KVZ1"
+#define COMPRESS_MAGIC_SIZE 4
+#define COMPRESS_BLOCK_HEADER 8
+
+/// Ativa ou desativa a compressão de backups e checkpoints.
+/// @param enabled 1 para ativar, 0 para desativar.
+void compress_set_enabled(int enabled);
+
+/// @return 1 se a compressão estiver ativa, 0 caso contrário.
+int compress_enabled(void);
+
+/// Tamanho máximo do resultado de lz_compress para len bytes.
+/// @param len Número de bytes a comprimir.
+/// @return Tamanho máximo comprimido.
+size_t lz_bound(size_t len);
+
+/// Comprime um buffer no formato de blocos LZ (semelhante ao LZ4).
+/// @param src Dados a comprimir.
+/// @param len Tamanho dos dados.
+/// @param dst Destino, com pelo menos lz_bound(len) bytes.
+/// @return Tamanho comprimido.
+size_t lz_compress(const char *src, size_t len, char *dst);
+
+/// Descomprime um bloco produzido por lz_compress.
+/// @param src Dados comprimidos.
+/// @param len Tamanho dos dados comprimidos.
+/// @param dst Destino.
+/// @param capacity Tamanho do destino.
+/// @return Tamanho descomprimido, -1 se o bloco estiver corrompido.
+long lz_decompress(const char *src, size_t len, char *dst, size_t capacity);
+
+/// Cria um bloco com cabeçalho a partir de dados em claro.
+/// @param raw Dados a comprimir.
+/// @param len Tamanho dos dados.
+/// @param out_len Onde guardar o tamanho do bloco.
+/// @return Bloco alocado (a libertar por quem chama), NULL em caso de erro.
+char *compress_frame(const char *raw, size_t len, size_t *out_len);
+
+/// Escreve o cabeçalho de ficheiro comprimido, se a compressão estiver ativa.
+/// @param fd Ficheiro onde escrever.
+/// @return 1 em caso de sucesso, -1 em caso de erro.
+int compress_write_header(int fd);
+
+/// Escreve dados, comprimidos num bloco se a compressão estiver ativa.
+/// @param fd Ficheiro onde escrever.
+/// @param buffer Dados a escrever.
+/// @param len Tamanho dos dados.
+/// @return 1 em caso de sucesso, -1 em caso de erro.
+int compress_write(int fd, const char *buffer, size_t len);
+
+/// Lê um ficheiro inteiro, descomprimindo-o se tiver o cabeçalho COMPRESS_MAGIC.
+/// @param path Caminho do ficheiro.
+/// @param len Onde guardar o tamanho do conteúdo.
+/// @return Conteúdo em claro (a libertar por quem chama), NULL em caso de erro.
+char *compress_read_file(const char *path, size_t *len);
+
+#endif  // KVS_COMPRESS_H
@@ -2,3 +2,29 @@
 #define MAX_STRING_SIZE 40
 #define MAX_JOB_FILE_NAME_SIZE 256
 
+
+#define WAL_SEGMENT_PREFIX "kvs"          // Segmentos do log: <dir>/kvs-<n>.wal
+#define CHECKPOINT_FILE "kvs.ckpt"        // Último checkpoint: <dir>/kvs.ckpt
+#define CHECKPOINT_INTERVAL_MS 30000      // Tempo máximo entre checkpoints
+#define CHECKPOINT_WAL_BYTES (4 * 1024 * 1024) // Tamanho do log que força um checkpoint
+#define BACKUP_THREADS 4                  // Threads que formatam cada backup em paralelo
+#define MAX_SESSIONS_DEFAULT 1024         // Sessões em simultâneo, alterável com -s
+#define SESSION_IO_THREADS_DEFAULT 1      // Threads que leem os pedidos, alterável com -i
+#define SESSION_WORKERS_DEFAULT 4         // Threads que executam os pedidos, alterável com -p
+#define WORK_QUEUE_SIZE 256               // Pedidos à espera de um worker
+#define ADMISSION_QUEUE_SIZE_DEFAULT 64   // Ligações à espera de admissão, alterável com -q
+#define SESSION_BATCH 32                  // Pedidos em pipeline executados de seguida por um worker
+#define RESPONSE_BUFFER_SIZE (16 * 1024)  // Respostas de um lote acumuladas antes de escrever
+#define REACTOR_EVENTS 64                 // Eventos tratados por cada epoll_wait
+#define NOTIF_QUEUE_SIZE 64               // Notificações por enviar de cada sessão
+#define NOTIF_POLICY_DEFAULT NOTIF_DROP_OLDEST // Quando a fila enche, alterável com -n
+#define NOTIF_FLUSH_DELAY_US_DEFAULT 0    // Espera para juntar notificações num lote, alterável com -f
+#define SUBSCRIPTION_BUCKETS 1024         // Posições da tabela chave -> subscritores
+#define SUBSCRIPTION_LOCKS 64             // Locks que protegem as posições dessa tabela
+#define CHANGELOG_SIZE 4096               // Últimas alterações guardadas para retomar subscrições e o CDC
+#define CHANGELOG_INDEX_BUCKETS 128      // Baldes do índice do registo por índice da tabela
+#define MUTATION_HOOKS 4                  // Funções que recebem as alterações do KVS
+#define CDC_MAX_CONSUMERS 16              // Consumidores do CDC em simultâneo
+#define CDC_BATCH 64                      // Alterações lidas do registo de cada vez por consumidor
+#define CDC_BLOCK_TIMEOUT_MS 1000         // Espera máxima de uma escrita por um consumidor lento (-b)
+#define PUBLISH_LOCAL_SUBSCRIBERS 64      // Subscritores de uma escrita juntados sem alocar memória
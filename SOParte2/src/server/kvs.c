@@ -11,87 +11,6 @@
 
 
 
-/**
- * helper function to send messages
- * retries to send whatever was not sent in the beginning
- */
-void send_msg(int fd, char const *str) {
-  size_t len = strlen(str);
-  size_t written = 0;
-
-  while (written < len) {
-      ssize_t ret = write(fd, str + written, len - written);
-      if (ret < 0) {
-          perror("Write failed");
-          exit(EXIT_FAILURE);
-      }
-
-      written += (size_t)ret;
-  }
-}
-
-int notify_clients(HashTable *ht, const char *key) {
-    int index = hash(key);
-    KeyNode *keyNode = ht->table[index];
-    char notification[2*MAX_STRING_SIZE];
-
-    while (keyNode != NULL) {
-        if (strcmp(keyNode->key, key) == 0) {
-            for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-                strncpy(notification, key, MAX_STRING_SIZE);
-                strncpy(notification + MAX_STRING_SIZE, keyNode->value, MAX_STRING_SIZE);
-                send_msg(keyNode->subscriber_fds[i], notification);
-            }
-            return 0;
-        }
-        keyNode = keyNode->next; // Move to the next node
-    }
-    return 1; // Key not found
-}
-
-int add_subscriber(HashTable *ht, const char *key, int subscriber_fd) {
-    int index = hash(key);
-    KeyNode *keyNode = ht->table[index];
-
-    while (keyNode != NULL) {
-        if (strcmp(keyNode->key, key) == 0) {
-            for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-                if (keyNode->subscriber_fds[i] == subscriber_fd) {
-                    return 1; // Subscriber already exists
-                }
-            }
-            for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-                if (keyNode->subscriber_fds[i] == 0) {
-                    keyNode->subscriber_fds[i] = subscriber_fd;
-                    return 0; // Subscriber added
-                }
-            }
-            return 1; // No space for new subscriber
-        }
-        keyNode = keyNode->next; // Move to the next node
-    }
-    return 1; // Key not found 
-}
-
-int remove_subscriber(HashTable *ht, const char *key, int subscriber_fd) {
-    int index = hash(key);
-    KeyNode *keyNode = ht->table[index];
-
-    while (keyNode != NULL) {
-        if (strcmp(keyNode->key, key) == 0) {
-            for (int i = 0; i < MAX_SESSION_COUNT; i++) {
-                if (keyNode->subscriber_fds[i] == subscriber_fd) {
-                    keyNode->subscriber_fds[i] = 0;
-                    return 0; // Subscriber removed
-                }
-            }
-            return 1; // Subscriber not found
-        }
-        keyNode = keyNode->next; // Move to the next node
-    }
-    return 1; // Key not found
-}
-
 int hash(const char *key) {
     int firstLetter = tolower(key[0]); 
     if (firstLetter >= 'a' && firstLetter <= 'z') {
@@ -113,6 +32,10 @@ struct HashTable* create_hash_table() {
 }
 
 int write_pair(HashTable *ht, const char *key, const char *value) {
+    return write_versioned_pair(ht, key, value, 0);
+}
+
+int write_versioned_pair(HashTable *ht, const char *key, const char *value, uint64_t version) {
     int index = hash(key); 
     KeyNode *keyNode = ht->table[index];
 
@@ -121,6 +44,7 @@ int write_pair(HashTable *ht, const char *key, const char *value) {
         if (strcmp(keyNode->key, key) == 0) {
             free(keyNode->value); // Liberta o valor antigo
             keyNode->value = strdup(value); // Atualiza o valor
+            keyNode->version = version;
             return 0;
         }
         keyNode = keyNode->next; // Move para o próximo par
@@ -130,6 +54,7 @@ int write_pair(HashTable *ht, const char *key, const char *value) {
     keyNode = malloc(sizeof(KeyNode));
     keyNode->key = strdup(key); // Aloca memória e copia a chave
     keyNode->value = strdup(value); // Aloca memória e copia o valor
+    keyNode->version = version;
     keyNode->next = ht->table[index]; // Encadeia com os pares existentes
     ht->table[index] = keyNode; // Adiciona o novo par no início da lista
     return 0;
@@ -137,11 +62,17 @@ int write_pair(HashTable *ht, const char *key, const char *value) {
 
 /// Lê o valor associado a uma chave na tabela hash.
 char* read_pair(HashTable *ht, const char *key) {
+    uint64_t version;
+    return read_versioned_pair(ht, key, &version);
+}
+
+char* read_versioned_pair(HashTable *ht, const char *key, uint64_t *version) {
     int index = hash(key); 
     KeyNode *keyNode = ht->table[index];
 
     while (keyNode != NULL) {
         if (strcmp(keyNode->key, key) == 0) {
+            *version = keyNode->version;
             return strdup(keyNode->value); 
         }
         keyNode = keyNode->next; 
@@ -3,6 +3,7 @@
 
 #define TABLE_SIZE 26
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/types.h>
@@ -26,14 +27,19 @@ typedef struct {
     int max_backups;                                   // Número máximo de backups
     pthread_rwlock_t rwlock;                           // Rwlock global para o proteger o comando show
     pthread_rwlock_t rwlock_array[26];                 // Rwlocks para cada letra do alfabeto
+    uint64_t publish_next[26];                         // Próxima vez de publicar de cada letra, com o seu lock de escrita
+    uint64_t publish_turn[26];                         // Vez que está a publicar em cada letra
+    pthread_mutex_t publish_mutex;                     // Protege as vezes que estão a publicar
+    pthread_cond_t publish_cond;                       // Sinaliza quando uma vez termina
     int active_backups;                                // Backups em atividade
     pthread_mutex_t backup_mutex;                      // Protege o acesso ao número de backups ativos
+    pthread_cond_t backup_cond;                        // Sinaliza quando um backup termina
 } ThreadData;
 
 typedef struct KeyNode {
     char *key;
     char *value;
-    int subscriber_fds[MAX_SESSION_COUNT];
+    uint64_t version;  // Versão da última alteração, 0 se anterior ao arranque
     struct KeyNode *next;
 } KeyNode;
 
@@ -41,10 +47,6 @@ typedef struct HashTable {
     KeyNode *table[TABLE_SIZE];
 } HashTable;
 
-void send_msg(int fd, char const *str);
-int notify_clients(HashTable *ht, const char *key);
-int add_subscriber(HashTable *ht, const char *key, int subscriber_fd);
-int remove_subscriber(HashTable *ht, const char *key, int subscriber_fd);
 
 
 
@@ -65,6 +67,12 @@ struct HashTable *create_hash_table();
 /// @return 0 if the node was appended successfully, 1 otherwise.
 int write_pair(HashTable *ht, const char *key, const char *value);
 
+/// Appends a new key value pair to the hash table, recording the version of
+/// the change.
+/// @param version Version given to the change by the change log.
+/// @return 0 if the node was appended successfully, 1 otherwise.
+int write_versioned_pair(HashTable *ht, const char *key, const char *value, uint64_t version);
+
 /// Deletes the value of given key.
 /// @param ht Hash table to delete from.
 /// @param key Key of the pair to be deleted.
@@ -77,6 +85,11 @@ char* read_pair(HashTable *ht, const char *key);
 /// @return 0 if the node was appended successfully, 1 otherwise.
 int delete_pair(HashTable *ht, const char *key);
 
+/// Reads the value of a key and the version of its last change.
+/// @param version Where to store the version (0 for pairs loaded at startup).
+/// @return Copy of the value, to be freed, or NULL if the key does not exist.
+char* read_versioned_pair(HashTable *ht, const char *key, uint64_t *version);
+
 /// Frees the hashtable.
 /// @param ht Hash table to be deleted.
 void free_table(HashTable *ht);
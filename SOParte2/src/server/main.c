@@ -12,19 +12,32 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 
 #include "parser.h"
 #include "operations.h"
+#include "wal.h"
+#include "compress.h"
+#include "sessions.h"
+#include "cdc.h"
 #include "src/common/constants.h"
+#include "src/common/io.h"
+#include "src/common/mpmc.h"
+#include "src/common/protocol.h"
 
-sem_t SEM_BUFFER_SPACE;
-sem_t SEM_BUFFER_CLIENTS;
-pthread_mutex_t BUFFER_MUTEX;
+// Pedido de ligação já descodificado pela thread anfitriã
+typedef struct {
+  char req_pipe_path[PATH_FIELD_SIZE];
+  char resp_pipe_path[PATH_FIELD_SIZE];
+  char notif_pipe_path[PATH_FIELD_SIZE];
+} ConnectRequest;
 
-char BUFFER[MAX_SESSION_COUNT][1 + 3 * MAX_PIPE_PATH_LENGTH] = {0};
-int BUFFER_READ_INDEX = 0;
-int BUFFER_WRITE_INDEX = 0;
+// Fila de admissão: a thread anfitriã insere e as threads de admissão
+// retiram, sem locks
+MpmcQueue ADMISSION_QUEUE;
 
 
 // Função para ordenar 
@@ -51,11 +64,42 @@ void insertionSort(char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
     }
 }
 
-// Função para processar um ficheiro .job e executar os comandos
-void process_job_file(const char *input_path, const char *output_path, char *job_name, ThreadData *data) {
-    int max_backups = data->max_backups;
-    const char *output_dir = data->output_dir;
+// Cria um processo filho que escreve o backup do armazenamento.
+// Com target == NULL escreve <output_dir>/<job>-<n>.bck, caso contrário
+// envia o estado para o FIFO ou socket indicado.
+void start_backup(ThreadData *data, const char *job_name, int *total_backups, const char *target) {
+    pthread_mutex_lock(&data->backup_mutex);
+    // Espera que a thread de recolha liberte uma vaga
+    while (data->active_backups >= data->max_backups) {
+        pthread_cond_wait(&data->backup_cond, &data->backup_mutex);
+    }
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        pthread_rwlock_rdlock(&data->rwlock_array[i]);
+    }
+    // Só os backups para ficheiro contam para a numeração dos .bck
+    if (target == NULL) {
+        (*total_backups)++;
+    }
+    pid_t pid = fork();
+    if (pid == 0) { // Processo filho
+        kvs_backup(*total_backups, data->output_dir, job_name, target);
+        kvs_terminate();
+        exit(0);
+    } else { // Processo pai
+        if (pid > 0) {
+            data->active_backups++;
+        } else {
+            perror("Failed to fork backup process");
+        }
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            pthread_rwlock_unlock(&data->rwlock_array[i]);
+        }
+        pthread_mutex_unlock(&data->backup_mutex);
+    }
+}
 
+// Função para processar um ficheiro .job e executar os comandos
+void process_job_file(const char *input_path, const char *output_path, const char *job_name, ThreadData *data) {
     // Abre o ficheiro .job
     int input_fd = open(input_path, O_RDONLY);
     if (input_fd < 0) {
@@ -75,6 +119,7 @@ void process_job_file(const char *input_path, const char *output_path, char *job
     unsigned int delay;
     size_t num_pairs;
     int total_backups = 0;
+    char target[MAX_JOB_FILE_NAME_SIZE];
 
     // Loop principal para processar comandos do ficheiro
     for (;;) {
@@ -136,29 +181,16 @@ void process_job_file(const char *input_path, const char *output_path, char *job
 
           case CMD_BACKUP:
               // Cria um backup do armazenamento
-              pthread_mutex_lock(&data->backup_mutex);
-              if (data->active_backups >= max_backups) {
-                  if (wait(NULL) > 0) {
-                      data->active_backups--;
-                  }
-              }
-              for (int i = 0; i < TABLE_SIZE; i++) {
-                  pthread_rwlock_rdlock(&data->rwlock_array[i]);
-              }
-              pid_t pid = fork();
-              if (pid == 0) { // Processo filho
-                  total_backups++;
-                  kvs_backup(total_backups, output_dir, job_name);
-                  kvs_terminate();
-                  exit(0);
-              } else { // Processo pai
-                  total_backups++;
-                  data->active_backups++;
-                  for (int i = 0; i < TABLE_SIZE; i++) {
-                      pthread_rwlock_unlock(&data->rwlock_array[i]);
-                  }
-                  pthread_mutex_unlock(&data->backup_mutex);
+              start_backup(data, job_name, &total_backups, NULL);
+              break;
+
+          case CMD_BACKUP_TO:
+              // Envia o backup para um FIFO ou socket em vez de um ficheiro
+              if (parse_backup_target(input_fd, target, MAX_JOB_FILE_NAME_SIZE) != 0) {
+                  fprintf(stderr, "Invalid command. See HELP for usage\n");
+                  continue;
               }
+              start_backup(data, job_name, &total_backups, target);
               break;
 
           case CMD_INVALID:
@@ -173,7 +205,7 @@ void process_job_file(const char *input_path, const char *output_path, char *job
                   "  DELETE [key,key2,...]\n"
                   "  SHOW\n"
                   "  WAIT <delay_ms>\n"
-                  "  BACKUP\n"
+                  "  BACKUP [fifo_or_socket_path]\n"
                   "  HELP\n"
               );
               break;
@@ -247,6 +279,72 @@ void process_job_directory(const char *input_dir, const char *output_dir, int ma
 }
 
 
+int REAPER_STOP = 0;
+
+// Thread que recolhe os processos de backup assim que terminam.
+// O SIGCHLD está bloqueado em todas as threads e é recebido aqui com sigwait,
+// por isso a contagem de backups ativos está sempre atualizada.
+void *thread_reap_backups(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+
+    for (;;) {
+        int sig;
+        if (sigwait(&set, &sig) != 0) {
+            continue;
+        }
+
+        pthread_mutex_lock(&data->backup_mutex);
+        // Vários filhos podem terminar com um único SIGCHLD pendente
+        while (waitpid(-1, NULL, WNOHANG) > 0) {
+            if (data->active_backups > 0) {
+                data->active_backups--;
+            }
+        }
+        pthread_cond_broadcast(&data->backup_cond);
+        int stop = REAPER_STOP;
+        pthread_mutex_unlock(&data->backup_mutex);
+
+        if (stop) {
+            return NULL;
+        }
+    }
+}
+
+// Thread que escreve as métricas das sessões (e do CDC, se ativo) para o
+// stderr a cada SIGUSR2
+void *thread_report_metrics(void *arg) {
+    int cdc_enabled = *(int *)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR2);
+
+    for (;;) {
+        int sig;
+        if (sigwait(&set, &sig) == 0) {
+            sessions_report(stderr);
+            if (cdc_enabled) {
+                cdc_report(stderr);
+            }
+        }
+    }
+}
+
+// Thread que escreve checkpoints periódicos e trunca o WAL
+void *thread_checkpoint(void *arg) {
+    ThreadData *data = (ThreadData *)arg;
+
+    while (wal_wait_checkpoint() == 0) {
+        if (kvs_checkpoint(data) != 0) {
+            fprintf(stderr, "Failed to write checkpoint\n");
+        }
+    }
+
+    return NULL;
+}
+
 void *host_FIFO(void *arg) {
   char *register_FIFO_name = (char *)arg;
 
@@ -269,172 +367,320 @@ void *host_FIFO(void *arg) {
   }
 
   // Lê do FIFO
-  //OP_CODE=1 | nome do pipe do cliente (para pedidos) | nome do pipe do cliente (para respostas) | nome do pipe do cliente (para notificações)
+  // Cada pedido é uma trama CONNECT: cabeçalho | pipe de pedidos | pipe de respostas | pipe de notificações
+  char payload[FRAME_MAX_PAYLOAD];
   while(1) {
-
-    sem_wait(&SEM_BUFFER_SPACE);
-    
-    // Escreve no buffer
-    // Não é necessário lock, visto que a thread anfitriã é a única a alterar o indice
-    ssize_t bytes_read = read(fifo_fd, BUFFER[BUFFER_WRITE_INDEX], 1 + 3 * MAX_PIPE_PATH_LENGTH);
-    
-    if (bytes_read == 0) {
-      // bytes_read == 0 indica EOF
+    FrameHeader header;
+    int result = recv_frame(fifo_fd, &header, payload, FRAME_MAX_PAYLOAD, NULL);
+    if (result == 0) {
+      // result == 0 indica EOF
       fprintf(stderr, "pipe closed\n");
       return NULL;
-    } else if (bytes_read == -1) {
-      // bytes_read == -1 indica erro
+    } else if (result == -1) {
       fprintf(stderr, "read failed: %s\n", strerror(errno));
       exit(EXIT_FAILURE);
     }
-    BUFFER_WRITE_INDEX = (BUFFER_WRITE_INDEX + 1) % MAX_SESSION_COUNT;
-    sem_post(&SEM_BUFFER_CLIENTS);
-        
+    if (header.op_code != OP_CODE_CONNECT || header.length != CONNECT_PAYLOAD_SIZE) {
+      fprintf(stderr, "Invalid connect request, op_code %u\n", header.op_code);
+      continue;
+    }
+
+    ConnectRequest *request = malloc(sizeof(ConnectRequest));
+    if (request == NULL) {
+      fprintf(stderr, "Failed to allocate connect request\n");
+      continue;
+    }
+    decode_connect(payload, request->req_pipe_path, request->resp_pipe_path, request->notif_pipe_path);
+
+    // Espera se a fila estiver cheia; o cliente fica à espera da resposta
+    mpmc_push(&ADMISSION_QUEUE, request);
   }
   
   close(fifo_fd);
   unlink(register_FIFO_name);
 }
 
+// Threads de admissão: abrem os pipes de cada cliente e entregam a sessão
+// ao reactor. Há MAX_SESSION_COUNT, para que um cliente que demore a abrir
+// os pipes não atrase os restantes.
 void *thread_manage_session(void *arg) {
-  ThreadData *data = (ThreadData *)arg;
+  (void)arg;
 
-  char client_paths[1 + 3 * MAX_PIPE_PATH_LENGTH];
   while (1) {
-    sem_wait(&SEM_BUFFER_CLIENTS);
-    pthread_mutex_lock(&BUFFER_MUTEX);
-    
-    // Lê do buffer global
-    // Lock necessário, visto que todas as threads gestoras podem alterar o indice
-    strncpy(client_paths, BUFFER[BUFFER_READ_INDEX], (1 + 3 * MAX_PIPE_PATH_LENGTH));
-
-    BUFFER_READ_INDEX = (BUFFER_READ_INDEX + 1) % MAX_SESSION_COUNT;
-    pthread_mutex_unlock(&BUFFER_MUTEX);
-    sem_post(&SEM_BUFFER_SPACE);
-
-    // OP_CODE=1 | nome do pipe do cliente (para pedidos) | nome do pipe do cliente (para respostas) | nome do pipe do cliente (para notificações)
-    int op_code_1;
-    char req_pipe_path[MAX_PIPE_PATH_LENGTH];
-    char resp_pipe_path[MAX_PIPE_PATH_LENGTH];
-    char notif_pipe_path[MAX_PIPE_PATH_LENGTH];
-    
-    sscanf(client_paths, "%d|%[^|]|%[^|]|%s", &op_code_1, req_pipe_path, resp_pipe_path, notif_pipe_path);
-    
+    ConnectRequest *request = mpmc_pop(&ADMISSION_QUEUE);
+
     // importante: abrir os pipes pela ordem que abres no cliente em api.c com a flag contrária
-    int resp_fd = open(resp_pipe_path, O_WRONLY);
+    int resp_fd = open(request->resp_pipe_path, O_WRONLY);
     if(resp_fd == -1) {
       perror("Failed to open FIFO");
       exit(EXIT_FAILURE);
     }
-    int req_fd = open(req_pipe_path, O_RDONLY);
+    int req_fd = open(request->req_pipe_path, O_RDONLY);
     if(req_fd == -1) {
       perror("Failed to open FIFO");
       exit(EXIT_FAILURE);
     }
-    int notif_fd = open(notif_pipe_path, O_WRONLY);
+    int notif_fd = open(request->notif_pipe_path, O_WRONLY);
     if(notif_fd == -1) {
       perror("Failed to open FIFO");
       exit(EXIT_FAILURE);
     }
+    free(request);
 
-    send_msg(resp_fd, "10");
-
-    char request[42] = {0};
-    while(1) {
-      // Ler do pipe de pedidos
-      ssize_t bytes_read = read(req_fd, request, sizeof(request));
-      if (bytes_read == 0) {
-        // bytes_read == 0 indica EOF
-        fprintf(stderr, "pipe closed\n");
-        break; // FIXME is it supposed to return?
-      } else if (bytes_read == -1) {
-        // bytes_read == -1 indica erro
-        fprintf(stderr, "read failed: %s\n", strerror(errno));
-        exit(EXIT_FAILURE); // FIXME is it supposed to return?
-      }
-    
-      //parse request
-      char op_code = request[0];
-      char key[41];
-
-      char response[2];
-      response[0] = op_code;
-
-      int result;
-      switch (op_code) {
-        case 2: //disconnect
-          // OP_CODE=2
-          send_msg(notif_fd, response);
-          printf("pipe closed\n");
-
-          break;
-          
-        case 3: //subscribe
-          // OP_CODE=3 | key
-          strncpy(key, request + 1, 41);
-          result = kvs_subscribe(key, notif_fd, data);
-          response[1] = (char) result+'0';
-          send_msg(notif_fd, response);
-
-          break;
-          
-        case 4: //unsubscribe
-          // OP_CODE=4 | key
-          strncpy(key, request + 1, 41);
-          result = kvs_unsubscribe(key, notif_fd, data);
-          response[1] = (char) result+'0';
-          send_msg(notif_fd, response);
-
-          break;
-
-        default:
-          fprintf(stderr, "Invalid command, op_code unrecognized\n");
-          break;
+    send_frame(resp_fd, OP_CODE_CONNECT, 0, 0, NULL, 0);
+
+    // A partir daqui os pedidos são tratados pelo reactor e pelos workers
+    if (sessions_add(req_fd, resp_fd, notif_fd, 0) != 0) {
+      fprintf(stderr, "Failed to register session\n");
+    }
+  }
+}
+
+// Thread que aceita sessões num socket Unix SOCK_SEQPACKET, alternativa ao
+// FIFO de registo. Cada ligação é um canal bidirecional: pedidos, respostas e
+// notificações passam pelo mesmo socket, uma trama por mensagem.
+void *host_socket(void *arg) {
+  char *socket_path = (char *)arg;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Socket path too long: %s\n", socket_path);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, socket_path);
+
+  // Remove o socket, se existir
+  if (unlink(socket_path) != 0 && errno != ENOENT) {
+    perror("unlink(%s) failed");
+    exit(EXIT_FAILURE);
+  }
+
+  int listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (listen_fd == -1 || bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    perror("Failed to create session socket");
+    exit(EXIT_FAILURE);
+  }
+
+  while (1) {
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno != EINTR) {
+        perror("accept failed");
       }
+      continue;
+    }
 
-      // exits inner while loop
-      if (op_code == 2) {
-        break;
+    // O cliente envia uma trama CONNECT sem payload logo após ligar; o
+    // timeout impede que um cliente parado atrase os restantes
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    FrameHeader header;
+    if (recv_packet(fd, &header, NULL, 0) != 1 || header.op_code != OP_CODE_CONNECT) {
+      fprintf(stderr, "Invalid connect request on socket\n");
+      close(fd);
+      continue;
+    }
+    timeout.tv_sec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Cada papel tem o seu descritor, para a sessão os fechar como aos pipes
+    int resp_fd = dup(fd);
+    int notif_fd = dup(fd);
+    if (resp_fd == -1 || notif_fd == -1) {
+      perror("dup failed");
+      close(fd);
+      if (resp_fd != -1) {
+        close(resp_fd);
       }
-      
+      continue;
+    }
+
+    send_frame(resp_fd, OP_CODE_CONNECT, 0, 0, NULL, 0);
+
+    if (sessions_add(fd, resp_fd, notif_fd, 1) != 0) {
+      fprintf(stderr, "Failed to register session\n");
     }
-    close(resp_fd);
-    close(req_fd);
-    close(notif_fd);
   }
 }
 
 int main(int argc, char *argv[]) {
-  if (argc < 5) {
-    fprintf(stderr, "Usage: %s <jobs_dir> <max_backups> <max_threads> <register_FIFO_name>\n", argv[0]);
+  const char *wal_dir = NULL;
+  char *socket_path = NULL;
+  char *cdc_path = NULL;
+  int cdc_block = 0;
+
+  int max_sessions = MAX_SESSIONS_DEFAULT;
+  int io_threads = SESSION_IO_THREADS_DEFAULT;
+  int workers = SESSION_WORKERS_DEFAULT;
+  int admission_size = ADMISSION_QUEUE_SIZE_DEFAULT;
+
+  // Opções: -w <wal_dir> ativa o WAL com checkpoints periódicos
+  //         -z comprime os backups e os checkpoints
+  //         -s <max_sessions> número máximo de sessões em simultâneo
+  //         -i <io_threads> threads que leem os pedidos das sessões
+  //         -p <workers> threads que executam os pedidos no KVS
+  //         -u <socket_path> aceita também sessões num socket Unix
+  //         -m permite sessões em memória partilhada
+  //         -q <admission_size> pedidos de ligação à espera de admissão
+  //         -n <policy> o que fazer quando a fila de notificações de uma
+  //            sessão enche: drop, coalesce ou disconnect
+  //         -f <flush_delay_us> espera para juntar notificações num lote
+  //         -c <cdc_socket_path> publica todas as alterações num socket Unix
+  //         -b as escritas esperam pelos consumidores do CDC mais lentos
+  int opt;
+  while ((opt = getopt(argc, argv, "w:zs:i:p:u:mq:n:f:c:b")) != -1) {
+    switch (opt) {
+      case 'b':
+        cdc_block = 1;
+        break;
+      case 'c':
+        cdc_path = optarg;
+        break;
+      case 'm':
+        sessions_set_shm(1);
+        break;
+      case 'f': {
+        char *end;
+        long delay_us = strtol(optarg, &end, 10);
+        if (*end != '\0' || delay_us < 0 || delay_us > 1000000) {
+          argc = 0;
+        } else {
+          sessions_set_notif_flush_delay((unsigned int)delay_us);
+        }
+        break;
+      }
+      case 'i':
+        io_threads = atoi(optarg);
+        if (io_threads <= 0) {
+          argc = 0;
+        }
+        break;
+      case 'p':
+        workers = atoi(optarg);
+        if (workers <= 0) {
+          argc = 0;
+        }
+        break;
+      case 'n':
+        if (sessions_set_notif_policy(optarg) != 0) {
+          argc = 0;
+        }
+        break;
+      case 'q':
+        admission_size = atoi(optarg);
+        if (admission_size <= 0) {
+          argc = 0;
+        }
+        break;
+      case 's':
+        max_sessions = atoi(optarg);
+        if (max_sessions <= 0) {
+          argc = 0;
+        }
+        break;
+      case 'u':
+        socket_path = optarg;
+        break;
+      case 'w':
+        wal_dir = optarg;
+        break;
+      case 'z':
+        compress_set_enabled(1);
+        break;
+      default:
+        argc = 0; // força a mensagem de utilização
+        break;
+    }
+  }
+
+  if (argc - optind < 4) {
+    fprintf(stderr, "Usage: %s [-w wal_dir] [-z] [-s max_sessions] [-i io_threads] [-p workers] [-u socket_path] [-m] [-q admission_size] [-n drop|coalesce|disconnect] [-f flush_delay_us] [-c cdc_socket_path] [-b] <jobs_dir> <max_backups> <max_threads> <register_FIFO_name>\n", argv[0]);
     return 1;
   }
+  argv += optind - 1;
+
   if (kvs_init()) {
     fprintf(stderr, "Failed to initialize KVS\n");
     return 1;
   }
+  if (wal_dir != NULL && kvs_wal_init(wal_dir)) {
+    fprintf(stderr, "Failed to initialize WAL in %s\n", wal_dir);
+    return 1;
+  }
 
   int max_backups = atoi(argv[2]);
   int max_threads = atoi(argv[3]);
   char *register_FIFO_name = argv[4];
 
   ThreadData data;
+  data.active_backups = 0;
 
   // Inicialização de mutexes e rwlocks
   pthread_mutex_init(&data.file_mutex, NULL);
   pthread_rwlock_init(&data.rwlock, NULL);
   pthread_mutex_init(&data.backup_mutex, NULL);
+  pthread_cond_init(&data.backup_cond, NULL);
+  pthread_mutex_init(&data.publish_mutex, NULL);
+  pthread_cond_init(&data.publish_cond, NULL);
   for (int i = 0; i < 26; i++) {
     pthread_rwlock_init(&data.rwlock_array[i], NULL);
+    data.publish_next[i] = 0;
+    data.publish_turn[i] = 0;
+  }
+
+  // Bloqueia o SIGCHLD e o SIGUSR2 antes de criar threads, para que só as
+  // threads que os esperam com sigwait os recebam
+  sigset_t blocked_set;
+  sigemptyset(&blocked_set);
+  sigaddset(&blocked_set, SIGCHLD);
+  sigaddset(&blocked_set, SIGUSR2);
+  pthread_sigmask(SIG_BLOCK, &blocked_set, NULL);
+
+  // Um cliente que termina sem DISCONNECT não deve terminar o servidor
+  signal(SIGPIPE, SIG_IGN);
+
+  pthread_t reaper_thread;
+  pthread_create(&reaper_thread, NULL, thread_reap_backups, &data);
+
+  int cdc_enabled = cdc_path != NULL;
+  pthread_t metrics_thread;
+  pthread_create(&metrics_thread, NULL, thread_report_metrics, &cdc_enabled);
+  pthread_detach(metrics_thread);
+
+  pthread_t checkpoint_thread;
+  if (wal_dir != NULL) {
+    pthread_create(&checkpoint_thread, NULL, thread_checkpoint, &data);
+  }
+
+  // Reactor e workers que tratam os pedidos das sessões
+  if (sessions_init(max_sessions, io_threads, workers, &data) != 0) {
+    fprintf(stderr, "Failed to initialize sessions\n");
+    return 1;
+  }
+
+  // Antes dos jobs e das sessões, para o CDC ver todas as escritas
+  if (cdc_path != NULL && cdc_init(cdc_path, cdc_block) != 0) {
+    fprintf(stderr, "Failed to initialize CDC on %s\n", cdc_path);
+    return 1;
+  }
+
+  if (mpmc_init(&ADMISSION_QUEUE, (size_t)admission_size) != 0) {
+    fprintf(stderr, "Failed to initialize admission queue\n");
+    return 1;
   }
 
   // Thread para gerenciar o FIFO de registo
   pthread_t register_thread;
-  pthread_mutex_init(&BUFFER_MUTEX, NULL);
   pthread_create(&register_thread, NULL, host_FIFO, register_FIFO_name);
 
-  sem_init(&SEM_BUFFER_SPACE, 0, MAX_SESSION_COUNT);
-  sem_init(&SEM_BUFFER_CLIENTS, 0, 0);
+  if (socket_path != NULL) {
+    pthread_t socket_thread;
+    pthread_create(&socket_thread, NULL, host_socket, socket_path);
+    pthread_detach(socket_thread);
+  }
 
   pthread_t manager_threads[MAX_SESSION_COUNT];
   for (int i = 0; i < MAX_SESSION_COUNT; i++) {
@@ -458,28 +704,33 @@ int main(int argc, char *argv[]) {
     pthread_join(manager_threads[i], NULL);
   }
 
+  if (wal_dir != NULL) {
+    wal_close();
+    pthread_join(checkpoint_thread, NULL);
+  }
+
   // Destruir mutexes e rwlocks
   pthread_mutex_destroy(&data.file_mutex);
   pthread_rwlock_destroy(&data.rwlock);
-  pthread_mutex_destroy(&data.backup_mutex);
-  for (int i = 0; i < 26; i++) {
-    pthread_rwlock_destroy(&data.rwlock_array[i]);
-  }
 
-  // Encerra os semáforos
-    if (sem_destroy(&SEM_BUFFER_SPACE) != 0) {
-        perror("Failed to destroy SEM_BUFFER_SPACE");
-    }
-
-    if (sem_destroy(&SEM_BUFFER_CLIENTS) != 0) {
-        perror("Failed to destroy SEM_BUFFER_CLIENTS");
-    }
+  mpmc_destroy(&ADMISSION_QUEUE);
 
   // Aguardar os processos filhos finalizarem
+  pthread_mutex_lock(&data.backup_mutex);
   while (data.active_backups > 0) {
-    if (wait(NULL) > 0) {
-      data.active_backups--;
-    } 
+    pthread_cond_wait(&data.backup_cond, &data.backup_mutex);
+  }
+  REAPER_STOP = 1;
+  pthread_mutex_unlock(&data.backup_mutex);
+  pthread_kill(reaper_thread, SIGCHLD);
+  pthread_join(reaper_thread, NULL);
+
+  pthread_mutex_destroy(&data.backup_mutex);
+  pthread_cond_destroy(&data.backup_cond);
+  pthread_mutex_destroy(&data.publish_mutex);
+  pthread_cond_destroy(&data.publish_cond);
+  for (int i = 0; i < 26; i++) {
+    pthread_rwlock_destroy(&data.rwlock_array[i]);
   }
   kvs_terminate();
   return 0;
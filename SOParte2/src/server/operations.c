@@ -5,14 +5,25 @@
 #include <pthread.h>
 
 #include "operations.h"
+#include "changelog.h"
+#include "wal.h"
+#include "compress.h"
 #include "constants.h"
 #include "src/common/constants.h"
+#include "src/common/io.h"
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 
 static struct HashTable* kvs_table = NULL;
+// Recebem as alterações já sem os locks: as subscrições e o CDC
+static MutationFn mutation_hooks[MUTATION_HOOKS];
+static int mutation_hook_count = 0;
 
 static struct timespec delay_to_timespec(unsigned int delay_ms) {
   return (struct timespec){delay_ms / 1000, (delay_ms % 1000) * 1000000};
@@ -24,10 +35,85 @@ int kvs_init() {
     return 1;
   }
 
+  changelog_init();
   kvs_table = create_hash_table();
   return kvs_table == NULL;
 }
 
+int kvs_wal_init(const char *wal_dir) {
+  if (kvs_table == NULL) {
+    fprintf(stderr, "KVS state must be initialized\n");
+    return 1;
+  }
+
+  return wal_init(wal_dir, kvs_table);
+}
+
+int kvs_add_mutation_hook(MutationFn hook) {
+    if (mutation_hook_count == MUTATION_HOOKS) {
+        return 1;
+    }
+    mutation_hooks[mutation_hook_count++] = hook;
+    return 0;
+}
+
+// Bloqueia os índices marcados da tabela por ordem crescente, e não pela
+// ordem das chaves no pedido: dois pedidos com as mesmas chaves por ordens
+// diferentes bloqueariam um à espera do outro
+static void lock_stripes(const int hashed[TABLE_SIZE], ThreadData *data, int write) {
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        if (hashed[i] == 1) {
+            if (write) {
+                pthread_rwlock_wrlock(&data->rwlock_array[i]);
+            } else {
+                pthread_rwlock_rdlock(&data->rwlock_array[i]);
+            }
+        }
+    }
+}
+
+static void publish_mutation(const char *key, const char *value, uint64_t version, int deleted) {
+    for (int i = 0; i < mutation_hook_count; i++) {
+        mutation_hooks[i](key, value, version, deleted);
+    }
+}
+
+// Tira uma senha para publicar em cada índice bloqueado, ainda com os seus
+// locks de escrita: as senhas de um índice seguem a ordem das versões, e
+// tirá-la não espera por nada
+static void publish_ticket(const int hashed[TABLE_SIZE], uint64_t tickets[TABLE_SIZE], ThreadData *data) {
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        if (hashed[i] == 1) {
+            tickets[i] = data->publish_next[i]++;
+        }
+    }
+}
+
+// Espera, já sem os locks das chaves, pela vez das senhas em cada índice.
+// Um pedido tira as senhas de todos os seus índices com todos bloqueados,
+// por isso dois pedidos têm-nas pela mesma ordem em todos os que partilham.
+static void publish_wait(const int hashed[TABLE_SIZE], const uint64_t tickets[TABLE_SIZE], ThreadData *data) {
+    pthread_mutex_lock(&data->publish_mutex);
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        while (hashed[i] == 1 && data->publish_turn[i] != tickets[i]) {
+            pthread_cond_wait(&data->publish_cond, &data->publish_mutex);
+        }
+    }
+    pthread_mutex_unlock(&data->publish_mutex);
+}
+
+// Passa a vez à senha seguinte de cada índice
+static void publish_done(const int hashed[TABLE_SIZE], ThreadData *data) {
+    pthread_mutex_lock(&data->publish_mutex);
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        if (hashed[i] == 1) {
+            data->publish_turn[i]++;
+        }
+    }
+    pthread_cond_broadcast(&data->publish_cond);
+    pthread_mutex_unlock(&data->publish_mutex);
+}
+
 int kvs_terminate() {
   if (kvs_table == NULL) {
     fprintf(stderr, "KVS state must be initialized\n");
@@ -40,6 +126,12 @@ int kvs_terminate() {
 
 
 int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], ThreadData *data) {
+    uint64_t versions[num_pairs];
+    return kvs_write_versioned(num_pairs, keys, values, versions, data);
+}
+
+int kvs_write_versioned(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+                        uint64_t *versions, ThreadData *data) {
     if (kvs_table == NULL) {
         fprintf(stderr, "KVS state has already been initialized\n");
         return 1;
@@ -50,35 +142,41 @@ int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_
     // Bloqueio global para evitar alterações durante a escrita
     pthread_rwlock_rdlock(&data->rwlock);
     for (size_t i = 0; i < num_pairs; i++) {
-        int index = hash(keys[i]);
-        if (hashed[index] == 0) { // Bloqueia o índice somente se ainda não estiver bloqueado
-            pthread_rwlock_wrlock(&data->rwlock_array[index]);
-            hashed[index] = 1;
-        }
+        hashed[hash(keys[i])] = 1; // Cada índice só é bloqueado uma vez
     }
+    lock_stripes(hashed, data, 1);
 
     // Adiciona os pares chave-valor à tabela hash
     for (size_t i = 0; i < num_pairs; i++) {
-        if (write_pair(kvs_table, keys[i], values[i]) != 0) {
+        wal_log_write(keys[i], values[i]);
+        versions[i] = changelog_append(keys[i], values[i], 0);
+        if (write_versioned_pair(kvs_table, keys[i], values[i], versions[i]) != 0) {
             fprintf(stderr, "Fail to write keypair (%s,%s)\n", keys[i], values[i]);
         }
     }
 
     // Liberta os bloqueios dos índices da tabela
+    uint64_t tickets[TABLE_SIZE];
+    publish_ticket(hashed, tickets, data);
     for (int i = 0; i < 26; i++) {
         if (hashed[i] == 1) {
             pthread_rwlock_unlock(&data->rwlock_array[i]);
-            hashed[i] = 0;
         }
     }
     pthread_rwlock_unlock(&data->rwlock); // Liberta o bloqueio global
 
+    // As alterações são publicadas já sem os locks das chaves, na vez das
+    // senhas: a publicação da escrita anterior não atrasa esta a escrever
+    publish_wait(hashed, tickets, data);
+    for (size_t i = 0; i < num_pairs; i++) {
+        publish_mutation(keys[i], values[i], versions[i], 0);
+    }
+    publish_done(hashed, data);
     return 0;
 }
 
-/// Lê múltiplos pares chave-valor da tabela hash.
-/// Escreve os resultados no ficheiro especificado.
-int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, ThreadData *data) {
+// Lê múltiplos pares chave-valor da tabela hash para memória.
+int kvs_read_values(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], int *found, ThreadData *data) {
     if (kvs_table == NULL) {
         fprintf(stderr, "KVS state must be initialized\n");
         return 1;
@@ -86,26 +184,23 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, Thre
 
     int hashed[26] = {0}; // Verifica quais índices estão bloqueados para leitura
     for (size_t i = 0; i < num_pairs; i++) {
-        int index = hash(keys[i]);
-        if (hashed[index] == 0) {
-            pthread_rwlock_rdlock(&data->rwlock_array[index]);
-            hashed[index] = 1;
-        }
+        hashed[hash(keys[i])] = 1;
     }
+    lock_stripes(hashed, data, 0);
 
-    write(output_fd, "[", 1); 
+    int missing = 0;
     for (size_t i = 0; i < num_pairs; i++) {
         char *result = read_pair(kvs_table, keys[i]);
-        char buffer[MAX_STRING_SIZE];
         if (result == NULL) {
-            sprintf(buffer, "(%s,KVSERROR)", keys[i]); // Chave não encontrada
+            values[i][0] = '\0'; // Chave não encontrada
+            found[i] = 0;
+            missing = 1;
         } else {
-            sprintf(buffer, "(%s,%s)", keys[i], result); // Chave encontrada
+            snprintf(values[i], MAX_STRING_SIZE, "%s", result); // Chave encontrada
+            found[i] = 1;
             free(result); // Liberta a memória alocada
         }
-        write(output_fd, buffer, strlen(buffer));
     }
-    write(output_fd, "]\n", 2); 
 
     for (int i = 0; i < 26; i++) {
         if (hashed[i] == 1) {
@@ -114,11 +209,38 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, Thre
         }
     }
 
+    return missing;
+}
+
+/// Lê múltiplos pares chave-valor da tabela hash.
+/// Escreve os resultados no ficheiro especificado.
+int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, ThreadData *data) {
+    char values[num_pairs][MAX_STRING_SIZE];
+    int found[num_pairs];
+    if (kvs_table == NULL) {
+        fprintf(stderr, "KVS state must be initialized\n");
+        return 1;
+    }
+    kvs_read_values(num_pairs, keys, values, found, data);
+
+    write(output_fd, "[", 1); 
+    for (size_t i = 0; i < num_pairs; i++) {
+        char buffer[2 * MAX_STRING_SIZE + 4];
+        if (!found[i]) {
+            sprintf(buffer, "(%s,KVSERROR)", keys[i]); // Chave não encontrada
+        } else {
+            sprintf(buffer, "(%s,%s)", keys[i], values[i]); // Chave encontrada
+        }
+        write(output_fd, buffer, strlen(buffer));
+    }
+    write(output_fd, "]\n", 2); 
+
     return 0;
 }
 
-// Função que apaga pares chave-valor da tabela KVS
-int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, ThreadData *data) {
+// Função que apaga pares chave-valor da tabela KVS, indicando quais não existiam
+int kvs_delete_keys(size_t num_pairs, char keys[][MAX_STRING_SIZE], int *missing, uint64_t *versions,
+                    ThreadData *data) {
     if (kvs_table == NULL) {
         fprintf(stderr, "KVS state must be initialized\n");
         return 1; 
@@ -129,47 +251,73 @@ int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, Th
     // Lock de leitura para garantir consistência durante a verificação
     pthread_rwlock_rdlock(&data->rwlock);
     
-    // Verifica a posição de hash de cada chave e aplica o lock de escrita, se necessário
+    // Marca a posição de hash de cada chave e aplica o lock de escrita
     for (size_t i = 0; i < num_pairs; i++) {
-        int position = hash(keys[i]);
-        if (hashed[position] == 0) {
-            pthread_rwlock_wrlock(&data->rwlock_array[position]);
-            hashed[position] = 1;  // Marca a posição como bloqueada
-        }
+        hashed[hash(keys[i])] = 1;
     }
+    lock_stripes(hashed, data, 1);
 
     // Variável para controlar se há erro ao apagar chaves
     int has_error = 0;
     for (size_t i = 0; i < num_pairs; i++) {
         // Tenta apagar o par chave-valor
-        if (delete_pair(kvs_table, keys[i]) != 0) {
-            if (!has_error) {
-                write(output_fd, "[", 1);  // Escreve o parêntese de abertura apenas uma vez
-                has_error = 1;
-            }
-            // Se a chave não existir, escreve um erro no formato (key,KVSMISSING)
-            char buffer[MAX_STRING_SIZE];
-            sprintf(buffer, "(%s,KVSMISSING)", keys[i]);
-            write(output_fd, buffer, strlen(buffer));
+        if (delete_pair(kvs_table, keys[i]) == 0) {
+            wal_log_delete(keys[i]);
+            versions[i] = changelog_append(keys[i], "DELETED", 1);
+            missing[i] = 0;
+        } else {
+            missing[i] = 1;
+            versions[i] = 0;
+            has_error = 1;
         }
     }
 
-    // Fecha o parêntese de erro se houve falha ao apagar alguma chave
-    if (has_error) {
-        write(output_fd, "]\n", 2); 
-    }
-
     // Liberta os locks das posições que foram processadas
+    uint64_t tickets[TABLE_SIZE];
+    publish_ticket(hashed, tickets, data);
     for (int i = 0; i < TABLE_SIZE; i++) {
         if (hashed[i] == 1) {
             pthread_rwlock_unlock(&data->rwlock_array[i]);
-            hashed[i] = 0;  // Marca a posição como desbloqueada
         }
     }
     
     // Liberta o lock global após a operação de apagar pares chave-valor
     pthread_rwlock_unlock(&data->rwlock);
 
+    // As alterações são publicadas já sem os locks, na vez das senhas
+    publish_wait(hashed, tickets, data);
+    for (size_t i = 0; i < num_pairs; i++) {
+        if (missing[i] == 0) {
+            publish_mutation(keys[i], "DELETED", versions[i], 1);
+        }
+    }
+    publish_done(hashed, data);
+    return has_error;
+}
+
+// Função que apaga pares chave-valor da tabela KVS
+int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, ThreadData *data) {
+    int missing[num_pairs];
+    uint64_t versions[num_pairs];
+    if (kvs_table == NULL) {
+        fprintf(stderr, "KVS state must be initialized\n");
+        return 1; 
+    }
+    if (kvs_delete_keys(num_pairs, keys, missing, versions, data) == 0) {
+        return 0;
+    }
+
+    // Se alguma chave não existir, escreve um erro no formato [(key,KVSMISSING)...]
+    write(output_fd, "[", 1);
+    for (size_t i = 0; i < num_pairs; i++) {
+        if (missing[i]) {
+            char buffer[MAX_STRING_SIZE + 16];
+            sprintf(buffer, "(%s,KVSMISSING)", keys[i]);
+            write(output_fd, buffer, strlen(buffer));
+        }
+    }
+    write(output_fd, "]\n", 2); 
+
     return 0; 
 }
 
@@ -199,22 +347,192 @@ void kvs_show(int output_fd, ThreadData *data, int use_rwlock) {
     }
 }
 
-// Função que realiza o backup da tabela KVS para um arquivo de backup
-int kvs_backup(int backup, const char *output_dir, const char *job_name) {
-    // Cria o caminho para o arquivo de backup baseado no diretório de saída e nome do .job
-    char backup_output_path[MAX_JOB_FILE_NAME_SIZE];
-    snprintf(backup_output_path, MAX_JOB_FILE_NAME_SIZE, "%s/%.*s-%d.bck", output_dir, (int)(strlen(job_name) - 4), job_name, backup);
+// Formata os pares das posições [first, last) da tabela no formato do SHOW.
+// Devolve um buffer alocado (a libertar por quem chama) e o seu tamanho em *len.
+static char *format_buckets(int first, int last, size_t *len) {
+    size_t size = 1;
+    for (int i = first; i < last; i++) {
+        for (KeyNode *node = kvs_table->table[i]; node != NULL; node = node->next) {
+            size += strlen(node->key) + strlen(node->value) + 5;
+        }
+    }
+
+    char *buffer = malloc(size);
+    if (buffer == NULL) {
+        *len = 0;
+        return NULL;
+    }
+
+    size_t offset = 0;
+    buffer[0] = '\0';
+    for (int i = first; i < last; i++) {
+        for (KeyNode *node = kvs_table->table[i]; node != NULL; node = node->next) {
+            offset += (size_t)snprintf(buffer + offset, size - offset, "(%s, %s)\n", node->key, node->value);
+        }
+    }
+    *len = offset;
+    return buffer;
+}
+
+// Parte da tabela formatada por uma thread de backup
+typedef struct {
+    int first;     // Primeira posição da tabela
+    int last;      // Posição seguinte à última
+    char *buffer;  // Pares formatados
+    size_t len;    // Tamanho do buffer
+} BackupChunk;
+
+static void *thread_backup_chunk(void *arg) {
+    BackupChunk *chunk = (BackupChunk *)arg;
+    chunk->buffer = format_buckets(chunk->first, chunk->last, &chunk->len);
+
+    // Cada thread comprime a sua parte, para a compressão também ser paralela
+    if (chunk->buffer != NULL && compress_enabled()) {
+        size_t frame_len;
+        char *frame = compress_frame(chunk->buffer, chunk->len, &frame_len);
+        free(chunk->buffer);
+        chunk->buffer = frame;
+        chunk->len = frame_len;
+    }
+    return NULL;
+}
+
+// Abre o destino de um backup em streaming. Abrir um FIFO bloqueia até
+// haver um consumidor; um socket Unix é ligado em modo SOCK_STREAM.
+// Em ambos os casos as escritas bloqueiam enquanto o consumidor não lê.
+static int open_backup_target(const char *target) {
+    struct stat st;
+    if (stat(target, &st) != 0) {
+        perror("Erro ao abrir o destino do backup");
+        return -1;
+    }
+
+    if (S_ISFIFO(st.st_mode)) {
+        return open(target, O_WRONLY);
+    }
+
+    if (S_ISSOCK(st.st_mode)) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(target) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Backup socket path too long: %s\n", target);
+            return -1;
+        }
+        strcpy(addr.sun_path, target);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            perror("Erro ao ligar ao socket do backup");
+            if (fd != -1) {
+                close(fd);
+            }
+            return -1;
+        }
+        return fd;
+    }
+
+    fprintf(stderr, "Backup target %s is not a FIFO or socket\n", target);
+    return -1;
+}
+
+// Função que realiza o backup da tabela KVS para um arquivo de backup.
+// Corre no processo filho, que tem uma cópia estável da tabela, por isso
+// a tabela é dividida em BACKUP_THREADS partes formatadas em paralelo e
+// escritas por ordem com uma única escrita por parte.
+int kvs_backup(int backup, const char *output_dir, const char *job_name, const char *target) {
+    int backup_fd;
+    if (target != NULL) {
+        // Se o consumidor desaparecer, a escrita falha com EPIPE em vez de matar o filho
+        signal(SIGPIPE, SIG_IGN);
+        backup_fd = open_backup_target(target);
+        if (backup_fd == -1) {
+            return -1;
+        }
+    } else {
+        // Cria o caminho para o arquivo de backup baseado no diretório de saída e nome do .job
+        char backup_output_path[MAX_JOB_FILE_NAME_SIZE];
+        snprintf(backup_output_path, MAX_JOB_FILE_NAME_SIZE, "%s/%.*s-%d.bck", output_dir, (int)(strlen(job_name) - 4), job_name, backup);
+
+        // Abre o arquivo de backup para escrita
+        backup_fd = open(backup_output_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+        if (backup_fd == -1) {
+            perror("Erro ao abrir o ficheiro de backup");
+            return -1;  // Retorna erro se o arquivo não puder ser aberto
+        }
+    }
+
+    if (compress_write_header(backup_fd) != 1) {
+        close(backup_fd);
+        return -1;
+    }
+
+    BackupChunk chunks[BACKUP_THREADS];
+    pthread_t threads[BACKUP_THREADS];
+    int started[BACKUP_THREADS] = {0};
+    for (int i = 0; i < BACKUP_THREADS; i++) {
+        chunks[i].first = i * TABLE_SIZE / BACKUP_THREADS;
+        chunks[i].last = (i + 1) * TABLE_SIZE / BACKUP_THREADS;
+        chunks[i].buffer = NULL;
+        // Se não for possível criar a thread, a parte é formatada por esta
+        if (pthread_create(&threads[i], NULL, thread_backup_chunk, &chunks[i]) == 0) {
+            started[i] = 1;
+        } else {
+            thread_backup_chunk(&chunks[i]);
+        }
+    }
 
-    // Abre o arquivo de backup para escrita
-    int backup_fd = open(backup_output_path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
-    if (backup_fd == -1) {
-        perror("Erro ao abrir o ficheiro de backup");
-        return -1;  // Retorna erro se o arquivo não puder ser aberto
+    // Cada parte é escrita assim que está pronta, pela ordem da tabela
+    int result = 0;
+    for (int i = 0; i < BACKUP_THREADS; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        }
+        if (chunks[i].buffer == NULL) {
+            result = -1;
+            continue;
+        }
+        if (result == 0 && chunks[i].len > 0 && write_all(backup_fd, chunks[i].buffer, chunks[i].len) != 1) {
+            result = -1;
+        }
+        free(chunks[i].buffer);
     }
-    kvs_show(backup_fd, NULL, 0);
     close(backup_fd);
 
-    return 0;
+    return result;
+}
+
+// Função que escreve um checkpoint da tabela sem bloquear as escritas:
+// cada posição é copiada com o seu lock de leitura e escrita fora dele.
+// O resultado pode misturar estados, mas a reposição do log a partir da
+// posição registada converge sempre para o estado final correto.
+int kvs_checkpoint(ThreadData *data) {
+    unsigned long lsn;
+    int fd = wal_checkpoint_begin(&lsn);
+    if (fd == -1) {
+        return 1;
+    }
+
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        size_t len;
+        pthread_rwlock_rdlock(&data->rwlock_array[i]);
+        char *buffer = format_buckets(i, i + 1, &len);
+        pthread_rwlock_unlock(&data->rwlock_array[i]);
+
+        if (buffer == NULL) {
+            close(fd);
+            return 1;
+        }
+        // A compressão é feita fora do lock
+        int result = compress_write(fd, buffer, len);
+        free(buffer);
+        if (result != 1) {
+            close(fd);
+            return 1;
+        }
+    }
+
+    return wal_checkpoint_end(fd);
 }
 
 // Função que aguarda um atraso especificado (em milissegundos)
@@ -223,35 +541,130 @@ void kvs_wait(unsigned int delay_ms) {
     nanosleep(&delay, NULL);  
 }
 
-int kvs_subscribe(const char *key, int fd, ThreadData *data) {
+int kvs_subscribe(const char *key, int subscriber, const uint64_t *since, ResumeFn resume,
+                  char *value, uint64_t *version, ThreadData *data) {
     if (kvs_table == NULL) {
         fprintf(stderr, "KVS state must be initialized\n");
         return 1;
     }
     
+    // Só se subscrevem chaves que existem. O lock de leitura impede que a
+    // chave seja alterada ou apagada entre a leitura do valor e o registo da
+    // subscrição, e que uma alteração nova chegue antes das recuperadas.
+    // Espera que as escritas anteriores da chave sejam publicadas, para
+    // nenhuma chegar também como alteração recuperada. Com o lock de leitura
+    // não saem senhas novas, por isso só espera pelas que já saíram; é a
+    // subscrição que espera, e as escritas do índice esperam por ela.
     int index = hash(key);
-    pthread_rwlock_wrlock(&data->rwlock_array[index]);
+    pthread_rwlock_rdlock(&data->rwlock_array[index]);
+    pthread_mutex_lock(&data->publish_mutex);
+    while (data->publish_turn[index] != data->publish_next[index]) {
+        pthread_cond_wait(&data->publish_cond, &data->publish_mutex);
+    }
+    pthread_mutex_unlock(&data->publish_mutex);
+
+    int result = 1;
+    char *current = read_versioned_pair(kvs_table, key, version);
+    if (current != NULL) {
+        snprintf(value, MAX_STRING_SIZE, "%s", current);
+        free(current);
+        if (*version == 0) {
+            *version = changelog_start();  // Recuperada do WAL
+        }
+        result = subscriptions_add(key, subscriber);
+    }
+
+    // As alterações perdidas entram na fila de notificações antes de
+    // qualquer outra da chave. Se já não estiverem todas no registo (ou não
+    // couberem no espaço livre da fila), fica só o valor atual.
+    if (result == 0 && since != NULL) {
+        Change changes[NOTIF_QUEUE_SIZE];
+        long count = changelog_since(key, *since, changes, NOTIF_QUEUE_SIZE);
+        if (count == -1 || (count > 0 && resume(subscriber, changes, (size_t)count) != 0)) {
+            result = 2;
+        }
+    }
 
-    int result = add_subscriber(kvs_table, key, fd);
-    
     pthread_rwlock_unlock(&data->rwlock_array[index]);
-    
+
     return result;
 }
 
-int kvs_unsubscribe(const char *key, int fd, ThreadData *data) {
+int kvs_subscribe_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results, ThreadData *data) {
     if (kvs_table == NULL) {
         fprintf(stderr, "KVS state must be initialized\n");
         return 1;
     }
 
-    int index = hash(key);
-    pthread_rwlock_wrlock(&data->rwlock_array[index]);
+    // Como em kvs_subscribe, os locks de leitura impedem que uma chave seja
+    // apagada entre a verificação e o registo; cada índice só é bloqueado uma vez
+    int hashed[26] = {0};
+    for (size_t i = 0; i < num_keys; i++) {
+        hashed[hash(keys[i])] = 1;
+    }
+    lock_stripes(hashed, data, 0);
+
+    // Só as chaves que existem são registadas, todas de uma vez
+    char present[num_keys][MAX_STRING_SIZE];
+    size_t position[num_keys];
+    int added[num_keys];
+    size_t num_present = 0;
+    for (size_t i = 0; i < num_keys; i++) {
+        char *current = read_pair(kvs_table, keys[i]);
+        results[i] = 1;
+        if (current != NULL) {
+            free(current);
+            memcpy(present[num_present], keys[i], MAX_STRING_SIZE);
+            position[num_present++] = i;
+        }
+    }
+    int failed = num_present < num_keys;
+    if (num_present > 0) {
+        failed |= subscriptions_add_keys(num_present, present, subscriber, added);
+        for (size_t i = 0; i < num_present; i++) {
+            results[position[i]] = added[i];
+        }
+    }
+
+    for (int i = 0; i < 26; i++) {
+        if (hashed[i] == 1) {
+            pthread_rwlock_unlock(&data->rwlock_array[i]);
+        }
+    }
 
-    int result = remove_subscriber(kvs_table, key, fd);
+    return failed;
+}
 
-    pthread_rwlock_unlock(&data->rwlock_array[index]);
+int kvs_subscribe_pattern(const char *pattern, int subscriber, ThreadData *data) {
+    if (kvs_table == NULL) {
+        fprintf(stderr, "KVS state must be initialized\n");
+        return 1;
+    }
 
-    return result;
+    // Um padrão pode apanhar chaves que ainda não existem, por isso não se
+    // consulta a tabela
+    (void)data;
+    return subscriptions_add_pattern(pattern, subscriber);
+}
+
+int kvs_unsubscribe(const char *key, int subscriber, ThreadData *data) {
+    if (kvs_table == NULL) {
+        fprintf(stderr, "KVS state must be initialized\n");
+        return 1;
+    }
+
+    // As subscrições não estão na tabela, por isso não é preciso o seu lock
+    (void)data;
+    return subscriptions_remove(key, subscriber);
+}
+
+int kvs_unsubscribe_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results, ThreadData *data) {
+    if (kvs_table == NULL) {
+        fprintf(stderr, "KVS state must be initialized\n");
+        return 1;
+    }
+
+    (void)data;
+    return subscriptions_remove_keys(num_keys, keys, subscriber, results);
 }
 
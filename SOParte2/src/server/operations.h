@@ -3,6 +3,8 @@
 
 #include <stddef.h>
 #include "kvs.h"
+#include "subscriptions.h"
+#include "changelog.h"
 #include "constants.h"
 
 
@@ -10,10 +12,25 @@
 /// @return 0 se o KVS foi inicializado com sucesso, 1 caso contrário.
 int kvs_init();
 
+/// Ativa o WAL, reconstruindo o estado a partir do último checkpoint e do log.
+/// @param wal_dir Diretoria onde ficam os segmentos do log e o checkpoint.
+/// @return 0 se o WAL foi ativado com sucesso, 1 caso contrário.
+int kvs_wal_init(const char *wal_dir);
+
 /// Destroys the KVS state.
 /// @return 0 se o KVS foi terminado com sucesso, 1 caso contrário.
 int kvs_terminate();
 
+/// Recebe cada escrita ou remoção, já aplicada e sem os locks das chaves.
+/// As alterações de chaves diferentes podem chegar fora da ordem das versões.
+typedef void (*MutationFn)(const char *key, const char *value, uint64_t version, int deleted);
+
+/// Junta uma função às que recebem as alterações do KVS. Deve ser chamada no
+/// arranque, antes de haver escritas.
+/// @param hook Função a chamar.
+/// @return 0 em caso de sucesso, 1 se já houver MUTATION_HOOKS funções.
+int kvs_add_mutation_hook(MutationFn hook);
+
 /// Escreve um par chave valor no KVS. Se a chave já existe o valor é atualizado.
 /// @param num_pairs Número de pares a ser escrito.
 /// @param keys Array das chaves.
@@ -22,6 +39,11 @@ int kvs_terminate();
 /// @return 0 se o KVS escreveu com sucesso, 1 caso contrário.
 int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], ThreadData *data);
 
+/// Como kvs_write, guardando a versão atribuída a cada par.
+/// @param versions Onde guardar as versões, uma por par.
+int kvs_write_versioned(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE],
+                        uint64_t *versions, ThreadData *data);
+
 /// Lê valores do KVS.
 /// @param num_pairs Número de pares a ler.
 /// @param keys Array de chaves.
@@ -30,6 +52,15 @@ int kvs_write(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_
 /// @return 0 se o KVS leu com sucesso, 1 caso contrário.
 int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, ThreadData *data);
 
+/// Lê valores do KVS para memória, para serem devolvidos a um cliente.
+/// @param num_pairs Número de pares a ler.
+/// @param keys Array de chaves.
+/// @param values Onde guardar os valores lidos (vazio se a chave não existir).
+/// @param found Onde guardar, por chave, 1 se existir e 0 caso contrário.
+/// @param data Estrutura thread que faz a operação
+/// @return 0 se todas as chaves existiam, 1 caso contrário.
+int kvs_read_values(size_t num_pairs, char keys[][MAX_STRING_SIZE], char values[][MAX_STRING_SIZE], int *found, ThreadData *data);
+
 /// Apagar valores do KVS.
 /// @param num_pairs Número de pares a apagar.
 /// @param keys Array de chaves.
@@ -37,18 +68,73 @@ int kvs_read(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, Thre
 /// @return 0 se o KVS apagou com sucesso, 1 caso contrário.
 int kvs_delete(size_t num_pairs, char keys[][MAX_STRING_SIZE], int output_fd, ThreadData *data);
 
+/// Apaga valores do KVS, indicando quais das chaves não existiam.
+/// @param num_pairs Número de pares a apagar.
+/// @param keys Array de chaves.
+/// @param missing Onde guardar, por chave, 1 se não existir e 0 se foi apagada.
+/// @param versions Onde guardar, por chave, a versão da remoção (0 se não existir).
+/// @param data Estrutura thread que faz a operação
+/// @return 0 se todas as chaves foram apagadas, 1 caso contrário.
+int kvs_delete_keys(size_t num_pairs, char keys[][MAX_STRING_SIZE], int *missing, uint64_t *versions,
+                    ThreadData *data);
+
 /// Escreve o estado do KVS.
 /// @param output_fd Ficheiro ao qual escrever o estado do KVS.
 void kvs_show(int output_fd, ThreadData *data, int use_rwlock);
 
 
-int kvs_backup(int backup, const char *output_dir, const char *job_name);
+/// Escreve o estado do KVS num ficheiro .bck ou num consumidor externo.
+/// @param backup Número do backup, usado no nome do ficheiro.
+/// @param output_dir Diretoria onde escrever o ficheiro.
+/// @param job_name Nome do .job que pediu o backup.
+/// @param target Caminho de um FIFO ou socket Unix, ou NULL para usar um ficheiro.
+/// @return 0 se o backup foi escrito com sucesso, -1 caso contrário.
+int kvs_backup(int backup, const char *output_dir, const char *job_name, const char *target);
+
+/// Escreve um checkpoint do KVS e trunca os segmentos do WAL que cobre.
+/// @param data Estrutura com os locks da tabela.
+/// @return 0 se o checkpoint foi escrito com sucesso, 1 caso contrário.
+int kvs_checkpoint(ThreadData *data);
+
 /// Espera um determinado tempo.
 /// @param delay_us Delay em millisegundos.
 void kvs_wait(unsigned int delay_ms);
 
 
-int kvs_subscribe(const char *key, int fd, ThreadData *data);
-int kvs_unsubscribe(const char *key, int fd, ThreadData *data);
+/// Entrega ao subscritor as alterações de uma subscrição retomada, todas ou
+/// nenhuma.
+/// @return 0 se ficaram todas na fila de notificações, 1 se não cabem no
+/// espaço livre da fila.
+typedef int (*ResumeFn)(int subscriber, const Change *changes, size_t count);
+
+/// Subscreve uma chave existente e devolve o seu valor e versão atuais, lidos
+/// de forma atómica com o registo da subscrição.
+/// @param since Se não for NULL, as alterações da chave depois desta versão
+/// são entregues ao subscritor antes de qualquer outra.
+/// @param resume Função que entrega essas alterações.
+/// @param value Onde guardar o valor atual (MAX_STRING_SIZE bytes).
+/// @param version Onde guardar a versão do valor atual.
+/// @return 0 em caso de sucesso, 1 se a chave não existe ou já estava
+/// subscrita, 2 se ficou subscrita mas as alterações depois de since já
+/// não estão no registo ou não cabem na fila de notificações.
+int kvs_subscribe(const char *key, int subscriber, const uint64_t *since, ResumeFn resume,
+                  char *value, uint64_t *version, ThreadData *data);
+int kvs_subscribe_pattern(const char *pattern, int subscriber, ThreadData *data);
+int kvs_unsubscribe(const char *key, int subscriber, ThreadData *data);
+
+/// Subscreve várias chaves num só passo, sem devolver os seus valores.
+/// @param num_keys Número de chaves.
+/// @param keys Array de chaves.
+/// @param results Onde guardar, por chave, 0 se ficou subscrita e 1 se não
+/// existe ou já estava subscrita.
+/// @param data Estrutura thread que faz a operação
+/// @return 0 se todas ficaram subscritas, 1 caso contrário.
+int kvs_subscribe_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results, ThreadData *data);
+
+/// Cancela várias subscrições num só passo.
+/// @param results Onde guardar, por chave, 0 se foi cancelada e 1 se não
+/// estava subscrita.
+/// @return 0 se todas foram canceladas, 1 caso contrário.
+int kvs_unsubscribe_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results, ThreadData *data);
 
 #endif  // KVS_OPERATIONS_H
@@ -136,6 +136,9 @@ enum Command get_next(int fd) {
       }
 
       if (read(fd, buf + 6, 1) != 0 && buf[6] != '\n') {
+        if (buf[6] == ' ') {
+          return CMD_BACKUP_TO;
+        }
         cleanup(fd);
         return CMD_INVALID;
       }
@@ -294,3 +297,19 @@ int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id) {
     return -1;
   }
 }
+
+int parse_backup_target(int fd, char *path, size_t max) {
+  size_t i = 0;
+  char ch;
+
+  while (read(fd, &ch, 1) == 1 && ch != '\n') {
+    if (i + 1 >= max) {
+      cleanup(fd);
+      return -1;
+    }
+    path[i++] = ch;
+  }
+  path[i] = '\0';
+
+  return i > 0 ? 0 : -1;
+}
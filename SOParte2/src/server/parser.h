@@ -11,6 +11,7 @@ enum Command {
   CMD_SHOW,
   CMD_WAIT,
   CMD_BACKUP,
+  CMD_BACKUP_TO,
   CMD_HELP,
   CMD_EMPTY,
   CMD_INVALID,
@@ -46,4 +47,11 @@ size_t parse_read_delete(int fd, char keys[][MAX_STRING_SIZE], size_t max_keys,
 /// @return 0 se nenhuma thread foi especificada, 1 se uma thread foi especificada, -1 em caso de erro.
 int parse_wait(int fd, unsigned int *delay, unsigned int *thread_id);
 
+/// Lê o destino de um comando BACKUP <caminho>
+/// @param fd Ficheiro ao qual se lê o comando.
+/// @param path Buffer onde guardar o caminho do FIFO ou socket.
+/// @param max Tamanho do buffer.
+/// @return 0 se o caminho foi lido com sucesso, -1 caso contrário.
+int parse_backup_target(int fd, char *path, size_t max);
+
 #endif  // KVS_PARSER_H
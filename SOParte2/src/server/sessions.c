@@ -0,0 +1,1197 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+
+#include "sessions.h"
+#include "operations.h"
+#include "constants.h"
+#include "src/common/constants.h"
+#include "src/common/io.h"
+#include "src/common/mpmc.h"
+#include "src/common/protocol.h"
+
+// Pedido lido por uma thread de I/O, à espera de um worker
+typedef struct {
+    Session *session;
+    struct timespec queued_at;  // Para medir o tempo de espera na fila
+    FrameHeader header;
+    char payload[FRAME_MAX_PAYLOAD];
+} Work;
+
+// Métricas da fila e dos workers, reportadas com SIGUSR2
+typedef struct {
+    _Atomic unsigned long requests;        // Pedidos executados
+    _Atomic unsigned long full_waits;      // Vezes que uma thread de I/O esperou por espaço
+    _Atomic unsigned long max_depth;       // Maior ocupação da fila
+    _Atomic unsigned long wait_ns_total;   // Tempo total de espera na fila
+    _Atomic unsigned long wait_ns_max;
+    _Atomic unsigned long service_ns_total; // Tempo total de execução nos workers
+    _Atomic unsigned long service_ns_max;
+} Metrics;
+
+// Resultado de um pedido, para o worker saber o que fazer à sessão
+enum {
+    REQUEST_DONE,    // Volta a vigiar o pipe de pedidos
+    REQUEST_CLOSED,  // O cliente desligou-se
+    REQUEST_SHM,     // Os próximos pedidos chegam pela memória partilhada
+};
+
+// Eventos do epoll: índice da sessão, seguido do descritor que ficou pronto
+#define EVENT_REQUEST 0
+#define EVENT_NOTIF 1
+#define EVENT_TIMER 2
+#define EVENT_KIND_BITS 2
+
+// Tramas de notificação escritas por cada writev: um pipe escreve de forma
+// atómica até PIPE_BUF bytes, por isso um lote nunca fica a meio. Cada trama
+// tem 8 bytes de cabeçalho, a chave e o valor (41 cada) e a versão (8), ou
+// seja 98 bytes: com o PIPE_BUF de 4096 do Linux são 41 por lote, o batch=
+// do relatório do SIGUSR2.
+#define NOTIF_FRAME_SIZE (FRAME_HEADER_SIZE + NOTIFICATION_PAYLOAD_SIZE)
+#define NOTIF_BATCH (PIPE_BUF / NOTIF_FRAME_SIZE)
+
+static ThreadData *store_data;
+static int shm_enabled = 0;
+static int notif_policy = NOTIF_POLICY_DEFAULT;
+static uint64_t notif_flush_ns = (uint64_t)NOTIF_FLUSH_DELAY_US_DEFAULT * 1000u;
+static int null_fd;  // Substitui o pipe de notificações de um cliente desligado
+
+// Notificações que não chegaram aos clientes
+static _Atomic unsigned long notif_dropped;
+static _Atomic unsigned long notif_coalesced;
+static _Atomic unsigned long notif_disconnects;
+// Notificações enviadas e escritas feitas para as enviar
+static _Atomic unsigned long notif_sent;
+static _Atomic unsigned long notif_writes;
+
+static Session *sessions;
+static int session_capacity;
+static pthread_mutex_t sessions_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sem_t SEM_SESSION_SLOTS;  // Vagas livres para sessões
+
+// Cada thread de I/O tem o seu epoll; a sessão na posição i é vigiada
+// pela thread i % io_thread_count
+static int *epoll_fds;
+static int io_thread_count;
+static int worker_count;
+
+// Fila limitada entre as threads de I/O e os workers, sem locks. Os
+// WORK_QUEUE_SIZE pedidos são reservados no arranque e circulam entre
+// work_free e work_ready; quando acabam, as threads de I/O deixam de ler
+// pedidos até um worker devolver um.
+static Work *work_pool;
+static MpmcQueue work_free;
+static MpmcQueue work_ready;
+
+static Metrics metrics;
+
+static unsigned long elapsed_ns(const struct timespec *start, const struct timespec *end) {
+    return (unsigned long)((end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec));
+}
+
+static void metric_max(_Atomic unsigned long *max, unsigned long value) {
+    unsigned long current = atomic_load_explicit(max, memory_order_relaxed);
+    while (value > current &&
+           !atomic_compare_exchange_weak_explicit(max, &current, value, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+// Reserva um pedido livre para a thread de I/O ler a trama diretamente
+static Work *work_get(void) {
+    void *work;
+    if (!mpmc_try_pop(&work_free, &work)) {
+        atomic_fetch_add_explicit(&metrics.full_waits, 1, memory_order_relaxed);
+        work = mpmc_pop(&work_free);
+    }
+    return work;
+}
+
+static void work_push(Work *work) {
+    clock_gettime(CLOCK_MONOTONIC, &work->queued_at);
+    // Nunca espera: work_ready tem lugar para todos os pedidos
+    mpmc_push(&work_ready, work);
+    metric_max(&metrics.max_depth, mpmc_size(&work_ready));
+}
+
+static Work *work_pop(void) {
+    struct timespec now;
+    Work *work = mpmc_pop(&work_ready);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long waited = elapsed_ns(&work->queued_at, &now);
+    atomic_fetch_add_explicit(&metrics.wait_ns_total, waited, memory_order_relaxed);
+    metric_max(&metrics.wait_ns_max, waited);
+    return work;
+}
+
+static void work_done(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    unsigned long service = elapsed_ns(start, &now);
+
+    atomic_fetch_add_explicit(&metrics.requests, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.service_ns_total, service, memory_order_relaxed);
+    metric_max(&metrics.service_ns_max, service);
+}
+
+static uint64_t event_data(Session *session, int kind) {
+    return (uint64_t)(session - sessions) << EVENT_KIND_BITS | (uint64_t)kind;
+}
+
+static int session_epoll(Session *session) {
+    return epoll_fds[(int)(session - sessions) % io_thread_count];
+}
+
+// Volta a vigiar o pipe de pedidos da sessão depois de o pedido estar tratado
+static int session_arm(Session *session, int op) {
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLONESHOT;
+    event.data.u64 = event_data(session, EVENT_REQUEST);
+    return epoll_ctl(session_epoll(session), op, session->req_fd, &event);
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// Arma o timerfd da sessão para o instante due, se ainda não estiver armado
+// para antes. O timerfd é criado na primeira vez e fica no epoll da thread
+// de I/O da sessão. Chamada com notif_mutex.
+static void timer_schedule(Session *session, uint64_t due) {
+    if (session->timer_due != 0 && session->timer_due <= due) {
+        return;
+    }
+    if (session->timer_fd == -1) {
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = event_data(session, EVENT_TIMER);
+        if (fd == -1 || epoll_ctl(session_epoll(session), EPOLL_CTL_ADD, fd, &event) != 0) {
+            perror("Failed to create notification timer");
+            if (fd != -1) {
+                close(fd);
+            }
+            return;
+        }
+        session->timer_fd = fd;
+    }
+
+    struct itimerspec spec = {{0, 0}, {(time_t)(due / 1000000000u), (long)(due % 1000000000u)}};
+    if (timerfd_settime(session->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0) {
+        session->timer_due = due;
+    }
+}
+
+// Escreve as notificações em fila até o pipe encher, em lotes de até
+// NOTIF_BATCH tramas com um só writev. Cada lote é escrito inteiro ou não é
+// escrito. Num socket cada trama é uma mensagem, por isso segue uma a uma.
+// Depois de notificações descartadas, a primeira enviada leva o estado
+// NOTIFICATION_LOST. Chamada com notif_mutex.
+// @return 1 se ficaram notificações por enviar, 0 caso contrário.
+static int notif_drain(Session *session) {
+    // Todas as notificações têm o mesmo cabeçalho
+    char header[FRAME_HEADER_SIZE];
+    char lost_header[FRAME_HEADER_SIZE];
+    encode_frame_header(header, OP_CODE_NOTIFICATION, 0, 0, NOTIFICATION_PAYLOAD_SIZE);
+    encode_frame_header(lost_header, OP_CODE_NOTIFICATION, NOTIFICATION_LOST, 0, NOTIFICATION_PAYLOAD_SIZE);
+    struct iovec iov[2 * NOTIF_BATCH];
+
+    session->notif_flush_due = 0;
+    while (session->notif_count > 0) {
+        int batch = session->packet ? 1 : session->notif_count < NOTIF_BATCH ? session->notif_count : NOTIF_BATCH;
+        for (int i = 0; i < batch; i++) {
+            iov[2 * i].iov_base = i == 0 && session->notif_lost ? lost_header : header;
+            iov[2 * i].iov_len = FRAME_HEADER_SIZE;
+            iov[2 * i + 1].iov_base = session->notif_queue[(session->notif_head + i) % NOTIF_QUEUE_SIZE];
+            iov[2 * i + 1].iov_len = NOTIFICATION_PAYLOAD_SIZE;
+        }
+
+        ssize_t written;
+        if (session->packet) {
+            struct msghdr message = {0};
+            message.msg_iov = iov;
+            message.msg_iovlen = 2;
+            written = sendmsg(session->notif_fd, &message, MSG_DONTWAIT);
+        } else {
+            written = writev(session->notif_fd, iov, 2 * batch);
+        }
+        if (written == -1 && errno == EINTR) {
+            continue;
+        }
+        if (written == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return 1;
+        }
+        // Noutros erros o cliente fechou o pipe e as notificações perdem-se
+        if (written != -1) {
+            atomic_fetch_add(&notif_sent, (unsigned long)batch);
+            atomic_fetch_add(&notif_writes, 1);
+            session->notif_lost = 0;
+        }
+        session->notif_head = (session->notif_head + batch) % NOTIF_QUEUE_SIZE;
+        session->notif_count -= batch;
+    }
+    return 0;
+}
+
+// Pede ao epoll da thread de I/O da sessão que avise quando o pipe de
+// notificações tiver espaço. Chamada com notif_mutex.
+static void notif_arm(Session *session) {
+    struct epoll_event event;
+    event.events = EPOLLOUT | EPOLLONESHOT;
+    event.data.u64 = event_data(session, EVENT_NOTIF);
+    int op = session->notif_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(session_epoll(session), op, session->notif_fd, &event) != 0) {
+        // As notificações ficam na fila até à próxima
+        perror("Failed to watch notification pipe");
+        return;
+    }
+    session->notif_registered = 1;
+    session->notif_armed = 1;
+}
+
+// Chamada pela thread de I/O quando o pipe de notificações tem espaço
+static void notif_writable(Session *session) {
+    pthread_mutex_lock(&session->notif_mutex);
+    if (session->notif_armed) {
+        session->notif_armed = 0;
+        if (notif_drain(session)) {
+            notif_arm(session);
+        }
+    }
+    pthread_mutex_unlock(&session->notif_mutex);
+}
+
+// Desliga um cliente que não acompanha as notificações. Fechar o pipe de
+// notificações (ou o socket) avisa o cliente; a sessão termina no próximo
+// pedido. Chamada com notif_mutex.
+static void notif_evict(Session *session) {
+    atomic_fetch_add(&notif_dropped, (unsigned long)session->notif_count + 1);
+    atomic_fetch_add(&notif_disconnects, 1);
+    session->notif_open = 0;
+    session->notif_count = 0;
+    session->notif_armed = 0;
+    atomic_store(&session->notif_evicted, 1);
+    if (session->packet) {
+        shutdown(session->notif_fd, SHUT_RDWR);
+    } else {
+        // O descritor continua válido até session_close
+        dup2(null_fd, session->notif_fd);
+    }
+}
+
+// Substitui o valor da notificação por enviar mais recente da mesma chave,
+// para o último valor chegar em último. Chamada com notif_mutex.
+// @return 1 se havia uma notificação da chave na fila, 0 caso contrário.
+static int notif_coalesce(Session *session, const char *payload) {
+    for (int i = session->notif_count - 1; i >= 0; i--) {
+        char *queued = session->notif_queue[(session->notif_head + i) % NOTIF_QUEUE_SIZE];
+        if (memcmp(queued, payload, KEY_FIELD_SIZE) == 0) {
+            memcpy(queued + KEY_FIELD_SIZE, payload + KEY_FIELD_SIZE, NOTIFICATION_PAYLOAD_SIZE - KEY_FIELD_SIZE);
+            atomic_fetch_add(&notif_coalesced, 1);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Trata uma notificação que não cabe na fila cheia, segundo notif_policy.
+// Chamada com notif_mutex.
+// @return 1 se a notificação deve entrar na fila, 0 caso contrário.
+static int notif_overflow(Session *session, const char *payload) {
+    if (notif_policy == NOTIF_DISCONNECT) {
+        notif_evict(session);
+        return 0;
+    }
+    if (notif_policy == NOTIF_COALESCE && notif_coalesce(session, payload)) {
+        return 0;
+    }
+    // Sem notificação da mesma chave, descarta a mais antiga
+    session->notif_head = (session->notif_head + 1) % NOTIF_QUEUE_SIZE;
+    session->notif_count--;
+    session->notif_lost = 1;
+    atomic_fetch_add(&notif_dropped, 1);
+    return 1;
+}
+
+// Põe uma notificação na fila e tenta enviá-la. Chamada com notif_mutex.
+// @param coalesce 1 para só atualizar o valor se a chave já estiver na fila.
+static void notif_enqueue(Session *session, const char *payload, int coalesce) {
+    if (coalesce && notif_coalesce(session, payload)) {
+        return;
+    }
+    if (session->notif_count == NOTIF_QUEUE_SIZE && !notif_overflow(session, payload)) {
+        return;
+    }
+    int tail = (session->notif_head + session->notif_count) % NOTIF_QUEUE_SIZE;
+    memcpy(session->notif_queue[tail], payload, NOTIFICATION_PAYLOAD_SIZE);
+    session->notif_count++;
+    // Se o epoll já espera por espaço, é a thread de I/O que envia
+    if (session->notif_armed) {
+        return;
+    }
+    // Com atraso, as notificações juntam-se num lote até ao timer ou até
+    // encherem uma escrita
+    if (notif_flush_ns > 0 && session->notif_count < NOTIF_BATCH) {
+        if (session->notif_flush_due == 0) {
+            session->notif_flush_due = monotonic_ns() + notif_flush_ns;
+            timer_schedule(session, session->notif_flush_due);
+        }
+        return;
+    }
+    if (notif_drain(session)) {
+        notif_arm(session);
+    }
+}
+
+// Opções da subscrição de uma chave, NULL se não tiver. Chamada com notif_mutex.
+static SubscriptionOptions *find_options(Session *session, const char *key) {
+    for (size_t i = 0; i < session->sub_count; i++) {
+        if (strcmp(session->sub_options[i].key, key) == 0) {
+            return &session->sub_options[i];
+        }
+    }
+    return NULL;
+}
+
+// Esquece as opções de uma subscrição, e a notificação que estivesse retida.
+// Chamada com notif_mutex.
+static void forget_options(Session *session, SubscriptionOptions *options) {
+    *options = session->sub_options[--session->sub_count];
+}
+
+// Aplica o ritmo máximo da subscrição. Uma notificação que chega antes do
+// fim do intervalo fica retida (substituindo a anterior) até ao timer.
+// Chamada com notif_mutex.
+// @return 1 se a notificação pode seguir já para a fila, 0 se ficou retida.
+static int options_admit(Session *session, SubscriptionOptions *options, const char *payload) {
+    if (options->interval_ns == 0) {
+        return 1;
+    }
+    uint64_t now = monotonic_ns();
+    if (!options->held && now >= options->next_ns) {
+        options->next_ns = now + options->interval_ns;
+        return 1;
+    }
+    if (options->held) {
+        atomic_fetch_add(&notif_coalesced, 1);
+    }
+    memcpy(options->held_payload, payload, NOTIFICATION_PAYLOAD_SIZE);
+    options->held = 1;
+    timer_schedule(session, options->next_ns);
+    return 0;
+}
+
+// Chamada pela thread de I/O quando o timer expira: envia as notificações
+// retidas cujo intervalo terminou e o lote à espera do atraso de envio, e
+// volta a armar o timer para o que falta
+static void timer_expired(Session *session) {
+    pthread_mutex_lock(&session->notif_mutex);
+    if (session->timer_fd != -1) {
+        // Limpa o evento; falha com EAGAIN se o timer foi entretanto rearmado
+        uint64_t expirations;
+        ssize_t cleared = read(session->timer_fd, &expirations, sizeof(expirations));
+        (void)cleared;
+        session->timer_due = 0;
+
+        uint64_t now = monotonic_ns();
+        uint64_t next = 0;
+        for (size_t i = 0; i < session->sub_count; i++) {
+            SubscriptionOptions *options = &session->sub_options[i];
+            if (!options->held) {
+                continue;
+            }
+            if (options->next_ns <= now) {
+                options->held = 0;
+                options->next_ns = now + options->interval_ns;
+                if (session->notif_open) {
+                    notif_enqueue(session, options->held_payload, options->coalesce);
+                }
+            } else if (next == 0 || options->next_ns < next) {
+                next = options->next_ns;
+            }
+        }
+
+        if (session->notif_flush_due != 0 && session->notif_flush_due <= now) {
+            if (!session->notif_armed && notif_drain(session)) {
+                notif_arm(session);
+            }
+        } else if (session->notif_flush_due != 0 && (next == 0 || session->notif_flush_due < next)) {
+            next = session->notif_flush_due;
+        }
+        if (next != 0) {
+            timer_schedule(session, next);
+        }
+    }
+    pthread_mutex_unlock(&session->notif_mutex);
+}
+
+// Guarda as opções de uma subscrição antes de a registar, para valerem logo
+// para a primeira notificação, ou esquece-as se a subscrição não tiver
+// opções, falhar ou tiver terminado
+static void session_set_options(Session *session, const char *key, int coalesce, unsigned int max_rate) {
+    pthread_mutex_lock(&session->notif_mutex);
+    SubscriptionOptions *options = find_options(session, key);
+    if (!coalesce && max_rate == 0) {
+        if (options != NULL) {
+            forget_options(session, options);
+        }
+        pthread_mutex_unlock(&session->notif_mutex);
+        return;
+    }
+
+    if (options == NULL) {
+        if (session->sub_count == session->sub_capacity) {
+            size_t capacity = session->sub_capacity == 0 ? 4 : session->sub_capacity * 2;
+            SubscriptionOptions *grown = realloc(session->sub_options, capacity * sizeof(SubscriptionOptions));
+            if (grown == NULL) {
+                // A subscrição fica sem opções
+                pthread_mutex_unlock(&session->notif_mutex);
+                return;
+            }
+            session->sub_options = grown;
+            session->sub_capacity = capacity;
+        }
+        options = &session->sub_options[session->sub_count++];
+        snprintf(options->key, MAX_STRING_SIZE, "%s", key);
+    }
+    options->coalesce = coalesce;
+    options->interval_ns = max_rate > 0 ? 1000000000u / max_rate : 0;
+    options->next_ns = 0;
+    options->held = 0;
+    pthread_mutex_unlock(&session->notif_mutex);
+}
+
+// Codifica o conteúdo de uma notificação: chave | valor | versão
+static void encode_notification(Notification payload, const char *key, const char *value, uint64_t version) {
+    encode_field(payload, key, KEY_FIELD_SIZE);
+    encode_field(payload + KEY_FIELD_SIZE, value, KEY_FIELD_SIZE);
+    encode_version(payload + 2 * KEY_FIELD_SIZE, version);
+}
+
+// Entrega uma notificação à sessão, segundo as opções da subscrição da
+// chave. Chamada com notif_mutex.
+static void notif_deliver(Session *session, const char *key, const char *value, uint64_t version) {
+    Notification payload;
+    encode_notification(payload, key, value, version);
+
+    SubscriptionOptions *options = find_options(session, key);
+    if (options == NULL) {
+        notif_enqueue(session, payload, 0);
+    } else if (options_admit(session, options, payload)) {
+        notif_enqueue(session, payload, options->coalesce);
+    }
+}
+
+void sessions_notify(int subscriber, const char *key, const char *value, uint64_t version) {
+    if (subscriber < 1 || subscriber > session_capacity) {
+        return;
+    }
+    Session *session = &sessions[subscriber - 1];
+
+    pthread_mutex_lock(&session->notif_mutex);
+    if (session->notif_open) {
+        notif_deliver(session, key, value, version);
+    }
+    pthread_mutex_unlock(&session->notif_mutex);
+}
+
+// Notifica que a chave foi apagada, o que termina a subscrição exata da
+// sessão: as suas opções são esquecidas, e a notificação não espera pelo
+// ritmo máximo por ser a última
+static void sessions_notify_deleted(int subscriber, const char *key, const char *value, uint64_t version) {
+    if (subscriber < 1 || subscriber > session_capacity) {
+        return;
+    }
+    Session *session = &sessions[subscriber - 1];
+
+    pthread_mutex_lock(&session->notif_mutex);
+    SubscriptionOptions *options = find_options(session, key);
+    int coalesce = options != NULL && options->coalesce;
+    if (options != NULL) {
+        forget_options(session, options);
+    }
+    if (session->notif_open) {
+        Notification payload;
+        encode_notification(payload, key, value, version);
+        notif_enqueue(session, payload, coalesce);
+    }
+    pthread_mutex_unlock(&session->notif_mutex);
+}
+
+// Põe na fila as alterações de uma subscrição retomada, se couberem todas
+// no espaço livre, para a política da fila cheia não descartar nenhuma
+static int sessions_resume(int subscriber, const Change *changes, size_t count) {
+    Session *session = &sessions[subscriber - 1];
+    pthread_mutex_lock(&session->notif_mutex);
+    int fits = session->notif_open && (size_t)(NOTIF_QUEUE_SIZE - session->notif_count) >= count;
+    for (size_t i = 0; fits && i < count; i++) {
+        notif_deliver(session, changes[i].key, changes[i].value, changes[i].version);
+    }
+    pthread_mutex_unlock(&session->notif_mutex);
+    return !fits;
+}
+
+// Entrega as alterações do KVS aos subscritores das chaves. As subscrições
+// de uma chave apagada terminam.
+static void sessions_mutation(const char *key, const char *value, uint64_t version, int deleted) {
+    subscriptions_publish(key, value, version, deleted ? sessions_notify_deleted : sessions_notify, deleted);
+}
+
+// Identificador da sessão nas subscrições do KVS (0 indica posição livre)
+static int session_subscriber(Session *session) {
+    return (int)(session - sessions) + 1;
+}
+
+// Fecha os pipes da sessão e liberta a vaga. Fechar o pipe de pedidos
+// retira-o automaticamente do epoll da sua thread de I/O.
+static void session_close(Session *session) {
+    if (session->shm != NULL) {
+        shm_ring_close(&session->shm->requests);
+        shm_ring_close(&session->shm->responses);
+        shm_segment_detach(session->shm);
+        shm_unlink(session->shm_name);  // Normalmente já removido pelo cliente
+        session->shm = NULL;
+    }
+
+    // A partir daqui nenhuma notificação usa o pipe
+    subscriptions_remove_all(session_subscriber(session));
+    pthread_mutex_lock(&session->notif_mutex);
+    if (session->notif_registered) {
+        epoll_ctl(session_epoll(session), EPOLL_CTL_DEL, session->notif_fd, NULL);
+    }
+    session->notif_open = 0;
+    session->notif_count = 0;
+    session->notif_armed = 0;
+    session->notif_registered = 0;
+    session->notif_flush_due = 0;
+    session->sub_count = 0;
+    if (session->timer_fd != -1) {
+        close(session->timer_fd);  // Sai também do epoll
+        session->timer_fd = -1;
+        session->timer_due = 0;
+    }
+    pthread_mutex_unlock(&session->notif_mutex);
+
+    close(session->req_fd);
+    close(session->resp_fd);
+    close(session->notif_fd);
+
+    pthread_mutex_lock(&sessions_mutex);
+    session->in_use = 0;
+    pthread_mutex_unlock(&sessions_mutex);
+    sem_post(&SEM_SESSION_SLOTS);
+}
+
+// Envia as respostas acumuladas pelo worker
+static void session_flush(Session *session) {
+    if (session->out_len == 0) {
+        return;
+    }
+    if (session->shm != NULL) {
+        shm_ring_write(&session->shm->responses, session->out, session->out_len);
+    } else {
+        write_all(session->resp_fd, session->out, session->out_len);
+    }
+    session->out_len = 0;
+}
+
+// Responde a um pedido, com o mesmo op_code e request_id. As respostas a
+// pedidos em pipeline são acumuladas e enviadas juntas no fim do lote; o
+// pipe de respostas só tem um escritor, por isso não precisam de ser atómicas.
+static void respond(Session *session, const FrameHeader *request, uint8_t status, const void *payload, size_t length) {
+    if (session->out_len + FRAME_HEADER_SIZE + length > RESPONSE_BUFFER_SIZE) {
+        session_flush(session);
+    }
+    session->out_len += encode_frame(session->out + session->out_len, request->op_code, status,
+                                     request->request_id, payload, length);
+}
+
+// Número de entradas de tamanho stride num payload, 0 se o tamanho for inválido
+static size_t payload_entries(const FrameHeader *header, size_t stride) {
+    if (header->length == 0 || header->length % stride != 0 || header->length / stride > MAX_REQUEST_KEYS) {
+        return 0;
+    }
+    return header->length / stride;
+}
+
+// Uma chave só tem posição na tabela (e lock) se começar por letra ou dígito
+static int valid_key(const char *key) {
+    return key[0] != '\0' && hash(key) >= 0;
+}
+
+// Executa um pedido de leitura, escrita ou remoção de várias chaves. As
+// chaves inválidas falham sem chegar ao KVS.
+static void handle_store_request(Session *session, const FrameHeader *header, const char *payload) {
+    char keys[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+    char values[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+    int results[MAX_REQUEST_KEYS];
+    uint64_t versions[MAX_REQUEST_KEYS];
+    size_t position[MAX_REQUEST_KEYS];  // Índice no pedido de cada chave válida
+    char response[MAX_REQUEST_KEYS * READ_ENTRY_SIZE];
+    size_t stride = header->op_code == OP_CODE_WRITE ? PAIR_FIELD_SIZE : KEY_FIELD_SIZE;
+
+    size_t num_pairs = payload_entries(header, stride);
+    if (num_pairs == 0) {
+        respond(session, header, 1, NULL, 0);
+        return;
+    }
+    size_t num_valid = 0;
+    for (size_t i = 0; i < num_pairs; i++) {
+        decode_field(keys[num_valid], payload + i * stride, MAX_STRING_SIZE);
+        if (header->op_code == OP_CODE_WRITE) {
+            decode_field(values[num_valid], payload + i * stride + KEY_FIELD_SIZE, MAX_STRING_SIZE);
+        }
+        if (valid_key(keys[num_valid])) {
+            position[num_valid++] = i;
+        }
+    }
+
+    int result = num_valid < num_pairs;
+    switch (header->op_code) {
+        case OP_CODE_READ:
+            // found | value, por chave
+            memset(response, 0, num_pairs * READ_ENTRY_SIZE);
+            if (num_valid > 0) {
+                result |= kvs_read_values(num_valid, keys, values, results, store_data);
+            }
+            for (size_t i = 0; i < num_valid; i++) {
+                response[position[i] * READ_ENTRY_SIZE] = (char)results[i];
+                encode_field(response + position[i] * READ_ENTRY_SIZE + 1, values[i], KEY_FIELD_SIZE);
+            }
+            respond(session, header, (uint8_t)result, response, num_pairs * READ_ENTRY_SIZE);
+            break;
+
+        case OP_CODE_WRITE:
+            // Versão de cada par, 0 se não foi escrito
+            memset(response, 0, num_pairs * VERSION_FIELD_SIZE);
+            if (num_valid > 0) {
+                result |= kvs_write_versioned(num_valid, keys, values, versions, store_data);
+            }
+            for (size_t i = 0; i < num_valid; i++) {
+                encode_version(response + position[i] * VERSION_FIELD_SIZE, versions[i]);
+            }
+            respond(session, header, (uint8_t)result, response, num_pairs * VERSION_FIELD_SIZE);
+            break;
+
+        default:
+            // missing | versão, por chave: 0 apagada, 1 inexistente
+            memset(response, 0, num_pairs * DELETE_ENTRY_SIZE);
+            for (size_t i = 0; i < num_pairs; i++) {
+                response[i * DELETE_ENTRY_SIZE] = 1;
+            }
+            if (num_valid > 0) {
+                result |= kvs_delete_keys(num_valid, keys, results, versions, store_data);
+            }
+            for (size_t i = 0; i < num_valid; i++) {
+                response[position[i] * DELETE_ENTRY_SIZE] = (char)results[i];
+                encode_version(response + position[i] * DELETE_ENTRY_SIZE + 1, versions[i]);
+            }
+            respond(session, header, (uint8_t)result, response, num_pairs * DELETE_ENTRY_SIZE);
+            break;
+    }
+}
+
+// Subscreve ou cancela várias chaves de uma vez. Responde com um bit por
+// chave, ligado se a operação teve sucesso para ela; as chaves inválidas
+// ficam com o bit desligado sem chegar ao KVS.
+static void handle_subscribe_keys(Session *session, const FrameHeader *header, const char *payload) {
+    char keys[MAX_REQUEST_KEYS][MAX_STRING_SIZE];
+    int results[MAX_REQUEST_KEYS];
+    int done[MAX_REQUEST_KEYS] = {0};
+    size_t position[MAX_REQUEST_KEYS];
+    char response[KEY_BITMAP_SIZE(MAX_REQUEST_KEYS)];
+
+    size_t num_keys = payload_entries(header, KEY_FIELD_SIZE);
+    if (num_keys == 0) {
+        respond(session, header, 1, NULL, 0);
+        return;
+    }
+    size_t num_valid = 0;
+    for (size_t i = 0; i < num_keys; i++) {
+        decode_field(keys[num_valid], payload + i * KEY_FIELD_SIZE, MAX_STRING_SIZE);
+        if (valid_key(keys[num_valid])) {
+            position[num_valid++] = i;
+        }
+    }
+
+    int subscriber = session_subscriber(session);
+    int result = num_valid < num_keys;
+    int subscribe = header->op_code == OP_CODE_SUBSCRIBE_KEYS;
+    for (size_t i = 0; subscribe && i < num_valid; i++) {
+        // Estas subscrições não têm opções, nem as que venham substituir
+        session_set_options(session, keys[i], 0, 0);
+    }
+    if (num_valid > 0) {
+        result |= subscribe ? kvs_subscribe_keys(num_valid, keys, subscriber, results, store_data)
+                            : kvs_unsubscribe_keys(num_valid, keys, subscriber, results, store_data);
+    }
+    for (size_t i = 0; i < num_valid; i++) {
+        if (results[i] == 0) {
+            if (!subscribe) {
+                session_set_options(session, keys[i], 0, 0);
+            }
+            done[position[i]] = 1;
+        }
+    }
+    encode_bitmap(response, done, num_keys);
+    respond(session, header, (uint8_t)result, response, KEY_BITMAP_SIZE(num_keys));
+}
+
+// Cria os anéis em memória partilhada da sessão e envia o nome do segmento
+// pelo pipe de respostas, que deixa de ser usado a seguir
+static int handle_attach_shm(Session *session, const FrameHeader *header) {
+    if (!shm_enabled || session->shm != NULL || header->length != 0) {
+        respond(session, header, 1, NULL, 0);
+        return REQUEST_DONE;
+    }
+
+    snprintf(session->shm_name, PATH_FIELD_SIZE, "/kvs-%d-%d", (int)getpid(), (int)(session - sessions));
+    ShmSegment *segment = shm_segment_create(session->shm_name);
+    if (segment == NULL) {
+        respond(session, header, 1, NULL, 0);
+        return REQUEST_DONE;
+    }
+    atomic_store(&segment->requests.reader_pid, getpid());
+    atomic_store(&segment->responses.writer_pid, getpid());
+
+    char name[PATH_FIELD_SIZE];
+    encode_field(name, session->shm_name, PATH_FIELD_SIZE);
+    respond(session, header, 0, name, PATH_FIELD_SIZE);
+    session_flush(session);
+    session->shm = segment;
+    return REQUEST_SHM;
+}
+
+// Executa um pedido de uma sessão e escreve a resposta no pipe de respostas.
+// @return REQUEST_DONE, REQUEST_CLOSED ou REQUEST_SHM.
+static int handle_request(Session *session, const FrameHeader *header, const char *payload) {
+    char key[KEY_FIELD_SIZE];
+    int result;
+
+    if (atomic_load(&session->notif_evicted)) {
+        return REQUEST_CLOSED;
+    }
+
+    switch (header->op_code) {
+        case OP_CODE_DISCONNECT:
+            respond(session, header, 0, NULL, 0);
+            return REQUEST_CLOSED;
+
+        case OP_CODE_ATTACH_SHM:
+            return handle_attach_shm(session, header);
+
+        case OP_CODE_SUBSCRIBE: {
+            // key [| flags | max rate [| version]]
+            // Resposta: valor | versão da chave no momento da subscrição
+            char response[SUBSCRIBE_RESPONSE_SIZE] = {0};
+            uint8_t flags = 0;
+            uint16_t max_rate = 0;
+            if (header->length == SUBSCRIBE_OPTIONS_PAYLOAD_SIZE ||
+                header->length == SUBSCRIBE_RESUME_PAYLOAD_SIZE) {
+                decode_subscribe_options(payload, &flags, &max_rate);
+            } else if (header->length != KEY_PAYLOAD_SIZE) {
+                respond(session, header, 1, response, SUBSCRIBE_RESPONSE_SIZE);
+                break;
+            }
+            if (((flags & SUBSCRIBE_RESUME) != 0) != (header->length == SUBSCRIBE_RESUME_PAYLOAD_SIZE)) {
+                respond(session, header, 1, response, SUBSCRIBE_RESPONSE_SIZE);
+                break;
+            }
+            decode_field(key, payload, KEY_FIELD_SIZE);
+            if (!(flags & SUBSCRIBE_PATTERN) && !valid_key(key)) {
+                respond(session, header, 1, response, SUBSCRIBE_RESPONSE_SIZE);
+                break;
+            }
+            if (flags & SUBSCRIBE_PATTERN) {
+                // As opções valem por chave, por isso os padrões não as têm
+                result = flags != SUBSCRIBE_PATTERN || max_rate != 0
+                             ? 1 : kvs_subscribe_pattern(key, session_subscriber(session), store_data);
+                respond(session, header, (uint8_t)result, response, SUBSCRIBE_RESPONSE_SIZE);
+                break;
+            }
+
+            uint64_t since = 0;
+            if (flags & SUBSCRIBE_RESUME) {
+                since = decode_version(payload + SUBSCRIBE_OPTIONS_PAYLOAD_SIZE);
+            }
+            char value[MAX_STRING_SIZE];
+            uint64_t version = 0;
+            session_set_options(session, key, (flags & SUBSCRIBE_COALESCE) != 0, max_rate);
+            result = kvs_subscribe(key, session_subscriber(session), (flags & SUBSCRIBE_RESUME) ? &since : NULL,
+                                   sessions_resume, value, &version, store_data);
+            if (result != 1) {
+                encode_field(response, value, KEY_FIELD_SIZE);
+                encode_version(response + KEY_FIELD_SIZE, version);
+            } else {
+                session_set_options(session, key, 0, 0);
+            }
+            respond(session, header, (uint8_t)result, response, SUBSCRIBE_RESPONSE_SIZE);
+            break;
+        }
+
+        case OP_CODE_UNSUBSCRIBE:
+            // key
+            if (header->length != KEY_PAYLOAD_SIZE) {
+                respond(session, header, 1, NULL, 0);
+                break;
+            }
+            decode_field(key, payload, KEY_FIELD_SIZE);
+            result = kvs_unsubscribe(key, session_subscriber(session), store_data);
+            if (result == 0) {
+                session_set_options(session, key, 0, 0);
+            }
+            respond(session, header, (uint8_t)result, NULL, 0);
+            break;
+
+        case OP_CODE_SUBSCRIBE_KEYS:
+        case OP_CODE_UNSUBSCRIBE_KEYS:
+            handle_subscribe_keys(session, header, payload);
+            break;
+
+        case OP_CODE_READ:
+        case OP_CODE_WRITE:
+        case OP_CODE_DELETE:
+            handle_store_request(session, header, payload);
+            break;
+
+        default:
+            fprintf(stderr, "Invalid command, op_code %u unrecognized\n", header->op_code);
+            respond(session, header, 1, NULL, 0);
+            break;
+    }
+    return REQUEST_DONE;
+}
+
+// Lê a próxima trama de pedido da sessão
+static int session_recv(Session *session, FrameHeader *header, char *payload) {
+    if (session->packet) {
+        return recv_packet(session->req_fd, header, payload, FRAME_MAX_PAYLOAD);
+    }
+    return recv_frame(session->req_fd, header, payload, FRAME_MAX_PAYLOAD, NULL);
+}
+
+// Verifica se o cliente já enviou outro pedido. Como cada trama é escrita
+// de uma só vez, se o cabeçalho está no pipe a trama está completa.
+static int session_has_frame(Session *session) {
+    int available = 0;
+    return ioctl(session->req_fd, FIONREAD, &available) == 0 && available >= FRAME_HEADER_SIZE;
+}
+
+// Thread de uma sessão em memória partilhada: espera pelos pedidos no anel
+// de pedidos (sem passar pelo epoll nem pela fila) e responde pelo anel de
+// respostas. Termina quando o cliente se desliga ou o seu processo morre.
+static void *thread_shm_session(void *arg) {
+    Session *session = (Session *)arg;
+    char payload[FRAME_MAX_PAYLOAD];
+    char *out = malloc(RESPONSE_BUFFER_SIZE);
+    if (out == NULL) {
+        fprintf(stderr, "Failed to allocate response buffer\n");
+        session_close(session);
+        return NULL;
+    }
+    session->out = out;
+    session->out_len = 0;
+
+    int state = REQUEST_DONE;
+    while (state == REQUEST_DONE) {
+        FrameHeader header;
+        if (shm_ring_recv_frame(&session->shm->requests, &header, payload, FRAME_MAX_PAYLOAD) != 1) {
+            fprintf(stderr, "Shared memory session ended\n");
+            break;
+        }
+        state = handle_request(session, &header, payload);
+        // Os pedidos já no anel são tratados antes de enviar as respostas
+        if (state != REQUEST_DONE || !shm_ring_has_data(&session->shm->requests)) {
+            session_flush(session);
+        }
+    }
+
+    session_close(session);
+    free(out);
+    return NULL;
+}
+
+// Workers: executam os pedidos no KVS e voltam a armar a sessão. Os pedidos
+// que o cliente enviou em pipeline são executados logo pelo mesmo worker, por
+// ordem, até SESSION_BATCH pedidos, para não passar cada um pelo epoll e pela
+// fila.
+static void *thread_session_worker(void *arg) {
+    (void)arg;
+    char *out = malloc(RESPONSE_BUFFER_SIZE);
+    if (out == NULL) {
+        fprintf(stderr, "Failed to allocate response buffer\n");
+        return NULL;
+    }
+
+    for (;;) {
+        Work *work = work_pop();
+        Session *session = work->session;
+        session->out = out;
+        session->out_len = 0;
+
+        int state = REQUEST_DONE;
+        for (int batch = 0;; batch++) {
+            struct timespec start;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            state = handle_request(session, &work->header, work->payload);
+            work_done(&start);
+
+            if (state != REQUEST_DONE || batch + 1 == SESSION_BATCH || !session_has_frame(session)) {
+                break;
+            }
+            int result = session_recv(session, &work->header, work->payload);
+            if (result != 1) {
+                fprintf(stderr, "Invalid request, closing session\n");
+                state = REQUEST_CLOSED;
+                break;
+            }
+        }
+        session_flush(session);
+        mpmc_push(&work_free, work);
+
+        if (state == REQUEST_SHM) {
+            // O pipe de pedidos fica fora do epoll até a sessão terminar
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, thread_shm_session, session) != 0) {
+                session_close(session);
+            } else {
+                pthread_detach(thread);
+            }
+        } else if (state == REQUEST_CLOSED) {
+            session_close(session);
+        } else if (session_arm(session, EPOLL_CTL_MOD) != 0) {
+            perror("Failed to rearm session");
+            session_close(session);
+        }
+    }
+    return NULL;
+}
+
+// Threads de I/O: cada uma espera pelos pedidos das suas sessões, lê-os
+// e entrega-os aos workers
+static void *thread_session_io(void *arg) {
+    int epoll_fd = *(int *)arg;
+    struct epoll_event events[REACTOR_EVENTS];
+    Work *work = NULL;
+
+    for (;;) {
+        int ready = epoll_wait(epoll_fd, events, REACTOR_EVENTS, -1);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait failed");
+            return NULL;
+        }
+
+        for (int i = 0; i < ready; i++) {
+            Session *session = &sessions[events[i].data.u64 >> EVENT_KIND_BITS];
+            uint64_t kind = events[i].data.u64 & ((1u << EVENT_KIND_BITS) - 1);
+            if (kind == EVENT_NOTIF) {
+                notif_writable(session);
+                continue;
+            }
+            if (kind == EVENT_TIMER) {
+                timer_expired(session);
+                continue;
+            }
+
+            if (work == NULL) {
+                work = work_get();
+            }
+
+            // Cada trama é escrita pelo cliente de uma só vez, por isso
+            // está completa no pipe quando o cabeçalho chega
+            int result = session_recv(session, &work->header, work->payload);
+            if (result == 0) {
+                // result == 0 indica EOF
+                fprintf(stderr, "pipe closed\n");
+                session_close(session);
+                continue;
+            } else if (result == -1) {
+                fprintf(stderr, "Invalid request, closing session\n");
+                session_close(session);
+                continue;
+            }
+            work->session = session;
+            work_push(work);
+            work = NULL;
+        }
+    }
+    return NULL;
+}
+
+void sessions_set_shm(int enabled) {
+    shm_enabled = enabled;
+}
+
+int sessions_set_notif_policy(const char *policy) {
+    if (strcmp(policy, "drop") == 0) {
+        notif_policy = NOTIF_DROP_OLDEST;
+    } else if (strcmp(policy, "coalesce") == 0) {
+        notif_policy = NOTIF_COALESCE;
+    } else if (strcmp(policy, "disconnect") == 0) {
+        notif_policy = NOTIF_DISCONNECT;
+    } else {
+        return 1;
+    }
+    return 0;
+}
+
+void sessions_set_notif_flush_delay(unsigned int delay_us) {
+    notif_flush_ns = (uint64_t)delay_us * 1000u;
+}
+
+int sessions_init(int max_sessions, int io_threads, int workers, ThreadData *data) {
+    store_data = data;
+    if (kvs_add_mutation_hook(sessions_mutation) != 0) {
+        return 1;
+    }
+    if (subscriptions_init(max_sessions) != 0) {
+        return 1;
+    }
+    session_capacity = max_sessions;
+    io_thread_count = io_threads;
+    worker_count = workers;
+
+    sessions = calloc((size_t)max_sessions, sizeof(Session));
+    epoll_fds = calloc((size_t)io_threads, sizeof(int));
+    Notification *notif_queues = calloc((size_t)max_sessions * NOTIF_QUEUE_SIZE, sizeof(Notification));
+    if (sessions == NULL || epoll_fds == NULL || notif_queues == NULL) {
+        fprintf(stderr, "Failed to allocate %d sessions\n", max_sessions);
+        return 1;
+    }
+    for (int i = 0; i < max_sessions; i++) {
+        pthread_mutex_init(&sessions[i].notif_mutex, NULL);
+        sessions[i].timer_fd = -1;
+        sessions[i].notif_queue = notif_queues + (size_t)i * NOTIF_QUEUE_SIZE;
+    }
+
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1) {
+        perror("Failed to open /dev/null");
+        return 1;
+    }
+
+    if (sem_init(&SEM_SESSION_SLOTS, 0, (unsigned int)max_sessions) != 0) {
+        perror("Failed to initialize SEM_SESSION_SLOTS");
+        return 1;
+    }
+
+    work_pool = calloc(WORK_QUEUE_SIZE, sizeof(Work));
+    if (work_pool == NULL || mpmc_init(&work_free, WORK_QUEUE_SIZE) != 0 ||
+        mpmc_init(&work_ready, WORK_QUEUE_SIZE) != 0) {
+        fprintf(stderr, "Failed to allocate the work queue\n");
+        return 1;
+    }
+    for (int i = 0; i < WORK_QUEUE_SIZE; i++) {
+        mpmc_push(&work_free, &work_pool[i]);
+    }
+
+    pthread_t thread;
+    for (int i = 0; i < io_threads; i++) {
+        epoll_fds[i] = epoll_create1(0);
+        if (epoll_fds[i] == -1) {
+            perror("epoll_create1 failed");
+            return 1;
+        }
+        if (pthread_create(&thread, NULL, thread_session_io, &epoll_fds[i]) != 0) {
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&thread, NULL, thread_session_worker, NULL) != 0) {
+            return 1;
+        }
+        pthread_detach(thread);
+    }
+    return 0;
+}
+
+void sessions_report(FILE *out) {
+    // Cada valor é lido à parte, por isso o relatório é aproximado
+    unsigned long executed = atomic_load(&metrics.requests);
+    unsigned long requests = executed > 0 ? executed : 1;
+    fprintf(out,
+            "sessions: io_threads=%d workers=%d\n"
+            "queue: depth=%zu max_depth=%lu capacity=%d full_waits=%lu\n"
+            "requests=%lu wait_avg_us=%lu wait_max_us=%lu service_avg_us=%lu service_max_us=%lu\n",
+            io_thread_count, worker_count,
+            mpmc_size(&work_ready), atomic_load(&metrics.max_depth), WORK_QUEUE_SIZE,
+            atomic_load(&metrics.full_waits),
+            executed,
+            atomic_load(&metrics.wait_ns_total) / requests / 1000, atomic_load(&metrics.wait_ns_max) / 1000,
+            atomic_load(&metrics.service_ns_total) / requests / 1000, atomic_load(&metrics.service_ns_max) / 1000);
+    fprintf(out,
+            "notifications: subscriptions=%zu patterns=%zu queue=%d dropped=%lu coalesced=%lu disconnects=%lu\n"
+            "notifications: sent=%lu writes=%lu batch=%d flush_delay_us=%lu\n",
+            subscriptions_count(), subscriptions_pattern_count(), NOTIF_QUEUE_SIZE, atomic_load(&notif_dropped),
+            atomic_load(&notif_coalesced), atomic_load(&notif_disconnects),
+            atomic_load(&notif_sent), atomic_load(&notif_writes), NOTIF_BATCH,
+            (unsigned long)(notif_flush_ns / 1000u));
+}
+
+int sessions_add(int req_fd, int resp_fd, int notif_fd, int packet) {
+    sem_wait(&SEM_SESSION_SLOTS);
+
+    pthread_mutex_lock(&sessions_mutex);
+    Session *session = NULL;
+    for (int i = 0; i < session_capacity; i++) {
+        if (!sessions[i].in_use) {
+            session = &sessions[i];
+            break;
+        }
+    }
+    // O semáforo garante que existe uma posição livre
+    if (session == NULL) {
+        pthread_mutex_unlock(&sessions_mutex);
+        sem_post(&SEM_SESSION_SLOTS);
+        close(req_fd);
+        close(resp_fd);
+        close(notif_fd);
+        return 1;
+    }
+    session->in_use = 1;
+    session->req_fd = req_fd;
+    session->resp_fd = resp_fd;
+    session->notif_fd = notif_fd;
+    session->packet = packet;
+    pthread_mutex_unlock(&sessions_mutex);
+
+    // As notificações nunca bloqueiam quem as envia; num socket, que partilha
+    // o descritor com as respostas, usa-se MSG_DONTWAIT em cada envio
+    if (!packet) {
+        fcntl(notif_fd, F_SETFL, fcntl(notif_fd, F_GETFL) | O_NONBLOCK);
+    }
+    pthread_mutex_lock(&session->notif_mutex);
+    session->notif_head = 0;
+    session->notif_count = 0;
+    session->notif_lost = 0;
+    session->notif_open = 1;
+    atomic_store(&session->notif_evicted, 0);
+    pthread_mutex_unlock(&session->notif_mutex);
+
+    if (session_arm(session, EPOLL_CTL_ADD) != 0) {
+        perror("Failed to register session");
+        session_close(session);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef KVS_SESSIONS_H
+#define KVS_SESSIONS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "kvs.h"
+#include "src/common/protocol.h"
+#include "src/common/shm.h"
+
+// Política quando a fila de notificações de uma sessão está cheia
+enum {
+    NOTIF_DROP_OLDEST,  // Descarta a notificação mais antiga
+    NOTIF_COALESCE,     // Atualiza a notificação mais recente da mesma chave, se houver
+    NOTIF_DISCONNECT,   // Desliga o cliente, que não acompanha as notificações
+};
+
+// Notificação por enviar, já codificada: key | value
+typedef char Notification[NOTIFICATION_PAYLOAD_SIZE];
+
+// Opções de uma subscrição da sessão (SUBSCRIBE_COALESCE e ritmo máximo) e
+// estado do limite de ritmo
+typedef struct {
+    char key[MAX_STRING_SIZE];
+    int coalesce;          // As notificações por enviar da chave colapsam
+    uint64_t interval_ns;  // Intervalo mínimo entre notificações, 0 sem limite
+    uint64_t next_ns;      // Antes deste instante não sai outra notificação
+    int held;              // 1 se held_payload espera por next_ns
+    Notification held_payload;
+} SubscriptionOptions;
+
+// Sessão de um cliente: os três pipes abertos pela thread de admissão, ou
+// três descritores do mesmo socket SOCK_SEQPACKET
+typedef struct Session {
+    int req_fd;    // Pipe de pedidos (leitura)
+    int resp_fd;   // Pipe de respostas (escrita)
+    int notif_fd;  // Pipe de notificações (escrita)
+    int packet;    // 1 se cada trama chega numa mensagem de um socket
+    int in_use;    // 1 se a posição estiver ocupada
+    char *out;     // Respostas por enviar, no buffer do worker que trata a sessão
+    size_t out_len;
+    ShmSegment *shm;  // Anéis em memória partilhada, se o cliente os pediu
+    char shm_name[PATH_FIELD_SIZE];
+
+    // Fila de notificações, escrita sem bloquear: o que não cabe no pipe
+    // fica aqui até o epoll da thread de I/O avisar que há espaço
+    pthread_mutex_t notif_mutex;
+    Notification *notif_queue;  // NOTIF_QUEUE_SIZE posições
+    int notif_head;
+    int notif_count;
+    int notif_open;              // 0 depois de a sessão fechar ou ser desligada
+    int notif_armed;             // 1 se o epoll estiver à espera de espaço no pipe
+    int notif_registered;        // 1 se o pipe de notificações estiver no epoll
+    uint64_t notif_flush_due;    // Instante em que a fila é enviada, 0 se já foi
+    _Atomic int notif_evicted;   // Desligada pela política NOTIF_DISCONNECT
+    int notif_lost;              // 1 se se descartaram notificações desde a última enviada
+    SubscriptionOptions *sub_options;  // Só as subscrições com opções, protegidas por notif_mutex
+    size_t sub_count;
+    size_t sub_capacity;
+    int timer_fd;                // timerfd das notificações retidas, -1 se não existir
+    uint64_t timer_due;          // Instante para que está armado, 0 se desarmado
+} Session;
+
+/// Cria as threads de I/O, cada uma com o seu epoll a vigiar os pipes de
+/// pedidos de parte das sessões, e a pool de workers que executa os pedidos.
+/// As duas pools comunicam por uma fila limitada a WORK_QUEUE_SIZE pedidos.
+/// @param max_sessions Número máximo de sessões em simultâneo.
+/// @param io_threads Número de threads de I/O.
+/// @param workers Número de workers.
+/// @param data Estrutura com os locks do KVS.
+/// @return 0 em caso de sucesso, 1 caso contrário.
+int sessions_init(int max_sessions, int io_threads, int workers, ThreadData *data);
+
+/// Permite que os clientes passem a sessão para memória partilhada. Cada
+/// sessão nesse modo é servida por uma thread própria.
+/// @param enabled 1 para permitir, 0 caso contrário.
+void sessions_set_shm(int enabled);
+
+/// Escolhe o que fazer quando a fila de notificações de uma sessão enche.
+/// @param policy "drop", "coalesce" ou "disconnect".
+/// @return 0 em caso de sucesso, 1 se a política não existir.
+int sessions_set_notif_policy(const char *policy);
+
+/// Atrasa o envio das notificações para as juntar em menos escritas. Uma
+/// notificação espera no máximo delay_us, ou menos se se juntarem as
+/// suficientes para uma escrita atómica no pipe.
+/// @param delay_us Atraso em microssegundos, 0 para enviar logo.
+void sessions_set_notif_flush_delay(unsigned int delay_us);
+
+/// Põe uma notificação na fila do subscritor e tenta enviá-la logo, sem
+/// bloquear. Se o cliente não a conseguir receber, é enviada pela thread de
+/// I/O da sessão quando o pipe tiver espaço.
+/// @param subscriber Identificador dado a kvs_subscribe pela sessão.
+/// @param key Chave alterada.
+/// @param value Novo valor.
+/// @param version Versão da alteração.
+void sessions_notify(int subscriber, const char *key, const char *value, uint64_t version);
+
+/// Escreve as métricas da fila de pedidos (ocupação, tempos de espera e de
+/// execução) para dimensionar as pools, e as notificações descartadas.
+/// @param out Onde escrever.
+void sessions_report(FILE *out);
+
+/// Entrega uma sessão já ligada às threads de I/O. Bloqueia enquanto o número
+/// máximo de sessões estiver atingido.
+/// @param req_fd Pipe de pedidos.
+/// @param resp_fd Pipe de respostas.
+/// @param notif_fd Pipe de notificações.
+/// @param packet 1 se os descritores forem de um socket SOCK_SEQPACKET.
+/// @return 0 em caso de sucesso, 1 caso contrário (os pipes são fechados).
+int sessions_add(int req_fd, int resp_fd, int notif_fd, int packet);
+
+#endif  // KVS_SESSIONS_H
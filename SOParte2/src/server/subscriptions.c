@@ -0,0 +1,605 @@
+#include <fnmatch.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "subscriptions.h"
+
+// Subscritores de uma chave. Só existe enquanto a chave tiver subscritores.
+typedef struct KeySubscribers {
+    char key[MAX_STRING_SIZE];
+    int *subscribers;
+    size_t count;
+    size_t capacity;
+    struct KeySubscribers *next;
+} KeySubscribers;
+
+// Subscritores de um padrão. Fica no nó da trie do seu prefixo literal (o
+// que vem antes do primeiro carácter especial).
+typedef struct PatternSubscribers {
+    char pattern[MAX_STRING_SIZE];
+    size_t literal;   // Comprimento do prefixo literal
+    int prefix_only;  // O padrão é o prefixo seguido de um só '*'
+    int *subscribers;
+    size_t count;
+    size_t capacity;
+    struct PatternSubscribers *next;
+} PatternSubscribers;
+
+// Nó da trie dos prefixos literais dos padrões
+typedef struct PatternNode {
+    char c;
+    struct PatternNode *children;  // Primeiro filho; os restantes são seus irmãos
+    struct PatternNode *sibling;
+    PatternSubscribers *patterns;
+} PatternNode;
+
+// Chave ou padrão subscrito por um subscritor
+typedef struct {
+    char key[MAX_STRING_SIZE];
+    int pattern;
+} OwnedKey;
+
+// Chaves subscritas por um subscritor (índice inverso), para cancelar todas
+// as subscrições quando a sessão termina
+typedef struct {
+    pthread_mutex_t mutex;
+    OwnedKey *keys;
+    size_t count;
+    size_t capacity;
+} SubscriberKeys;
+
+// Subscritores de uma alteração, juntados antes de notificar. Um subscritor
+// da chave e de padrões que a apanham recebe uma só notificação.
+typedef struct {
+    int local[PUBLISH_LOCAL_SUBSCRIBERS];
+    int *ids;
+    size_t count;
+    size_t capacity;
+} Recipients;
+
+// Tabela chave -> subscritores. Cada lock protege as listas de
+// SUBSCRIPTION_BUCKETS / SUBSCRIPTION_LOCKS posições. A ordem dos locks é
+// sempre o do subscritor antes do da tabela.
+static KeySubscribers *table[SUBSCRIPTION_BUCKETS];
+static pthread_rwlock_t table_locks[SUBSCRIPTION_LOCKS];
+
+// Trie dos padrões, com um só lock: as subscrições de padrões mudam pouco
+// e as escritas só a percorrem para leitura
+static PatternNode pattern_root;
+static pthread_rwlock_t pattern_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static SubscriberKeys *owners;
+static int max_owner = 0;
+
+// Permite às escritas não tocar em nenhum lock enquanto ninguém subscreve
+static _Atomic size_t total = 0;
+static _Atomic size_t pattern_total = 0;
+
+static size_t key_bucket(const char *key) {
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (const char *c = key; *c != '\0'; c++) {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    return hash % SUBSCRIPTION_BUCKETS;
+}
+
+static pthread_rwlock_t *bucket_lock(size_t bucket) {
+    return &table_locks[bucket % SUBSCRIPTION_LOCKS];
+}
+
+// Garante espaço para mais um elemento num array dinâmico
+static int reserve(void **array, size_t *capacity, size_t count, size_t size) {
+    if (count < *capacity) {
+        return 0;
+    }
+    size_t grown_capacity = *capacity == 0 ? 4 : *capacity * 2;
+    void *grown = realloc(*array, grown_capacity * size);
+    if (grown == NULL) {
+        return 1;
+    }
+    *array = grown;
+    *capacity = grown_capacity;
+    return 0;
+}
+
+// Procura a entrada de uma chave. Chamada com o lock da posição.
+static KeySubscribers *find_entry(size_t bucket, const char *key, KeySubscribers ***link) {
+    KeySubscribers **current = &table[bucket];
+    while (*current != NULL && strcmp((*current)->key, key) != 0) {
+        current = &(*current)->next;
+    }
+    if (link != NULL) {
+        *link = current;
+    }
+    return *current;
+}
+
+// Retira um subscritor da entrada de uma chave, libertando-a se ficar vazia.
+// Chamada com o lock de escrita da posição.
+static int remove_from_entry(size_t bucket, const char *key, int subscriber) {
+    KeySubscribers **link;
+    KeySubscribers *entry = find_entry(bucket, key, &link);
+    if (entry == NULL) {
+        return 1;
+    }
+    for (size_t i = 0; i < entry->count; i++) {
+        if (entry->subscribers[i] == subscriber) {
+            entry->subscribers[i] = entry->subscribers[--entry->count];
+            atomic_fetch_sub(&total, 1);
+            if (entry->count == 0) {
+                *link = entry->next;
+                free(entry->subscribers);
+                free(entry);
+            }
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Procura uma chave ou um padrão no índice inverso. Chamada com o mutex do
+// subscritor.
+static long find_owned(SubscriberKeys *owner, const char *key, int pattern) {
+    for (size_t i = 0; i < owner->count; i++) {
+        if (owner->keys[i].pattern == pattern && strcmp(owner->keys[i].key, key) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+static void forget_owned(SubscriberKeys *owner, size_t index) {
+    owner->count--;
+    if (index != owner->count) {
+        owner->keys[index] = owner->keys[owner->count];
+    }
+}
+
+static void remember_owned(SubscriberKeys *owner, const char *key, int pattern) {
+    OwnedKey *owned = &owner->keys[owner->count++];
+    snprintf(owned->key, MAX_STRING_SIZE, "%s", key);
+    owned->pattern = pattern;
+}
+
+static size_t literal_length(const char *pattern) {
+    return strcspn(pattern, "*?[\\");
+}
+
+static PatternNode *find_child(PatternNode *node, char c) {
+    PatternNode *child = node->children;
+    while (child != NULL && child->c != c) {
+        child = child->sibling;
+    }
+    return child;
+}
+
+// Apaga os nós da trie no caminho do prefixo que já não servem nenhum
+// padrão. Chamada com o lock de escrita da trie.
+static void prune_path(const char *pattern, size_t literal) {
+    PatternNode *path[MAX_STRING_SIZE];
+    size_t depth = 0;
+    path[0] = &pattern_root;
+    while (depth < literal && (path[depth + 1] = find_child(path[depth], pattern[depth])) != NULL) {
+        depth++;
+    }
+    for (; depth > 0 && path[depth]->patterns == NULL && path[depth]->children == NULL; depth--) {
+        PatternNode **child = &path[depth - 1]->children;
+        while (*child != path[depth]) {
+            child = &(*child)->sibling;
+        }
+        *child = path[depth]->sibling;
+        free(path[depth]);
+    }
+}
+
+// Retira um subscritor de um padrão. Chamada com o lock de escrita da trie.
+// @return 0 se o subscritor estava no padrão, 1 caso contrário.
+static int remove_pattern(const char *pattern, int subscriber) {
+    size_t literal = literal_length(pattern);
+    PatternNode *node = &pattern_root;
+    for (size_t i = 0; i < literal && node != NULL; i++) {
+        node = find_child(node, pattern[i]);
+    }
+    if (node == NULL) {
+        return 1;
+    }
+
+    PatternSubscribers **link = &node->patterns;
+    while (*link != NULL && strcmp((*link)->pattern, pattern) != 0) {
+        link = &(*link)->next;
+    }
+    PatternSubscribers *entry = *link;
+    if (entry == NULL) {
+        return 1;
+    }
+    size_t i = 0;
+    while (i < entry->count && entry->subscribers[i] != subscriber) {
+        i++;
+    }
+    if (i == entry->count) {
+        return 1;
+    }
+    entry->subscribers[i] = entry->subscribers[--entry->count];
+    atomic_fetch_sub(&pattern_total, 1);
+    atomic_fetch_sub(&total, 1);
+    if (entry->count > 0) {
+        return 0;
+    }
+    *link = entry->next;
+    free(entry->subscribers);
+    free(entry);
+    prune_path(pattern, literal);
+    return 0;
+}
+
+static void recipients_add(Recipients *recipients, int subscriber) {
+    if (recipients->count == recipients->capacity) {
+        size_t capacity = recipients->capacity * 2;
+        int *grown = recipients->ids == recipients->local ? malloc(capacity * sizeof(int))
+                                                          : realloc(recipients->ids, capacity * sizeof(int));
+        if (grown == NULL) {
+            return;  // Este subscritor perde a notificação
+        }
+        if (recipients->ids == recipients->local) {
+            memcpy(grown, recipients->local, sizeof(recipients->local));
+        }
+        recipients->ids = grown;
+        recipients->capacity = capacity;
+    }
+    recipients->ids[recipients->count++] = subscriber;
+}
+
+// Junta os subscritores dos padrões que apanham a chave. Só visita os nós da
+// trie no caminho da chave, por isso o custo não cresce com o número de
+// padrões que não lhe dizem respeito. Chamada com o lock de leitura da trie.
+static void match_patterns(const char *key, Recipients *recipients) {
+    PatternNode *node = &pattern_root;
+    size_t depth = 0;
+    for (;;) {
+        for (PatternSubscribers *entry = node->patterns; entry != NULL; entry = entry->next) {
+            if (entry->prefix_only || fnmatch(entry->pattern + entry->literal, key + depth, 0) == 0) {
+                for (size_t i = 0; i < entry->count; i++) {
+                    recipients_add(recipients, entry->subscribers[i]);
+                }
+            }
+        }
+        if (key[depth] == '\0' || (node = find_child(node, key[depth])) == NULL) {
+            return;
+        }
+        depth++;
+    }
+}
+
+static int compare_ids(const void *a, const void *b) {
+    int x = *(const int *)a;
+    int y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+int subscriptions_init(int max_subscribers) {
+    for (int i = 0; i < SUBSCRIPTION_LOCKS; i++) {
+        pthread_rwlock_init(&table_locks[i], NULL);
+    }
+    owners = calloc((size_t)max_subscribers, sizeof(SubscriberKeys));
+    if (owners == NULL) {
+        fprintf(stderr, "Failed to allocate %d subscribers\n", max_subscribers);
+        return 1;
+    }
+    for (int i = 0; i < max_subscribers; i++) {
+        pthread_mutex_init(&owners[i].mutex, NULL);
+    }
+    max_owner = max_subscribers;
+    return 0;
+}
+
+// Subscreve uma chave com o mutex do subscritor
+static int add_key(SubscriberKeys *owner, const char *key, int subscriber) {
+    if (find_owned(owner, key, 0) != -1 ||
+        reserve((void **)&owner->keys, &owner->capacity, owner->count, sizeof(OwnedKey)) != 0) {
+        return 1;
+    }
+
+    size_t bucket = key_bucket(key);
+    int result = 1;
+    pthread_rwlock_wrlock(bucket_lock(bucket));
+    KeySubscribers *entry = find_entry(bucket, key, NULL);
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(KeySubscribers));
+        if (entry != NULL) {
+            snprintf(entry->key, MAX_STRING_SIZE, "%s", key);
+            entry->next = table[bucket];
+            table[bucket] = entry;
+        }
+    }
+    if (entry != NULL &&
+        reserve((void **)&entry->subscribers, &entry->capacity, entry->count, sizeof(int)) == 0) {
+        entry->subscribers[entry->count++] = subscriber;
+        remember_owned(owner, key, 0);
+        atomic_fetch_add(&total, 1);
+        result = 0;
+    }
+    // Uma entrada acabada de criar fica vazia se não houve memória
+    if (entry != NULL && entry->count == 0) {
+        table[bucket] = entry->next;
+        free(entry);
+    }
+    pthread_rwlock_unlock(bucket_lock(bucket));
+    return result;
+}
+
+int subscriptions_add(const char *key, int subscriber) {
+    if (subscriber < 1 || subscriber > max_owner) {
+        return 1;
+    }
+    SubscriberKeys *owner = &owners[subscriber - 1];
+
+    pthread_mutex_lock(&owner->mutex);
+    int result = add_key(owner, key, subscriber);
+    pthread_mutex_unlock(&owner->mutex);
+    return result;
+}
+
+int subscriptions_add_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results) {
+    int failed = 0;
+    if (subscriber < 1 || subscriber > max_owner) {
+        for (size_t i = 0; i < num_keys; i++) {
+            results[i] = 1;
+        }
+        return 1;
+    }
+    SubscriberKeys *owner = &owners[subscriber - 1];
+
+    pthread_mutex_lock(&owner->mutex);
+    for (size_t i = 0; i < num_keys; i++) {
+        results[i] = add_key(owner, keys[i], subscriber);
+        failed |= results[i];
+    }
+    pthread_mutex_unlock(&owner->mutex);
+    return failed;
+}
+
+int subscriptions_add_pattern(const char *pattern, int subscriber) {
+    if (subscriber < 1 || subscriber > max_owner) {
+        return 1;
+    }
+    SubscriberKeys *owner = &owners[subscriber - 1];
+    size_t literal = literal_length(pattern);
+    int result = 1;
+
+    pthread_mutex_lock(&owner->mutex);
+    if (find_owned(owner, pattern, 1) != -1 ||
+        reserve((void **)&owner->keys, &owner->capacity, owner->count, sizeof(OwnedKey)) != 0) {
+        pthread_mutex_unlock(&owner->mutex);
+        return 1;
+    }
+
+    pthread_rwlock_wrlock(&pattern_lock);
+    PatternNode *node = &pattern_root;
+    for (size_t i = 0; i < literal && node != NULL; i++) {
+        PatternNode *child = find_child(node, pattern[i]);
+        if (child == NULL && (child = calloc(1, sizeof(PatternNode))) != NULL) {
+            child->c = pattern[i];
+            child->sibling = node->children;
+            node->children = child;
+        }
+        node = child;
+    }
+
+    PatternSubscribers *entry = NULL;
+    if (node != NULL) {
+        entry = node->patterns;
+        while (entry != NULL && strcmp(entry->pattern, pattern) != 0) {
+            entry = entry->next;
+        }
+        if (entry == NULL && (entry = calloc(1, sizeof(PatternSubscribers))) != NULL) {
+            snprintf(entry->pattern, MAX_STRING_SIZE, "%s", pattern);
+            entry->literal = literal;
+            entry->prefix_only = strcmp(pattern + literal, "*") == 0;
+            entry->next = node->patterns;
+            node->patterns = entry;
+        }
+    }
+    if (entry != NULL &&
+        reserve((void **)&entry->subscribers, &entry->capacity, entry->count, sizeof(int)) == 0) {
+        entry->subscribers[entry->count++] = subscriber;
+        remember_owned(owner, pattern, 1);
+        atomic_fetch_add(&pattern_total, 1);
+        atomic_fetch_add(&total, 1);
+        result = 0;
+    } else {
+        // Sem memória: a entrada e os nós acabados de criar saem outra vez
+        if (entry != NULL && entry->count == 0) {
+            node->patterns = entry->next;
+            free(entry);
+        }
+        prune_path(pattern, literal);
+    }
+    pthread_rwlock_unlock(&pattern_lock);
+
+    pthread_mutex_unlock(&owner->mutex);
+    return result;
+}
+
+// Cancela uma subscrição com o mutex do subscritor
+static int remove_key(SubscriberKeys *owner, const char *key, int subscriber) {
+    // A subscrição exata da chave tem prioridade sobre um padrão igual
+    int pattern = 0;
+    long index = find_owned(owner, key, 0);
+    if (index == -1) {
+        pattern = 1;
+        index = find_owned(owner, key, 1);
+    }
+    if (index == -1) {
+        return 1;
+    }
+    forget_owned(owner, (size_t)index);
+
+    if (pattern) {
+        pthread_rwlock_wrlock(&pattern_lock);
+        remove_pattern(key, subscriber);
+        pthread_rwlock_unlock(&pattern_lock);
+    } else {
+        size_t bucket = key_bucket(key);
+        pthread_rwlock_wrlock(bucket_lock(bucket));
+        remove_from_entry(bucket, key, subscriber);
+        pthread_rwlock_unlock(bucket_lock(bucket));
+    }
+    return 0;
+}
+
+int subscriptions_remove(const char *key, int subscriber) {
+    if (subscriber < 1 || subscriber > max_owner) {
+        return 1;
+    }
+    SubscriberKeys *owner = &owners[subscriber - 1];
+
+    pthread_mutex_lock(&owner->mutex);
+    int result = remove_key(owner, key, subscriber);
+    pthread_mutex_unlock(&owner->mutex);
+    return result;
+}
+
+int subscriptions_remove_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results) {
+    int failed = 0;
+    if (subscriber < 1 || subscriber > max_owner) {
+        for (size_t i = 0; i < num_keys; i++) {
+            results[i] = 1;
+        }
+        return 1;
+    }
+    SubscriberKeys *owner = &owners[subscriber - 1];
+
+    pthread_mutex_lock(&owner->mutex);
+    for (size_t i = 0; i < num_keys; i++) {
+        results[i] = remove_key(owner, keys[i], subscriber);
+        failed |= results[i];
+    }
+    pthread_mutex_unlock(&owner->mutex);
+    return failed;
+}
+
+void subscriptions_remove_all(int subscriber) {
+    if (subscriber < 1 || subscriber > max_owner) {
+        return;
+    }
+    SubscriberKeys *owner = &owners[subscriber - 1];
+
+    pthread_mutex_lock(&owner->mutex);
+    for (size_t i = 0; i < owner->count; i++) {
+        if (owner->keys[i].pattern) {
+            pthread_rwlock_wrlock(&pattern_lock);
+            remove_pattern(owner->keys[i].key, subscriber);
+            pthread_rwlock_unlock(&pattern_lock);
+            continue;
+        }
+        size_t bucket = key_bucket(owner->keys[i].key);
+        pthread_rwlock_wrlock(bucket_lock(bucket));
+        remove_from_entry(bucket, owner->keys[i].key, subscriber);
+        pthread_rwlock_unlock(bucket_lock(bucket));
+    }
+    // O espaço fica reservado para a próxima sessão nesta posição
+    owner->count = 0;
+    pthread_mutex_unlock(&owner->mutex);
+}
+
+void subscriptions_publish(const char *key, const char *value, uint64_t version, NotifyFn notify, int drop) {
+    if (atomic_load(&total) == 0) {
+        return;
+    }
+    size_t bucket = key_bucket(key);
+    int patterns = atomic_load(&pattern_total) > 0;
+
+    // Sem padrões, cada subscritor aparece uma só vez e notifica-se
+    // diretamente a partir da tabela
+    if (!drop && !patterns) {
+        pthread_rwlock_rdlock(bucket_lock(bucket));
+        KeySubscribers *entry = find_entry(bucket, key, NULL);
+        if (entry != NULL) {
+            for (size_t i = 0; i < entry->count; i++) {
+                notify(entry->subscribers[i], key, value, version);
+            }
+        }
+        pthread_rwlock_unlock(bucket_lock(bucket));
+        return;
+    }
+
+    Recipients recipients;
+    recipients.ids = recipients.local;
+    recipients.count = 0;
+    recipients.capacity = PUBLISH_LOCAL_SUBSCRIBERS;
+
+    // Se a chave foi apagada, a sua entrada sai da tabela e cada subscritor
+    // esquece-a mais abaixo, sem ter o lock da tabela (a ordem é
+    // subscritor -> tabela). As subscrições de padrões continuam.
+    KeySubscribers *dropped = NULL;
+    pthread_rwlock_t *lock = bucket_lock(bucket);
+    if (drop) {
+        pthread_rwlock_wrlock(lock);
+        KeySubscribers **link;
+        dropped = find_entry(bucket, key, &link);
+        if (dropped != NULL) {
+            *link = dropped->next;
+            atomic_fetch_sub(&total, dropped->count);
+        }
+        pthread_rwlock_unlock(lock);
+        for (size_t i = 0; dropped != NULL && i < dropped->count; i++) {
+            recipients_add(&recipients, dropped->subscribers[i]);
+        }
+    } else {
+        pthread_rwlock_rdlock(lock);
+        KeySubscribers *entry = find_entry(bucket, key, NULL);
+        for (size_t i = 0; entry != NULL && i < entry->count; i++) {
+            recipients_add(&recipients, entry->subscribers[i]);
+        }
+        pthread_rwlock_unlock(lock);
+    }
+
+    if (patterns) {
+        pthread_rwlock_rdlock(&pattern_lock);
+        match_patterns(key, &recipients);
+        pthread_rwlock_unlock(&pattern_lock);
+
+        qsort(recipients.ids, recipients.count, sizeof(int), compare_ids);
+        size_t unique = 0;
+        for (size_t i = 0; i < recipients.count; i++) {
+            if (unique == 0 || recipients.ids[unique - 1] != recipients.ids[i]) {
+                recipients.ids[unique++] = recipients.ids[i];
+            }
+        }
+        recipients.count = unique;
+    }
+
+    for (size_t i = 0; i < recipients.count; i++) {
+        notify(recipients.ids[i], key, value, version);
+    }
+    if (recipients.ids != recipients.local) {
+        free(recipients.ids);
+    }
+
+    if (dropped == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < dropped->count; i++) {
+        SubscriberKeys *owner = &owners[dropped->subscribers[i] - 1];
+        pthread_mutex_lock(&owner->mutex);
+        long index = find_owned(owner, key, 0);
+        if (index != -1) {
+            forget_owned(owner, (size_t)index);
+        }
+        pthread_mutex_unlock(&owner->mutex);
+    }
+    free(dropped->subscribers);
+    free(dropped);
+}
+
+size_t subscriptions_count(void) {
+    return atomic_load(&total);
+}
+
+size_t subscriptions_pattern_count(void) {
+    return atomic_load(&pattern_total);
+}
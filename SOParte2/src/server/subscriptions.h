@@ -0,0 +1,73 @@
+#ifndef KVS_SUBSCRIPTIONS_H
+#define KVS_SUBSCRIPTIONS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "constants.h"
+
+// Entrega uma notificação (chave, novo valor e versão da alteração) a um
+// subscritor
+typedef void (*NotifyFn)(int subscriber, const char *key, const char *value, uint64_t version);
+
+/// Prepara o índice inverso (subscritor -> chaves). As subscrições de cada
+/// chave ficam numa tabela à parte do KVS, com locks próprios, por isso
+/// subscrever não bloqueia leitores nem escritores de outras chaves.
+/// @param max_subscribers Maior identificador de subscritor (de 1 a max).
+/// @return 0 em caso de sucesso, 1 caso contrário.
+int subscriptions_init(int max_subscribers);
+
+/// Subscreve uma chave. Não há limite de subscritores por chave.
+/// @param key Chave a subscrever.
+/// @param subscriber Identificador do subscritor.
+/// @return 0 em caso de sucesso, 1 se já estava subscrita ou em caso de erro.
+int subscriptions_add(const char *key, int subscriber);
+
+/// Subscreve várias chaves de uma vez, com o mutex do subscritor tomado uma
+/// só vez para todas.
+/// @param results Onde guardar, por chave, o resultado de subscriptions_add.
+/// @return 0 se todas foram subscritas, 1 caso contrário.
+int subscriptions_add_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results);
+
+/// Subscreve todas as chaves que um padrão apanha, existentes ou futuras.
+/// O padrão segue as regras de fnmatch (*, ? e [...]); "sensor*" apanha as
+/// chaves com o prefixo "sensor". Os padrões ficam numa trie indexada pelo
+/// seu prefixo literal, por isso cada escrita só compara a chave com os
+/// padrões cujo prefixo literal é prefixo dela.
+/// @param pattern Padrão a subscrever.
+/// @param subscriber Identificador do subscritor.
+/// @return 0 em caso de sucesso, 1 se já estava subscrito ou em caso de erro.
+int subscriptions_add_pattern(const char *pattern, int subscriber);
+
+/// Cancela a subscrição de uma chave ou, se não existir, a de um padrão com
+/// o mesmo texto.
+/// @return 0 em caso de sucesso, 1 se a chave não estava subscrita.
+int subscriptions_remove(const char *key, int subscriber);
+
+/// Cancela várias subscrições de uma vez, como subscriptions_add_keys.
+/// @param results Onde guardar, por chave, o resultado de subscriptions_remove.
+/// @return 0 se todas foram canceladas, 1 caso contrário.
+int subscriptions_remove_keys(size_t num_keys, char keys[][MAX_STRING_SIZE], int subscriber, int *results);
+
+/// Cancela todas as subscrições de um subscritor, com custo proporcional ao
+/// número de chaves que subscreveu.
+/// @param subscriber Identificador do subscritor.
+void subscriptions_remove_all(int subscriber);
+
+/// Entrega uma alteração a todos os subscritores da chave e dos padrões que a
+/// apanham, uma só vez a cada subscritor.
+/// @param key Chave alterada.
+/// @param value Novo valor.
+/// @param version Versão da alteração.
+/// @param notify Função de entrega.
+/// @param drop 1 se a chave foi apagada: as subscrições da chave terminam,
+/// as dos padrões não.
+void subscriptions_publish(const char *key, const char *value, uint64_t version, NotifyFn notify, int drop);
+
+/// @return Número total de subscrições.
+size_t subscriptions_count(void);
+
+/// @return Número de subscrições de padrões.
+size_t subscriptions_pattern_count(void);
+
+#endif  // KVS_SUBSCRIPTIONS_H
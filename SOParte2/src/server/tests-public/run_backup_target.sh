@@ -0,0 +1,36 @@
+# Runs backup/target.job, which takes a BACKUP to a file and a BACKUP to a
+# FIFO of the same state: both must hold backup/target.result.
+if [ -z "$1" ]; then
+    echo "Usage: $0 <executable>"
+    exit 1
+fi
+executable=$(realpath "$1")
+
+test_dir="tests-public/backup"
+work_dir=$(mktemp -d)
+mkdir "$work_dir/jobs"
+mkfifo "$work_dir/target"
+sed "s|@TARGET@|$work_dir/target|" "$test_dir/target.job" > "$work_dir/jobs/target.job"
+
+# The backup to the FIFO only finishes once something reads it
+cat "$work_dir/target" > "$work_dir/target.bck" &
+reader_pid=$!
+timeout 1 "$executable" "$work_dir/jobs" 1 1 "$work_dir/reg" &> /dev/null
+kill "$reader_pid" 2> /dev/null
+wait "$reader_pid" 2> /dev/null
+
+status=0
+if diff "$work_dir/jobs/target-1.bck" "$test_dir/target.result"; then
+    echo -e "\e[32mTest passed: BACKUP to a file\e[0m"
+else
+    echo -e "\e[31mTest failed: BACKUP to a file\e[0m"
+    status=1
+fi
+if diff "$work_dir/target.bck" "$test_dir/target.result"; then
+    echo -e "\e[32mTest passed: BACKUP to a FIFO\e[0m"
+else
+    echo -e "\e[31mTest failed: BACKUP to a FIFO\e[0m"
+    status=1
+fi
+rm -r "$work_dir"
+exit $status
@@ -0,0 +1,33 @@
+# Throughput of 1-key READs on one session, made one at a time, by several
+# threads at once, and pipelined from one thread with up to 32 in flight,
+# first over the pipes and then over the shared memory rings (-m).
+# Not a pass/fail test: the numbers depend on the host.
+if [ -z "$1" ] || [ -z "$2" ]; then
+    echo "Usage: $0 <server_executable> <bench_executable> [ops]"
+    exit 1
+fi
+server=$(realpath "$1")
+bench=$(realpath "$2")
+ops=${3:-100000}
+
+work_dir=$(mktemp -d)
+mkdir "$work_dir/jobs"
+
+# Runs every mode against a server started with the flags given
+run_bench() {
+    "$server" "$@" "$work_dir/jobs" 1 1 "$work_dir/reg" &> /dev/null &
+    local server_pid=$!
+    sleep 0.3
+    for args in "-t 1" "-t 8" "-d 8" "-d 32"; do
+        timeout 60 "$bench" $args "$work_dir/reg" "$ops" | grep "ops/s"
+    done
+    kill "$server_pid"
+    wait "$server_pid" 2> /dev/null
+}
+
+echo "Pipes:"
+run_bench
+echo "Shared memory rings:"
+run_bench -m
+
+rm -r "$work_dir"
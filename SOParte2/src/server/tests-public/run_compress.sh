@@ -0,0 +1,73 @@
+# Runs the same job with and without -z. The compressed backup and WAL
+# checkpoint must start with KVZ1, the backup must be smaller than the
+# plain one, and a new server must recover the store from the compressed
+# checkpoint.
+if [ -z "$1" ]; then
+    echo "Usage: $0 <executable>"
+    exit 1
+fi
+executable=$(realpath "$1")
+
+work_dir=$(mktemp -d)
+mkdir "$work_dir/plain" "$work_dir/z" "$work_dir/wal" "$work_dir/recover"
+
+# Enough writes to 256 keys for more than 4 MB of WAL, so the server writes
+# a checkpoint. Each key keeps the value of the last of 1600 WRITEs.
+value='value-%04d-%03d-xxxxxxxxxxxxxxxxxx'
+awk -v value="$value" 'BEGIN {
+    for (n = 0; n < 1600; n++) {
+        line = "WRITE ["
+        for (i = 0; i < 64; i++) {
+            line = line sprintf("(key%03d," value ")", i + 64 * (n % 4), n, i)
+        }
+        print line "]"
+    }
+    print "BACKUP"
+    print "SHOW"
+}' > "$work_dir/plain/big.job"
+awk -v value="$value" 'BEGIN {
+    for (k = 0; k < 256; k++) {
+        printf("(key%03d, " value ")\n", k, 1596 + int(k / 64), k % 64)
+    }
+}' > "$work_dir/expected"
+cp "$work_dir/plain/big.job" "$work_dir/z/big.job"
+echo "SHOW" > "$work_dir/recover/recover.job"
+
+# The server keeps running after its jobs, so it is stopped once SHOW has
+# written the whole store (or after 30 seconds)
+run_until_shown() {
+    "$executable" "${@:2}" &> /dev/null &
+    local server_pid=$!
+    for _ in $(seq 1 300); do
+        if [ -f "$1" ] && [ "$(wc -l < "$1")" = "256" ]; then
+            break
+        fi
+        sleep 0.1
+    done
+    # Gives the backup process time to finish
+    sleep 0.2
+    kill "$server_pid"
+    wait "$server_pid" 2> /dev/null
+}
+run_until_shown "$work_dir/plain/big.out" "$work_dir/plain" 1 1 "$work_dir/reg"
+run_until_shown "$work_dir/z/big.out" -z -w "$work_dir/wal" "$work_dir/z" 1 1 "$work_dir/reg"
+run_until_shown "$work_dir/recover/recover.out" -w "$work_dir/wal" "$work_dir/recover" 1 1 "$work_dir/reg"
+
+status=0
+plain_size=$(stat -c %s "$work_dir/plain/big-1.bck" 2> /dev/null || echo 0)
+z_size=$(stat -c %s "$work_dir/z/big-1.bck" 2> /dev/null || echo 0)
+if [ "$(head -c 4 "$work_dir/z/big-1.bck" 2> /dev/null)" = "KVZ1" ] && [ "$z_size" -lt "$plain_size" ]; then
+    echo -e "\e[32mTest passed: compressed backup ($z_size of $plain_size bytes)\e[0m"
+else
+    echo -e "\e[31mTest failed: compressed backup\e[0m"
+    status=1
+fi
+if [ "$(head -c 4 "$work_dir/wal/kvs.ckpt" 2> /dev/null)" = "KVZ1" ] && \
+    diff "$work_dir/recover/recover.out" "$work_dir/expected" > /dev/null; then
+    echo -e "\e[32mTest passed: store recovered from a compressed checkpoint\e[0m"
+else
+    echo -e "\e[31mTest failed: store not recovered from a compressed checkpoint\e[0m"
+    status=1
+fi
+rm -r "$work_dir"
+exit $status
@@ -0,0 +1,57 @@
+# Clients that write, read and delete the same keys in opposite orders, at
+# the same time. The server must lock the keys in a fixed order: otherwise
+# two requests wait for each other and every client hangs.
+if [ -z "$1" ] || [ -z "$2" ]; then
+    echo "Usage: $0 <server_executable> <client_executable>"
+    exit 1
+fi
+server=$(realpath "$1")
+client=$(realpath "$2")
+
+work_dir=$(mktemp -d)
+mkdir "$work_dir/jobs"
+"$server" -u "$work_dir/sock" -p 8 "$work_dir/jobs" 1 1 "$work_dir/reg" > "$work_dir/server.log" 2>&1 &
+server_pid=$!
+sleep 0.3
+
+# Half the clients list the keys in one order and half in the other
+for i in $(seq 1 8); do
+    for n in $(seq 1 1000); do
+        if [ $((i % 2)) -eq 0 ]; then
+            echo "WRITE [(apple,$i)(banana,$i)(cherry,$i)]"
+            echo "READ [apple,banana,cherry]"
+            echo "SUBSCRIBE [apple,cherry]"
+            echo "UNSUBSCRIBE [apple,cherry]"
+        else
+            echo "WRITE [(cherry,$i)(banana,$i)(apple,$i)]"
+            echo "READ [cherry,banana,apple]"
+            echo "SUBSCRIBE [cherry,apple]"
+            echo "UNSUBSCRIBE [cherry,apple]"
+            echo "DELETE [cherry,apple]"
+        fi
+    done > "$work_dir/$i.in"
+    echo "DISCONNECT" >> "$work_dir/$i.in"
+done
+
+failed=0
+client_pids=()
+for i in $(seq 1 8); do
+    timeout 30 "$client" "c$$-$i" "$work_dir/sock" < "$work_dir/$i.in" > "$work_dir/$i.out" 2>&1 &
+    client_pids+=($!)
+done
+for pid in "${client_pids[@]}"; do
+    if ! wait "$pid"; then
+        failed=1
+    fi
+done
+
+kill "$server_pid"
+wait "$server_pid" 2>/dev/null
+rm -rf "$work_dir"
+
+if [ "$failed" -eq 0 ]; then
+    echo -e "\e[32mTest passed: concurrent requests with keys in opposite orders\e[0m"
+else
+    echo -e "\e[31mTest failed: a client did not finish (deadlock?)\e[0m"
+    exit 1
+fi
@@ -0,0 +1,39 @@
+# Runs wal/write.job on a server with a WAL, stops it, and runs
+# wal/recover.job on a new server with the same WAL directory: the second
+# server must start with what the first one wrote.
+if [ -z "$1" ]; then
+    echo "Usage: $0 <executable>"
+    exit 1
+fi
+executable=$(realpath "$1")
+
+test_dir="tests-public/wal"
+work_dir=$(mktemp -d)
+mkdir "$work_dir/wal" "$work_dir/write" "$work_dir/recover"
+cp "$test_dir/write.job" "$work_dir/write/"
+cp "$test_dir/recover.job" "$work_dir/recover/"
+
+# The server keeps running after its jobs, waiting for clients
+timeout 1 "$executable" -w "$work_dir/wal" "$work_dir/write" 1 1 "$work_dir/reg" &> /dev/null
+timeout 1 "$executable" -w "$work_dir/wal" "$work_dir/recover" 1 1 "$work_dir/reg" &> /dev/null
+
+if diff "$work_dir/recover/recover.out" "$test_dir/recover.result"; then
+    echo -e "\e[32mTest passed: store recovered from the WAL\e[0m"
+    status=0
+else
+    echo -e "\e[31mTest failed: store not recovered from the WAL\e[0m"
+    status=1
+fi
+# An unreadable checkpoint: the segments it covered are gone, so the server
+# must refuse to start rather than start with part of the store
+echo "garbage" > "$work_dir/wal/kvs.ckpt"
+timeout 1 "$executable" -w "$work_dir/wal" "$work_dir/recover" 1 1 "$work_dir/reg" &> /dev/null
+result=$?
+if [ "$result" -ne 0 ] && [ "$result" -ne 124 ]; then
+    echo -e "\e[32mTest passed: unreadable checkpoint rejected\e[0m"
+else
+    echo -e "\e[31mTest failed: server started with an unreadable checkpoint\e[0m"
+    status=1
+fi
+rm -r "$work_dir"
+exit $status
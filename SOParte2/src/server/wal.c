@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "wal.h"
+#include "compress.h"
+#include "constants.h"
+#include "src/common/io.h"
+
+// Cada linha do log tem o formato "<lsn> W <chave> <valor>" ou "<lsn> D <chave>".
+// As chaves e valores nunca têm espaços (o parser rejeita-os), por isso o
+// formato de texto é suficiente e fácil de inspecionar.
+#define WAL_LINE_SIZE (2 * MAX_STRING_SIZE + 64)
+
+static pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wal_cond = PTHREAD_COND_INITIALIZER;
+
+static char wal_dir[MAX_JOB_FILE_NAME_SIZE / 2]; // Metade, para caber o nome dos ficheiros
+static int wal_fd = -1;
+static int wal_closed = 0;
+static unsigned long wal_segment = 0;     // Segmento onde se escreve atualmente
+static unsigned long wal_lsn = 0;         // Última posição atribuída
+static size_t wal_bytes = 0;              // Bytes escritos desde o último checkpoint
+static unsigned long ckpt_segment = 0;    // Primeiro segmento não coberto pelo checkpoint em curso
+
+static void segment_path(char *path, unsigned long segment) {
+    snprintf(path, MAX_JOB_FILE_NAME_SIZE, "%s/" WAL_SEGMENT_PREFIX "-%lu.wal", wal_dir, segment);
+}
+
+static int compare_segments(const void *a, const void *b) {
+    unsigned long x = *(const unsigned long *)a;
+    unsigned long y = *(const unsigned long *)b;
+    return (x > y) - (x < y);
+}
+
+// Lista os segmentos existentes na diretoria, por ordem crescente.
+// Devolve o número de segmentos encontrados; *segments tem de ser libertado.
+static size_t list_segments(unsigned long **segments) {
+    size_t count = 0;
+    size_t capacity = 16;
+    *segments = malloc(capacity * sizeof(unsigned long));
+
+    DIR *dir = opendir(wal_dir);
+    if (dir == NULL || *segments == NULL) {
+        if (dir != NULL) {
+            closedir(dir);
+        }
+        return 0;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned long segment;
+        char suffix[8];
+        if (sscanf(entry->d_name, WAL_SEGMENT_PREFIX "-%lu.%7s", &segment, suffix) != 2 ||
+            strcmp(suffix, "wal") != 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            unsigned long *grown = realloc(*segments, capacity * sizeof(unsigned long));
+            if (grown == NULL) {
+                break;
+            }
+            *segments = grown;
+        }
+        (*segments)[count++] = segment;
+    }
+    closedir(dir);
+
+    qsort(*segments, count, sizeof(unsigned long), compare_segments);
+    return count;
+}
+
+// Carrega o checkpoint para a tabela e guarda em *lsn a posição do log que
+// cobre, 0 se não houver checkpoint. Os segmentos que cobre já foram
+// apagados, por isso um checkpoint ilegível é um erro e não um arranque vazio.
+// @return 0 em caso de sucesso, 1 se o checkpoint existe mas não se lê.
+static int load_checkpoint(HashTable *ht, unsigned long *lsn) {
+    char path[MAX_JOB_FILE_NAME_SIZE];
+    snprintf(path, MAX_JOB_FILE_NAME_SIZE, "%s/" CHECKPOINT_FILE, wal_dir);
+
+    *lsn = 0;
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        perror("Failed to open checkpoint");
+        return 1;
+    }
+
+    // O checkpoint pode estar comprimido; é descomprimido para memória
+    size_t size;
+    char *content = compress_read_file(path, &size);
+    if (content == NULL) {
+        fprintf(stderr, "Failed to read checkpoint %s\n", path);
+        return 1;
+    }
+    FILE *file = size > 0 ? fmemopen(content, size, "r") : NULL;
+    char line[WAL_LINE_SIZE];
+    if (file == NULL || fgets(line, sizeof(line), file) == NULL || sscanf(line, "LSN %lu", lsn) != 1) {
+        fprintf(stderr, "Invalid checkpoint header in %s\n", path);
+        if (file != NULL) {
+            fclose(file);
+        }
+        free(content);
+        return 1;
+    }
+
+    char key[MAX_STRING_SIZE + 1];
+    char value[MAX_STRING_SIZE + 1];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "(%40[^,], %40[^)])", key, value) == 2) {
+            write_pair(ht, key, value);
+        }
+    }
+    fclose(file);
+    free(content);
+    return 0;
+}
+
+// Repete as operações de um segmento posteriores a ckpt_lsn.
+static void replay_segment(HashTable *ht, unsigned long segment, unsigned long ckpt_lsn) {
+    char path[MAX_JOB_FILE_NAME_SIZE];
+    segment_path(path, segment);
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror("Failed to open WAL segment");
+        return;
+    }
+
+    char line[WAL_LINE_SIZE];
+    char key[MAX_STRING_SIZE + 1];
+    char value[MAX_STRING_SIZE + 1];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        unsigned long lsn;
+        char op;
+        int fields = sscanf(line, "%lu %c %40s %40s", &lsn, &op, key, value);
+        if (fields < 3) {
+            // Linha incompleta: o servidor terminou a meio de uma escrita
+            break;
+        }
+        if (lsn > wal_lsn) {
+            wal_lsn = lsn;
+        }
+        if (lsn <= ckpt_lsn) {
+            continue;
+        }
+        if (op == 'W' && fields == 4) {
+            write_pair(ht, key, value);
+        } else if (op == 'D') {
+            delete_pair(ht, key);
+        }
+    }
+    fclose(file);
+}
+
+int wal_init(const char *dir, HashTable *ht) {
+    snprintf(wal_dir, sizeof(wal_dir), "%s", dir);
+
+    unsigned long ckpt_lsn;
+    if (load_checkpoint(ht, &ckpt_lsn) != 0) {
+        return 1;
+    }
+    wal_lsn = ckpt_lsn;
+
+    unsigned long *segments;
+    size_t count = list_segments(&segments);
+    for (size_t i = 0; i < count; i++) {
+        replay_segment(ht, segments[i], ckpt_lsn);
+    }
+    wal_segment = count > 0 ? segments[count - 1] + 1 : 1;
+    free(segments);
+
+    char path[MAX_JOB_FILE_NAME_SIZE];
+    segment_path(path, wal_segment);
+    wal_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal_fd == -1) {
+        perror("Failed to open WAL segment");
+        return 1;
+    }
+    return 0;
+}
+
+void wal_close(void) {
+    pthread_mutex_lock(&wal_mutex);
+    wal_closed = 1;
+    if (wal_fd != -1) {
+        close(wal_fd);
+        wal_fd = -1;
+    }
+    pthread_cond_broadcast(&wal_cond);
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+int wal_enabled(void) {
+    return wal_fd != -1;
+}
+
+static void wal_append(char op, const char *key, const char *value) {
+    char line[WAL_LINE_SIZE];
+
+    pthread_mutex_lock(&wal_mutex);
+    if (wal_fd == -1) {
+        pthread_mutex_unlock(&wal_mutex);
+        return;
+    }
+
+    int len;
+    if (value != NULL) {
+        len = snprintf(line, sizeof(line), "%lu %c %s %s\n", ++wal_lsn, op, key, value);
+    } else {
+        len = snprintf(line, sizeof(line), "%lu %c %s\n", ++wal_lsn, op, key);
+    }
+    if (write_all(wal_fd, line, (size_t)len) == 1) {
+        wal_bytes += (size_t)len;
+        if (wal_bytes >= CHECKPOINT_WAL_BYTES) {
+            pthread_cond_signal(&wal_cond);
+        }
+    }
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+void wal_log_write(const char *key, const char *value) {
+    wal_append('W', key, value);
+}
+
+void wal_log_delete(const char *key) {
+    wal_append('D', key, NULL);
+}
+
+int wal_wait_checkpoint(void) {
+    pthread_mutex_lock(&wal_mutex);
+    for (;;) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CHECKPOINT_INTERVAL_MS / 1000;
+        deadline.tv_nsec += (CHECKPOINT_INTERVAL_MS % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        int rc = 0;
+        while (!wal_closed && wal_bytes < CHECKPOINT_WAL_BYTES && rc != ETIMEDOUT) {
+            rc = pthread_cond_timedwait(&wal_cond, &wal_mutex, &deadline);
+        }
+        // Sem escritas desde o último checkpoint não há nada a truncar
+        if (wal_closed || wal_bytes > 0) {
+            break;
+        }
+    }
+    int closed = wal_closed;
+    pthread_mutex_unlock(&wal_mutex);
+    return closed;
+}
+
+int wal_checkpoint_begin(unsigned long *lsn) {
+    char path[MAX_JOB_FILE_NAME_SIZE];
+
+    // Roda o segmento: tudo o que tiver posição <= *lsn fica nos segmentos antigos
+    pthread_mutex_lock(&wal_mutex);
+    if (wal_fd == -1) {
+        pthread_mutex_unlock(&wal_mutex);
+        return -1;
+    }
+    segment_path(path, wal_segment + 1);
+    int new_fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (new_fd == -1) {
+        perror("Failed to open WAL segment");
+        pthread_mutex_unlock(&wal_mutex);
+        return -1;
+    }
+    close(wal_fd);
+    wal_fd = new_fd;
+    ckpt_segment = ++wal_segment;
+    *lsn = wal_lsn;
+    wal_bytes = 0;
+    pthread_mutex_unlock(&wal_mutex);
+
+    snprintf(path, MAX_JOB_FILE_NAME_SIZE, "%s/" CHECKPOINT_FILE ".tmp", wal_dir);
+    int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644);
+    if (fd == -1) {
+        perror("Failed to open checkpoint file");
+        return -1;
+    }
+
+    char header[32];
+    int len = snprintf(header, sizeof(header), "LSN %lu\n", *lsn);
+    if (compress_write_header(fd) != 1 || compress_write(fd, header, (size_t)len) != 1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int wal_checkpoint_end(int fd) {
+    char tmp_path[MAX_JOB_FILE_NAME_SIZE];
+    char path[MAX_JOB_FILE_NAME_SIZE];
+    snprintf(tmp_path, MAX_JOB_FILE_NAME_SIZE, "%s/" CHECKPOINT_FILE ".tmp", wal_dir);
+    snprintf(path, MAX_JOB_FILE_NAME_SIZE, "%s/" CHECKPOINT_FILE, wal_dir);
+
+    if (fsync(fd) != 0) {
+        perror("Failed to sync checkpoint file");
+        close(fd);
+        return 1;
+    }
+    close(fd);
+
+    // O rename é atómico: ou fica o checkpoint antigo ou o novo, nunca metade
+    if (rename(tmp_path, path) != 0) {
+        perror("Failed to install checkpoint file");
+        return 1;
+    }
+
+    // Os segmentos anteriores ao atual só contêm posições <= lsn
+    unsigned long *segments;
+    size_t count = list_segments(&segments);
+    for (size_t i = 0; i < count && segments[i] < ckpt_segment; i++) {
+        segment_path(path, segments[i]);
+        unlink(path);
+    }
+    free(segments);
+    return 0;
+}
@@ -0,0 +1,45 @@
+#ifndef KVS_WAL_H
+#define KVS_WAL_H
+
+#include "kvs.h"
+
+/// Ativa o registo de escritas (WAL) na diretoria indicada.
+/// Carrega o último checkpoint e repete os segmentos de log posteriores para
+/// a tabela, abrindo depois um segmento novo para as próximas operações.
+/// @param dir Diretoria onde ficam os segmentos e o checkpoint.
+/// @param ht Tabela a reconstruir.
+/// @return 0 em caso de sucesso, 1 caso contrário (também se o checkpoint
+/// existir mas não se puder ler).
+int wal_init(const char *dir, HashTable *ht);
+
+/// Fecha o segmento de log atual.
+void wal_close(void);
+
+/// @return 1 se o WAL estiver ativo, 0 caso contrário.
+int wal_enabled(void);
+
+/// Regista a escrita de um par. Deve ser chamado com o lock da chave.
+/// @param key Chave escrita.
+/// @param value Valor escrito.
+void wal_log_write(const char *key, const char *value);
+
+/// Regista a remoção de uma chave. Deve ser chamado com o lock da chave.
+/// @param key Chave apagada.
+void wal_log_delete(const char *key);
+
+/// Bloqueia até ser necessário um novo checkpoint, seja porque passou
+/// CHECKPOINT_INTERVAL_MS ou porque o log cresceu CHECKPOINT_WAL_BYTES.
+/// @return 0 quando for altura de fazer checkpoint, 1 se o WAL foi fechado.
+int wal_wait_checkpoint(void);
+
+/// Começa um checkpoint: roda o segmento de log e abre o ficheiro temporário.
+/// @param lsn Onde guardar a última posição do log coberta pelo checkpoint.
+/// @return Descritor do ficheiro temporário, -1 em caso de erro.
+int wal_checkpoint_begin(unsigned long *lsn);
+
+/// Termina um checkpoint: torna-o definitivo e apaga os segmentos antigos.
+/// @param fd Descritor devolvido por wal_checkpoint_begin.
+/// @return 0 em caso de sucesso, 1 caso contrário.
+int wal_checkpoint_end(int fd);
+
+#endif  // KVS_WAL_H